@@ -0,0 +1,92 @@
+/*
+* TSP
+* Copyright (C) Zach Wilder 2024
+*
+* This file is a part of TSP
+*
+* TSP is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* TSP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with TSP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef COORDS_H
+#define COORDS_H
+
+#include <stdlib.h>
+#include <math.h>
+
+/*****
+ * Distance metrics. These follow the TSPLIB definitions (EDGE_WEIGHT_TYPE), so
+ * every distance is rounded to an int:
+ *  - METRIC_MAN_2D  nint(|dx| + |dy|), same as man_dist() for integer points
+ *  - METRIC_EUC_2D  nint(sqrt(dx^2 + dy^2))
+ *  - METRIC_CEIL_2D ceil(sqrt(dx^2 + dy^2))
+ *  - METRIC_GEO     Great circle distance in km, x/y are latitude/longitude in
+ *                   DDD.MM (degrees.minutes) format
+ *  - METRIC_EXPLICIT No formula - the distances only exist as a stored matrix
+ *  - METRIC_ATT     TSPLIB "pseudo-Euclidean" distance, sqrt((dx^2 + dy^2)/10)
+ *                   rounded up if nint() would round it down
+ *****/
+typedef enum {
+    METRIC_MAN_2D   = 0,
+    METRIC_EUC_2D   = 1,
+    METRIC_CEIL_2D  = 2,
+    METRIC_GEO      = 3,
+    METRIC_EXPLICIT = 4,
+    METRIC_ATT      = 5
+} Metric;
+
+/*****
+ * Coordinates are kept as a struct of arrays (all the x's, then all the y's)
+ * rather than an array of Vec2i, so that one city can be compared against a
+ * run of other cities with SIMD loads.
+ *****/
+typedef struct {
+    int n;
+    double *x;
+    double *y;
+} TSP_Coords;
+
+/*****
+ * coords.c
+ *****/
+TSP_Coords* create_coords(int n);
+TSP_Coords* create_coords_from_vec(const Vec2i *points, int n);
+void destroy_coords(TSP_Coords *c);
+int geo_dist(const TSP_Coords *c, int i, int j);
+double coord_tour_bound(const TSP_Coords *c, int metric);
+void coord_dist_row(const TSP_Coords *c, int metric, int i, int from,
+        int count, int *out);
+void coord_dist_gather(const TSP_Coords *c, int metric, int i,
+        const int *js, int count, int *out);
+
+static inline int att_dist(double dx, double dy) {
+    double r = sqrt((dx * dx + dy * dy) / 10.0);
+    int t = (int)(r + 0.5);
+    return (t < r) ? t + 1 : t;
+}
+
+static inline int coord_dist(const TSP_Coords *c, int metric, int i, int j) {
+    /* Distance between city i and city j under metric */
+    double dx = c->x[i] - c->x[j];
+    double dy = c->y[i] - c->y[j];
+    switch(metric) {
+        case METRIC_MAN_2D: return (int)(fabs(dx) + fabs(dy) + 0.5);
+        case METRIC_EUC_2D: return (int)(sqrt(dx * dx + dy * dy) + 0.5);
+        case METRIC_CEIL_2D: return (int)ceil(sqrt(dx * dx + dy * dy));
+        case METRIC_GEO: return geo_dist(c, i, j);
+        case METRIC_ATT: return att_dist(dx, dy);
+        default: break;
+    }
+    return 0;
+}
+
+#endif //COORDS_H
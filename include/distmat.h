@@ -0,0 +1,143 @@
+/*
+* TSP
+* Copyright (C) Zach Wilder 2024
+*
+* This file is a part of TSP
+*
+* TSP is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* TSP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with TSP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef DISTMAT_H
+#define DISTMAT_H
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*****
+ * Rows start on a cache line boundary, and each row is padded out to a whole
+ * number of cache lines so that a row can be walked with aligned SIMD loads.
+ *****/
+#define DM_ALIGN 64
+#define DM_STRIDE_ALIGN ((int)(DM_ALIGN / sizeof(int)))
+#define DM_STRIDE_ALIGN16 ((int)(DM_ALIGN / sizeof(uint16_t)))
+
+/*****
+ * Storage modes
+ *  - DM_FULL stores all n * n entries, row by row.
+ *  - DM_SYMMETRIC stores only the upper triangle (diagonal included, so the
+ *    index math never has to special case i == j), which is n(n+1)/2 entries -
+ *    about half the memory. Only valid when dist(i,j) == dist(j,i), which is
+ *    always true for man_dist().
+ *  - DM_ORACLE stores nothing at all, and calculates each distance from a set
+ *    of TSP_Coords (which the matrix borrows, it doesn't own them) when it is
+ *    asked for. Memory is O(n) instead of O(n^2).
+ *  - DM_QUANT16 stores all n * n entries like DM_FULL, but as uint16_t - twice
+ *    as many distances per cache line. A distance is qoffset + q * qscale, with
+ *    qoffset/qscale picked from the range of the data when the matrix is made
+ *    (create_quantized_dist_matrix). If the range fits in 16 bits qscale is 1
+ *    and nothing is lost, otherwise each distance may be off by up to qerr.
+ *    dm_get() still hands back an int, so solvers keep adding up costs in 32
+ *    bits.
+ *****/
+typedef enum {
+    DM_FULL         = 0,
+    DM_SYMMETRIC    = 1,
+    DM_ORACLE       = 2,
+    DM_QUANT16      = 3
+} DistMatrixMode;
+
+typedef struct {
+    int n;      // Number of nodes (rows/columns)
+    int stride; // Ints per row, n rounded up to DM_STRIDE_ALIGN (0 if packed)
+    int mode;   // DistMatrixMode
+    int *data;  // One allocation, n * stride ints (or n(n+1)/2 if packed)
+    const TSP_Coords *coords; // DM_ORACLE only
+    int metric;               // DM_ORACLE only, see Metric in coords.h
+    uint16_t *q16;            // DM_QUANT16 only, n * stride entries
+    int qoffset;              // DM_QUANT16 only
+    int qscale;               // DM_QUANT16 only
+    int qerr;                 // DM_QUANT16 only, worst rounding error
+} DistMatrix;
+
+/*****
+ * DistMatrix functions
+ * distmat.c
+ *****/
+DistMatrix* create_dist_matrix(int n);
+DistMatrix* create_sym_dist_matrix(int n);
+DistMatrix* create_oracle_dist_matrix(const TSP_Coords *coords, int metric);
+DistMatrix* create_quantized_dist_matrix(const DistMatrix *src);
+size_t dm_bytes(const DistMatrix *m);
+void destroy_dist_matrix(DistMatrix *m);
+void dm_fill(DistMatrix *m, int value);
+void dm_get_row(const DistMatrix *m, int i, int from, int count, int *out);
+bool dm_is_symmetric(const DistMatrix *m);
+long dm_tour_bound(const DistMatrix *m);
+int dm_default_threads(void);
+bool dm_build(DistMatrix *m, const TSP_Coords *c, int metric, int nthreads);
+
+/*****
+ * Inline accessors - these are in the hot loop of every solver, so they live
+ * here where the compiler can see them.
+ *****/
+static inline size_t dm_sym_index(int n, int i, int j) {
+    /* Index of (i,j) in the packed upper triangle. Swap so a <= b without a
+     * branch: d is (i - j) when i < j and 0 otherwise. Row a starts after
+     * n + (n-1) + ... + (n-a+1) = a(2n - a + 1)/2 entries. */
+    int d = (i - j) & ((i - j) >> (sizeof(int) * CHAR_BIT - 1));
+    size_t a = (size_t)(j + d); // min(i,j)
+    size_t b = (size_t)(i - d); // max(i,j)
+    return (a * (2 * (size_t)n - a + 1)) / 2 + (b - a);
+}
+
+static inline int* dm_row(const DistMatrix *m, int i) {
+    /* Pointer to the start of row i - DM_FULL matrices only */
+    return m->data + (size_t)i * m->stride;
+}
+
+static inline int dm_get(const DistMatrix *m, int i, int j) {
+    switch(m->mode) {
+        case DM_SYMMETRIC: return m->data[dm_sym_index(m->n, i, j)];
+        case DM_ORACLE: return coord_dist(m->coords, m->metric, i, j);
+        case DM_QUANT16:
+            return m->qoffset + m->q16[(size_t)i * m->stride + j] * m->qscale;
+        default: break;
+    }
+    return m->data[(size_t)i * m->stride + j];
+}
+
+static inline uint16_t dm_quantize(const DistMatrix *m, int d) {
+    /* Nearest 16 bit value for d on m's scale, clamped to fit */
+    long q = ((long)d - m->qoffset + m->qscale / 2) / m->qscale;
+    if(q < 0) q = 0;
+    if(q > UINT16_MAX) q = UINT16_MAX;
+    return (uint16_t)q;
+}
+
+static inline void dm_set(DistMatrix *m, int i, int j, int d) {
+    /* For DM_SYMMETRIC this sets both (i,j) and (j,i). DM_ORACLE has nowhere
+     * to put d, so it is ignored. DM_QUANT16 rounds d onto its scale. */
+    switch(m->mode) {
+        case DM_SYMMETRIC: m->data[dm_sym_index(m->n, i, j)] = d; break;
+        case DM_ORACLE: break;
+        case DM_QUANT16:
+            m->q16[(size_t)i * m->stride + j] = dm_quantize(m, d);
+            break;
+        default: m->data[(size_t)i * m->stride + j] = d; break;
+    }
+}
+
+#endif //DISTMAT_H
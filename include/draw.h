@@ -27,6 +27,7 @@ extern Glyph *g_screenbuf; /* draw.c */
 
 void init_screenbuf(void);
 void close_screenbuf(void);
+void draw_invalidate(void);
 void draw_glyph(int x, int y, Glyph g);
 void draw_screen(Glyph *screen);
 void draw_str(int x, int y, char *str);
@@ -0,0 +1,72 @@
+/*
+* TSP
+* Copyright (C) Zach Wilder 2024
+*
+* This file is a part of TSP
+*
+* TSP is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* TSP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with TSP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef GENERATE_H
+#define GENERATE_H
+
+/*****
+ * Random instances for testing, up to millions of cities (./TSP --generate).
+ *
+ * Only coordinates are made - never a matrix - and they're whole numbers in
+ * [0, size), so TSPLIB and .tspb files of the same instance are identical.
+ *
+ *   uniform    scattered evenly over the square
+ *   clustered  Gaussian blobs around random centres, each its own spread
+ *   grid       a lattice, filled row by row (no randomness at all)
+ *   ring       concentric rings, more cities on the longer ones, a little
+ *              noise in the radius
+ *   road       towns joined to their nearest neighbours by straight roads;
+ *              most cities strung along the roads, the rest around the towns
+ *
+ * groups is the number of blobs, rings or towns (0 for a default that grows
+ * with n).
+ *
+ * Generation is split into GEN_CHUNK-city pieces shared out between threads.
+ * Piece k draws from stream k + 1 of the seed (rng_split()) and the layout -
+ * centres, rings, roads - from stream 0, so a seed gives the same instance
+ * whatever the thread count.
+ *****/
+#define GEN_CHUNK 65536
+#define GEN_SIZE 1000000       // Default side of the square
+
+typedef enum {
+    GEN_UNIFORM     = 0,
+    GEN_CLUSTERED   = 1,
+    GEN_GRID        = 2,
+    GEN_RING        = 3,
+    GEN_ROAD        = 4
+} GenKind;
+
+#define GEN_KINDS 5
+
+typedef struct {
+    GenKind kind;
+    int n;
+    uint64_t seed;
+    double size;        // Coordinates are in [0, size)
+    int groups;
+} GenOptions;
+
+/*****
+ * generate.c
+ *****/
+const char* gen_kind_name(GenKind kind);
+TSP_Coords* generate_coords(const GenOptions *g, int nthreads);
+
+#endif //GENERATE_H
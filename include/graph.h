@@ -0,0 +1,62 @@
+/*
+* TSP
+* Copyright (C) Zach Wilder 2024
+*
+* This file is a part of TSP
+*
+* TSP is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* TSP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with TSP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef GRAPH_H
+#define GRAPH_H
+
+#include <stdbool.h>
+
+/*****
+ * A sparse graph in CSR (compressed sparse row) form - the arcs leaving node u
+ * are col[rowptr[u]] .. col[rowptr[u+1] - 1], with weights in w[] alongside.
+ * Each row is sorted by weight, cheapest first. An undirected edge is stored
+ * as two arcs.
+ *
+ * GRAPH_INF stands for "no arc"/"no path" inside graph.c and the graph
+ * solvers - it never ends up in a matrix, graph_shortest_paths() turns down
+ * graphs that aren't connected. Arc weights have to be below it, and a road
+ * network's small enough that no tour can overflow an int (see
+ * load_graph_edges()).
+ *****/
+#define GRAPH_INF (INT_MAX / 4)
+
+typedef struct {
+    int n;          // Nodes
+    int narcs;      // Arcs stored (2 per undirected edge)
+    int *rowptr;    // n + 1 entries
+    int *col;       // narcs entries, the node each arc goes to
+    int *w;         // narcs entries, the weight of each arc
+} TSP_Graph;
+
+/*****
+ * graph.c
+ *****/
+TSP_Graph* create_graph_edges(int n, int m, const int *u, const int *v,
+        const int *w, bool undirected);
+void destroy_graph(TSP_Graph *g);
+TSP_Graph* load_graph_edges(const char *fname);
+int graph_arc_weight(const TSP_Graph *g, int u, int v);
+DistMatrix* graph_shortest_paths(const TSP_Graph *g, int nthreads);
+
+/*****
+ * delaunay.c
+ *****/
+TSP_Graph* create_delaunay_graph(const TSP_Coords *c, int metric, int quad);
+
+#endif //GRAPH_H
@@ -0,0 +1,119 @@
+/*
+* TSP
+* Copyright (C) Zach Wilder 2024
+*
+* This file is a part of TSP
+*
+* TSP is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* TSP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with TSP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*****
+ * A problem instance - the cities, and how to get the distance between them.
+ * dist is always set. coords is set when the instance came from coordinates
+ * (and then dist may be an oracle matrix pointing at them), and is NULL for
+ * instances that only have a distance table.
+ *
+ * If map is set, the coordinate/matrix data lives in a read-only mmap'd file
+ * instead of being malloc'd, so don't dm_set() into it.
+ *
+ * Instances loaded from a road network (an edge list, see graph.c) keep the
+ * graph too: dist is its shortest paths, and graph is what TSP_Options
+ * roads_only solves on.
+ *****/
+typedef struct {
+    int n;
+    int metric;         // Metric (coords.h)
+    TSP_Coords *coords;
+    DistMatrix *dist;
+    TSP_Graph *graph;   // Road network dist was completed from, or NULL
+    void *map;          // mmap'd file, or NULL
+    size_t maplen;
+} TSP_Instance;
+
+/*****
+ * Binary instance file (.tspb)
+ *
+ * [TSP_BinHeader, 64 bytes][coords x][coords y][matrix]
+ *
+ * Every section starts on a 64 byte boundary (from the start of the file, and
+ * mmap() hands back page aligned memory) so the sections can be used in place
+ * as TSP_Coords/DistMatrix data - loading is an mmap(), no parsing, no copying.
+ * Numbers are in the byte order of the machine that wrote the file. The magic
+ * is a byte string, so it reads the same either way - it's the version field
+ * (1 one way round, 1 << 24 the other) that turns away a file from a machine
+ * with the other byte order.
+ *
+ * The checksum is 64 bit FNV-1a over everything after the header.
+ *****/
+#define TSPB_MAGIC "TSPB\x01\x02\x03\x04"
+#define TSPB_VERSION 1
+#define TSPB_ALIGN 64
+#define FNV64_INIT 0xcbf29ce484222325ULL
+
+typedef enum {
+    TSPB_ELEM_NONE  = 0, // No matrix stored
+    TSPB_ELEM_I32   = 1  // int32 distances
+} TSPB_ElemType;
+
+typedef enum {
+    TSPB_SYMMETRIC  = 1 << 0, // Matrix is packed upper triangle
+    TSPB_HAS_COORDS = 1 << 1,
+    TSPB_HAS_MATRIX = 1 << 2
+} TSPB_Flags;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t n;
+    uint32_t metric;
+    uint32_t elem_type;     // TSPB_ElemType
+    uint32_t flags;         // TSPB_Flags
+    uint32_t stride;        // Matrix row stride in elements, 0 if packed
+    uint64_t coords_off;    // Byte offset of x[n], y[n] follows at the next
+                            // TSPB_ALIGN boundary
+    uint64_t matrix_off;    // Byte offset of the matrix
+    uint64_t payload_len;   // Bytes after the header
+    uint64_t checksum;
+} TSP_BinHeader;
+
+/*****
+ * instance.c
+ *****/
+TSP_Instance* create_instance_coords(TSP_Coords *coords, int metric,
+        int mode);
+TSP_Instance* create_instance_matrix(DistMatrix *dist);
+void destroy_instance(TSP_Instance *inst);
+uint64_t fnv1a64(uint64_t h, const void *buf, size_t len);
+bool save_instance_bin(const TSP_Instance *inst, const char *fname);
+TSP_Instance* load_instance_bin(const char *fname, bool verify);
+
+/*****
+ * graph.c
+ *****/
+TSP_Instance* load_instance_graph(const char *fname);
+
+/*****
+ * tsplib.c
+ *****/
+TSP_Instance* parse_tsplib(const char *buf, size_t len, int mode);
+TSP_Instance* load_instance_tsplib(const char *fname, int mode);
+bool save_instance_tsplib(const TSP_Instance *inst, const char *fname,
+        const char *name);
+
+#endif //INSTANCE_H
@@ -0,0 +1,55 @@
+/*
+* TSP
+* Copyright (C) Zach Wilder 2024
+*
+* This file is a part of TSP
+*
+* TSP is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* TSP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with TSP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef KDTREE_H
+#define KDTREE_H
+
+/*****
+ * A 2-d tree over a set of coordinates, for "which cities are near this one"
+ * questions in O(log n) instead of a scan of every city.
+ *
+ * The tree is implicit - no nodes are allocated. The cities are reordered so
+ * that each subtree is a contiguous run [lo, hi) of x/y/idx, split at its
+ * middle element along dim[mid]; everything left of mid is <= it along that
+ * axis, everything right of it is >=. Runs of KD_LEAF or fewer are scanned.
+ *
+ * Distances inside the tree are plain Euclidean on the x/y values, whatever the
+ * instance metric (for GEO that's degrees - close enough to pick candidates).
+ *****/
+#define KD_LEAF 8
+
+typedef struct {
+    int n;
+    const TSP_Coords *coords;   // What the tree was built over (not owned)
+    double *x;                  // Coordinates, in tree order
+    double *y;
+    int *idx;                   // City at each tree position
+    unsigned char *dim;         // Split axis at each tree position, 0 = x
+} TSP_KDTree;
+
+/*****
+ * kdtree.c
+ *****/
+TSP_KDTree* create_kdtree(const TSP_Coords *c);
+void destroy_kdtree(TSP_KDTree *t);
+int kdtree_nearest(const TSP_KDTree *t, double x, double y, int exclude);
+TSP_Graph* kdtree_candidates(const TSP_KDTree *t, int metric, int k,
+        bool quadrant, int nthreads);
+
+#endif //KDTREE_H
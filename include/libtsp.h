@@ -0,0 +1,312 @@
+/*
+* TSP
+* Copyright (C) Zach Wilder 2024
+*
+* This file is a part of TSP
+*
+* TSP is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* TSP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with TSP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef LIBTSP_H
+#define LIBTSP_H
+
+#include <stdbool.h>
+
+/*****
+ * libtsp - the solvers, without the terminal demo.
+ *
+ * Everything goes through a TSP_Handle (one problem instance) and the result
+ * comes back in a TSP_Result the caller owns. The only global state is where
+ * diagnostics go (tsp_set_log()): a handle is never changed by solving it, so
+ * any number of threads can call tsp_solve() at once, on the same handle or
+ * different ones. Opening and closing a handle has to be done by one thread,
+ * like any other object.
+ *
+ * This header stands on its own - programs using the library only need this
+ * and -ltsp (plus -lm -pthread for the static library).
+ *****/
+
+typedef struct TSP_Handle TSP_Handle;
+
+/*
+ * Distance metrics, the same numbers as TSPLIB EDGE_WEIGHT_TYPE (see coords.h
+ * for how each is calculated)
+ */
+#define TSP_METRIC_MAN_2D   0
+#define TSP_METRIC_EUC_2D   1
+#define TSP_METRIC_CEIL_2D  2
+#define TSP_METRIC_GEO      3
+#define TSP_METRIC_ATT      5
+
+/*
+ * How the distance table is kept (see distmat.h). TSP_MATRIX_AUTO stores a
+ * packed table for up to 20000 cities and calculates distances as needed past
+ * that.
+ */
+#define TSP_MATRIX_AUTO     -1
+#define TSP_MATRIX_FULL     0
+#define TSP_MATRIX_SYM      1
+#define TSP_MATRIX_ORACLE   2
+#define TSP_MATRIX_QUANT16  3
+
+/*
+ * Seconds TSP_SOLVER_AUTO gives itself when there's no time limit. Held-Karp
+ * is 2^n * n^2 steps in a 2^n * n * 2 int table, so it runs out of time (or
+ * memory - 160MB at 20 cities) long before the n <= 30 it can do.
+ */
+#define TSP_AUTO_SECONDS 1.0
+
+typedef enum {
+    TSP_SOLVER_AUTO     = 0,    // Picked per instance, see tsp_select_solver()
+    TSP_SOLVER_HK       = 1,    // Held-Karp, exact, n <= 30
+    TSP_SOLVER_NN       = 2,    // Nearest neighbor
+    TSP_SOLVER_2OPT     = 3,    // Nearest neighbor + 2-opt
+    TSP_SOLVER_ILS      = 4,    // 2-opt, then kicked and re-optimized
+    TSP_SOLVER_PORTFOLIO = 5    // HK, 2-opt and ILS racing on their own threads
+} TSP_Solver;
+
+#define TSP_SOLVERS 6
+
+typedef enum {
+    TSP_OK              = 0,
+    TSP_ERR_ARG         = 1,    // Bad argument
+    TSP_ERR_NOMEM       = 2,
+    TSP_ERR_TOO_BIG     = 3,    // Too many cities for the solver asked for
+    TSP_ERR_IO          = 4,    // Couldn't read the file
+    TSP_ERR_NO_TOUR     = 5     // The solver didn't find a tour
+} TSP_Error;
+
+/*
+ * Cancelling a solve from another thread (or a signal handler): pass the
+ * token in TSP_Options and call tsp_cancel() on it. The solver notices at its
+ * next check and hands back the best tour it has so far.
+ */
+typedef struct TSP_Cancel TSP_Cancel;
+
+/*
+ * Where a solve has got to, for TSP_Options.progress. done is the fraction
+ * of the work finished (Held-Karp's subsets, ILS's kicks), or -1 for solvers
+ * that can't tell (2-opt runs until nothing improves).
+ */
+typedef struct {
+    TSP_Solver solver;  // Engine reporting
+    double done;
+    int best;           // Cost of the best tour so far, INT_MAX if none yet
+    double seconds;     // Since the solve started
+} TSP_Progress;
+
+typedef void (*TSP_ProgressFn)(const TSP_Progress *p, void *arg);
+
+/*
+ * How good a tour TSP_SOLVER_AUTO has to come up with. Each level lets in the
+ * solvers below it too, and the fastest of those wins - so TSP_QUALITY_GOOD on
+ * 10 cities can still be Held-Karp. When nothing good enough fits in the
+ * budget, the best solver that does is used instead.
+ */
+typedef enum {
+    TSP_QUALITY_OPTIMAL = 0,    // Held-Karp
+    TSP_QUALITY_HIGH    = 1,    // ILS
+    TSP_QUALITY_GOOD    = 2,    // 2-opt
+    TSP_QUALITY_ANY     = 3     // Nearest neighbor will do
+} TSP_Quality;
+
+/*
+ * This machine's speed, in nanoseconds per step of each solver (select.c says
+ * what a step is). tsp_calibrate() measures it.
+ */
+typedef struct {
+    double hk;
+    double nn;
+    double two_opt;
+    double ils;
+} TSP_Calibration;
+
+/*
+ * Where 2-opt and ILS get their candidate lists (coordinate instances only).
+ * Both have TSP_Options.candidates cities per quadrant; the Delaunay edges on
+ * top link up cities that are close in a way "nearest" misses, like the two
+ * ends of a gap between clusters or along a road. That's worth a few percent
+ * on clustered and road-like instances, next to nothing on uniform ones.
+ */
+typedef enum {
+    TSP_CAND_QUADRANT   = 0,    // The nearest few in each quadrant (k-d tree)
+    TSP_CAND_DELAUNAY   = 1     // Delaunay triangulation, plus the quadrant
+                                // neighbours found two Delaunay edges away
+} TSP_CandidateKind;
+
+typedef struct {
+    TSP_Solver solver;
+    int candidates;     // 2-opt candidate cities per quadrant, 0 for default
+    TSP_CandidateKind candidates_kind;
+    double time_limit;  // Seconds to solve for, 0 for no limit. Past it the
+                        // best tour so far comes back.
+    TSP_Cancel *cancel; // NULL for none
+    TSP_ProgressFn progress; // Called now and then from the solving thread
+                        // (engine threads for the portfolio, one at a time)
+    void *progress_arg;
+    TSP_Quality quality;        // For TSP_SOLVER_AUTO
+    double memory_limit;        // Bytes AUTO may plan on, 0 to ask the system
+    const TSP_Calibration *calibration; // NULL for the built-in numbers
+    bool roads_only;    // Road networks (edge list files): a tour over the
+                        // roads given, not the shortest paths between cities.
+                        // Held-Karp or nearest neighbor only, no time limit,
+                        // and there may not be one (TSP_ERR_NO_TOUR)
+    bool reduce;        // Held-Karp and 2-opt: first throw out the edges a
+                        // 2-opt tour proves can't be in a better one. Worth
+                        // it for Held-Karp, costly for 2-opt (O(n^2) a step)
+} TSP_Options;
+
+/*
+ * What TSP_SOLVER_AUTO picked and why. seconds and bytes are the estimates
+ * for each solver (infinite for ones that can't run at this n), fits says
+ * which are inside both budgets. memory is infinite when every solver needed
+ * so little the system wasn't asked.
+ */
+typedef struct {
+    TSP_Solver solver;
+    double seconds[TSP_SOLVERS];
+    double bytes[TSP_SOLVERS];
+    bool fits[TSP_SOLVERS];
+    double time_budget;
+    double memory;
+    char why[256];      // One line, for logs
+} TSP_Selection;
+
+typedef struct {
+    TSP_Solver solver;  // Solver that actually ran, or whose tour won the
+                        // portfolio (never AUTO or PORTFOLIO)
+    int cost;
+    int n;
+    int *tour;          // n cities, starting at city 0; free with
+                        // tsp_free_result()
+    double seconds;     // Time spent solving
+    TSP_Error status;   // What tsp_solve() returned, for batches
+    bool stopped;       // Cut short by time_limit or cancel, so tour is the
+                        // best found rather than the solver's answer
+} TSP_Result;
+
+/*
+ * A batch of instances solved by a TSP_Pool. seconds is wall clock time for
+ * the whole batch, solve_seconds the sum of every result's seconds - with
+ * the threads kept busy it's close to seconds * threads.
+ */
+typedef struct {
+    int count;
+    int solved;
+    int failed;
+    int by_solver[TSP_SOLVERS]; // Instances solved by each TSP_Solver
+    int threads;
+    double seconds;
+    double solve_seconds;
+    double per_second;      // Instances per second of wall clock
+} TSP_BatchStats;
+
+typedef struct TSP_Pool TSP_Pool;
+
+/*
+ * Counters for a TSP_Cache. hits is mem_hits + disk_hits; evictions are tours
+ * dropped from memory to make room (they stay on disk if there is one).
+ */
+typedef struct {
+    long hits;
+    long mem_hits;
+    long disk_hits;
+    long misses;
+    long evictions;
+    int entries;            // Tours in memory
+    long disk_entries;      // Tours in the file
+} TSP_CacheStats;
+
+typedef struct TSP_Cache TSP_Cache;
+
+/*
+ * Where the library's diagnostics go - why a file was turned down, what
+ * couldn't be allocated - one line at a time, without the newline. They're
+ * extra detail for a TSP_Error or NULL that's returned anyway. The library
+ * never writes to stdout; until tsp_set_log() is called they go to stderr,
+ * and a NULL fn drops them.
+ */
+typedef void (*TSP_LogFn)(const char *msg, void *arg);
+
+/*****
+ * libtsp.c
+ *****/
+void tsp_default_options(TSP_Options *opt);
+TSP_Handle* tsp_open_coords(const double *x, const double *y, int n,
+        int metric, int matrix);
+TSP_Handle* tsp_open_matrix(const int *dist, int n);
+TSP_Handle* tsp_open_file(const char *fname, int matrix);
+void tsp_close(TSP_Handle *h);
+int tsp_size(const TSP_Handle *h);
+int tsp_distance(const TSP_Handle *h, int i, int j);
+TSP_Error tsp_solve(const TSP_Handle *h, const TSP_Options *opt,
+        TSP_Result *res);
+void tsp_free_result(TSP_Result *res);
+const char* tsp_strerror(TSP_Error err);
+const char* tsp_solver_name(TSP_Solver solver);
+TSP_Cancel* tsp_cancel_create(void);
+void tsp_cancel_destroy(TSP_Cancel *c);
+void tsp_cancel(TSP_Cancel *c);
+void tsp_cancel_reset(TSP_Cancel *c);
+void tsp_set_log(TSP_LogFn fn, void *arg);
+TSP_Error tsp_select_solver(const TSP_Handle *h, const TSP_Options *opt,
+        TSP_Selection *sel);
+
+/*****
+ * select.c - how TSP_SOLVER_AUTO decides
+ *
+ * A calibration only has to be measured once per machine; save it and load
+ * it into TSP_Options.calibration after that.
+ *****/
+void tsp_default_calibration(TSP_Calibration *cal);
+bool tsp_calibrate(TSP_Calibration *cal);
+bool tsp_calibration_save(const char *fname, const TSP_Calibration *cal);
+bool tsp_calibration_load(const char *fname, TSP_Calibration *cal);
+const char* tsp_quality_name(TSP_Quality quality);
+
+/*****
+ * batch.c - solving lots of instances at once
+ *
+ * A TSP_Pool is a fixed set of threads, each with its own scratch space, that
+ * stay around between batches. tsp_pool_solve() hands out the instances
+ * (results[i] is always handles[i]'s) and waits for the whole batch; only one
+ * batch runs on a pool at a time. Every result has to be freed with
+ * tsp_free_result(), the failed ones included.
+ *****/
+TSP_Pool* tsp_pool_create(int nthreads);
+void tsp_pool_destroy(TSP_Pool *pool);
+int tsp_pool_threads(const TSP_Pool *pool);
+void tsp_pool_set_cache(TSP_Pool *pool, TSP_Cache *cache);
+TSP_Error tsp_pool_solve(TSP_Pool *pool, TSP_Handle *const *handles,
+        int count, const TSP_Options *opt, TSP_Result *results,
+        TSP_BatchStats *stats);
+TSP_Error tsp_solve_batch(TSP_Handle *const *handles, int count,
+        const TSP_Options *opt, int nthreads, TSP_Result *results,
+        TSP_BatchStats *stats);
+
+/*****
+ * cache.c - answers for instances that have been solved before
+ *
+ * tsp_solve_cached() looks the instance up first, and only solves it (and
+ * files the tour) if it isn't there. The same cities in a different order, or
+ * a different handle for the same matrix, find the same entry. A cache can be
+ * shared by any number of threads, and by a TSP_Pool (tsp_pool_set_cache()),
+ * as long as it outlives them.
+ *****/
+TSP_Cache* tsp_cache_create(int entries, const char *path);
+void tsp_cache_destroy(TSP_Cache *cache);
+void tsp_cache_stats(TSP_Cache *cache, TSP_CacheStats *stats);
+TSP_Error tsp_solve_cached(TSP_Cache *cache, const TSP_Handle *h,
+        const TSP_Options *opt, TSP_Result *res);
+
+#endif //LIBTSP_H
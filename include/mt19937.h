@@ -45,9 +45,34 @@
 
 #include <stdlib.h> 
 #include <stdbool.h>
+#include <stdint.h>
 #include <limits.h>
 #include <time.h>
 
+#define MT_N 624
+
+/*
+ * Generator state. The functions without _r share one default state, so
+ * only one thread can use them; anything running in parallel keeps its own
+ * MT_State (set it up with init_genrand_r(), or MT_STATE_INIT for the same
+ * default seed the shared one gets).
+ */
+typedef struct {
+    unsigned long mt[MT_N];     /* the array for the state vector */
+    int mti;                    /* mti==MT_N+1 means mt[] is not initialized */
+} MT_State;
+
+#define MT_STATE_INIT {{0}, MT_N + 1}
+
+void init_genrand_r(MT_State *st, unsigned long s);
+void init_by_array_r(MT_State *st, unsigned long init_key[], int key_length);
+unsigned long genrand_int32_r(MT_State *st);
+long genrand_int31_r(MT_State *st);
+double genrand_real1_r(MT_State *st);
+double genrand_real2_r(MT_State *st);
+double genrand_real3_r(MT_State *st);
+double genrand_res53_r(MT_State *st);
+
 void init_genrand(unsigned long s);
 void init_by_array(unsigned long init_key[], int key_length);
 unsigned long genrand_int32(void);
@@ -61,6 +86,10 @@ double genrand_res53(void);
  * Functions below added by Zach Wilder, 2022, with the same conditions as
  * above.
  */
+int mt_rand_r(MT_State *st, int min, int max);
+bool mt_bool_r(MT_State *st);
+bool mt_chance_r(MT_State *st, int chance);
+
 int mt_rand(int min, int max); 
 bool mt_bool(void); 
 bool mt_chance(int chance);
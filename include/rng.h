@@ -0,0 +1,75 @@
+/*
+* TSP
+* Copyright (C) Zach Wilder 2024
+*
+* This file is a part of TSP
+*
+* TSP is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* TSP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with TSP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef RNG_H
+#define RNG_H
+
+/*****
+ * Random numbers in bulk, for instance generation and the metaheuristics.
+ *
+ * RNG_LANES independent xoshiro256** generators run side by side, with their
+ * state stored word-major (s[word][lane]) so one step of all of them is a
+ * handful of plain loops over RNG_LANES uint64_t's - which the compiler turns
+ * into SIMD (see rng_block()). Their outputs interleave into one stream:
+ * step 0 lane 0, step 0 lane 1, ..., step 1 lane 0, ... The rng_fill_*()
+ * functions write straight out of that; the one-at-a-time functions take
+ * from buf, a step's worth at a time, so mixing the two is fine and a seed
+ * gives the same u64s either way. (rng_fill_u32() gets two u32s out of each,
+ * rng_u32() only one.)
+ *
+ * Bounded ints use Lemire's multiply-and-shift with a rejection step, so every
+ * value in the range is exactly as likely - no modulo and no bias.
+ *
+ * A TSP_Rng is plain data: one per thread, no locking.
+ *
+ * Streams, for parallel runs that come out the same every time: stream k of
+ * a seed is stream 0 (rng_seed()) moved 2^192 steps ahead k times with
+ * xoshiro's long jump, and within a stream each lane starts 2^128 steps
+ * after the one before - so no two lanes of any streams ever draw the same
+ * numbers. Split the work into pieces of a fixed size and give piece k
+ * stream k (rng_split() sets up count streams in one pass), and the result
+ * depends only on the seed, not on how many threads there are or which one
+ * got which piece.
+ *****/
+#define RNG_LANES 8
+
+typedef struct {
+    uint64_t s[4][RNG_LANES];   // xoshiro256** state, word-major
+    uint64_t buf[RNG_LANES];    // The step being handed out one at a time
+    int left;                   // Words of buf not handed out yet
+} TSP_Rng;
+
+/*****
+ * rng.c
+ *****/
+void rng_seed(TSP_Rng *r, uint64_t seed);
+void rng_next_stream(TSP_Rng *r);
+void rng_stream(TSP_Rng *r, uint64_t seed, int k);
+void rng_split(uint64_t seed, TSP_Rng *out, int count);
+uint64_t rng_u64(TSP_Rng *r);
+uint32_t rng_u32(TSP_Rng *r);
+double rng_double(TSP_Rng *r);
+int rng_range(TSP_Rng *r, int min, int max);
+void rng_fill_u64(TSP_Rng *r, uint64_t *out, size_t count);
+void rng_fill_u32(TSP_Rng *r, uint32_t *out, size_t count);
+void rng_fill_double(TSP_Rng *r, double *out, size_t count);
+void rng_fill_range(TSP_Rng *r, int *out, size_t count, int min, int max);
+uint32_t rng_bounded(uint32_t x, uint32_t range, TSP_Rng *r);
+
+#endif //RNG_H
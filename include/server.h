@@ -0,0 +1,77 @@
+/*
+* TSP
+* Copyright (C) Zach Wilder 2024
+*
+* This file is a part of TSP
+*
+* TSP is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* TSP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with TSP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef SERVER_H
+#define SERVER_H
+
+/*****
+ * Solve server (./TSP --serve PATH)
+ *
+ * Listens on a Unix domain socket. A client can send any number of requests
+ * down one connection, mixing the two encodings below as it likes, and gets
+ * one response per request back in the order it sent them.
+ *
+ * JSON - one object per line:
+ *   {"id": 7, "solver": "hk", "metric": "EUC_2D", "coords": [[x, y], ...]}
+ *   {"id": "a", "matrix": [[0, 3, 4], [3, 0, 5], [4, 5, 0]]}
+ * id (a number or string, echoed back), solver (a tsp_solver_name()) and
+ * metric (a TSPLIB EDGE_WEIGHT_TYPE, default EUC_2D) are optional. A matrix
+ * has to be symmetric, in either encoding, and no tour over the cities can
+ * cost more than an int holds. Answers:
+ *   {"id": 7, "status": "ok", "solver": "hk", "cost": 212, "tour": [0, ...]}
+ *   {"id": 7, "status": "error", "error": "too many cities for this solver"}
+ *
+ * Binary - a TSP_SrvRequest followed by n x's then n y's as doubles, or n*n
+ * int32 distances row by row, in the host's byte order. Answered with a
+ * TSP_SrvResponse followed by n int32 cities of the tour.
+ *****/
+#define SRV_REQ_MAGIC "TSPQ"
+#define SRV_RESP_MAGIC "TSPR"
+
+typedef enum {
+    SRV_COORDS  = 0,
+    SRV_MATRIX  = 1
+} TSP_SrvKind;
+
+typedef struct {
+    char magic[4];      // SRV_REQ_MAGIC
+    uint32_t id;
+    uint8_t kind;       // TSP_SrvKind
+    uint8_t metric;     // TSP_METRIC_*, for SRV_COORDS
+    uint8_t solver;     // TSP_Solver
+    uint8_t pad;
+    uint32_t n;
+} TSP_SrvRequest;
+
+typedef struct {
+    char magic[4];      // SRV_RESP_MAGIC
+    uint32_t id;
+    int32_t status;     // TSP_Error
+    int32_t solver;     // Solver that ran
+    int32_t cost;
+    uint32_t n;         // Cities in the tour that follows, 0 on error
+} TSP_SrvResponse;
+
+/*****
+ * server.c
+ *****/
+int run_server(const char *path, const TSP_Options *opt, int mode, int jobs,
+        TSP_Cache *cache, bool stats);
+
+#endif //SERVER_H
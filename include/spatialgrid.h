@@ -0,0 +1,64 @@
+/*
+* TSP
+* Copyright (C) Zach Wilder 2024
+*
+* This file is a part of TSP
+*
+* TSP is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* TSP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with TSP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef SPATIALGRID_H
+#define SPATIALGRID_H
+
+/*****
+ * A uniform bucket grid over a set of Vec2i points, for "what's near here"
+ * questions in O(1) on average.
+ *
+ * The buckets aren't lists - the points are counting-sorted by cell into one
+ * array, so cell c is pos[cell_start[c]] .. pos[cell_start[c] + cell_len[c]].
+ * Removing a point swaps it to the end of its cell's run and shortens the
+ * run, so there are no mallocs after create and a scan of a cell is a scan of
+ * a few contiguous Vec2i's.
+ *
+ * Distances are straight line, or taxicab (man_dist()) if the grid was made
+ * that way.
+ *****/
+typedef struct {
+    Rect bounds;        // pos = smallest x/y, dim = width/height
+    int cell;           // Cell size
+    int cols;
+    int rows;
+    bool taxicab;
+    int n;              // Points the grid was built with
+    int live;           // Points not removed yet
+    int *cell_start;    // cols * rows
+    int *cell_len;      // Points left in each cell
+    Vec2i *pos;         // Points, in cell order
+    int *id;            // Index (into the array the grid was made from) of each
+    int *slot;          // Where each id is in pos/id now
+} SpatialGrid;
+
+/*********************
+ * SpatialGrid functions
+ *********************/
+SpatialGrid* create_SpatialGrid(const Vec2i *points, int n, int cell,
+        bool taxicab);
+void destroy_SpatialGrid(SpatialGrid *grid);
+bool remove_SpatialGrid(SpatialGrid *grid, int id);
+int radius_SpatialGrid(const SpatialGrid *grid, Vec2i p, int r, int *out,
+        int max);
+int nearest_SpatialGrid(const SpatialGrid *grid, Vec2i p, int exclude);
+int nearest_unvisited_SpatialGrid(const SpatialGrid *grid, Vec2i p,
+        const bool *visited);
+
+#endif //SPATIALGRID_H
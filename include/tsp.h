@@ -27,6 +27,15 @@
  *****/
 #define SIZE 15
 
+/*****
+ * Held-Karp needs (2^n * n) table entries, and the subsets are kept in an int
+ * bitmask - it won't go past this no matter how much memory there is.
+ *****/
+#define HK_MAX_N 30
+
+#define TSP_CANDIDATES 5        // Default 2-opt candidates per quadrant
+#define ILS_KICKS 1000          // ILS kicks if the caller doesn't say
+
 /*****
  * System
  *****/
@@ -35,19 +44,34 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <limits.h>
+#include <stdatomic.h>
 
 
 /*****
  * Toolbox
  *****/
 #include <mt19937.h>
+#include <rng.h>
 #include <vec2i.h>
 #include <rect.h>
+#include <spatialgrid.h>
 #include <slist.h>
 #include <term_engine.h>
 #include <glyph.h>
 #include <draw.h>
 
+/*****
+ * TSP
+ *****/
+#include <coords.h>
+#include <distmat.h>
+#include <graph.h>
+#include <instance.h>
+#include <kdtree.h>
+#include <generate.h>
+#include <libtsp.h>
+#include <server.h>
+
 /*****
  * TSP Structures
  *****/
@@ -57,11 +81,106 @@ typedef struct TSP_Data TSP_Data;
 
 struct TSP_Path {
     int cost;
-    int path[SIZE + 1];
+    int n;      // Number of nodes in the tour
+    int *path;  // n + 1 entries, path[n] == path[0] (the return trip)
 };
 
+/*****
+ * What reduce_edges() managed. edge_ratio is edges / edges left - only a count,
+ * not a time: what it saves depends on the solver (Held-Karp's work is per
+ * arc, 2-opt's mostly isn't), and seconds is what it cost.
+ *****/
+typedef struct {
+    long edges;         // n(n-1)/2
+    long eliminated;
+    double lower_bound; // 1-tree (Held-Karp) bound
+    int upper_bound;    // Incumbent tour cost
+    double edge_ratio;
+    double seconds;     // Spent in reduce_edges()
+} TSP_ReduceStats;
+
+/*****
+ * Scratch space for the solvers, for running a lot of instances one after the
+ * other (one per thread) without going back to malloc for each. Buffers only
+ * ever grow; the Held-Karp table is sized separately since it's 2^n * n.
+ *****/
+typedef struct {
+    int n;          // Cities visited/path have room for
+    int hk_n;       // Cities dp/prev have room for, 0 if not allocated yet
+    int *dp;        // Held-Karp costs, 2^hk_n * hk_n
+    int *prev;      // Held-Karp back pointers, same size
+    bool *visited;
+    int *path;      // n + 1
+} TSP_Workspace;
+
+/*****
+ * A 2-opt search that can be picked up again (twoopt.c). t is the tour in
+ * whatever rotation the moves have left it; a city is queued exactly when its
+ * don't-look bit is off. ILS keeps one for its whole run, so a kick only costs
+ * what it changes.
+ *****/
+typedef struct {
+    int n;
+    int *t;
+    int *pos;           // Where each city is in t
+    bool *dlb;          // Don't-look bits
+    int *queue;         // Ring of n, cities to look at
+    int head;
+    int queued;
+    int cost;           // Of t, kept up to date move by move
+    bool logging;       // Keep reversals in undo for two_opt_undo()
+    bool lost;          // A reversal couldn't be logged (out of memory)
+    int *undo;          // (i, j) position pairs
+    int nundo;
+    int undocap;
+} TwoOpt;
+
+/*****
+ * Deadlines and cancellation for the solvers. Each solve gets a TSP_Stop
+ * (stop_init()), and the solvers call tsp_stopped() at cheap points - every
+ * few thousand Held-Karp subsets, every few hundred 2-opt or nearest neighbor
+ * steps, every ILS kick. Once it says stop:
+ *  - held_karp_ws() gives up and returns NULL (half a table isn't a tour)
+ *  - nearest neighbor tacks the cities it hasn't reached on in order
+ *  - two_opt() and iterated_local_search() hand back the tour they have
+ * It stops when stop is set (by whoever owns it), the deadline passes, the
+ * caller's TSP_Cancel is cancelled or the parent stops - the portfolio gives
+ * its engines their own TSP_Stop with the solve's as the parent. Once any of
+ * those happens, stop is set so the next check is just the one load. A NULL
+ * TSP_Stop never stops.
+ *****/
+struct TSP_Cancel {
+    atomic_bool cancelled;
+};
+
+typedef struct TSP_Stop TSP_Stop;
+struct TSP_Stop {
+    atomic_bool stop;
+    double start;               // stop_now() when the solve began
+    double deadline;            // stop_now() time to stop at, 0 for never
+    const TSP_Cancel *cancel;
+    const TSP_Stop *parent;
+    TSP_ProgressFn progress;
+    void *arg;
+};
+
+bool stop_check(const TSP_Stop *s);
+
+static inline bool tsp_stopped(const TSP_Stop *s) {
+    if(!s) return false;
+    if(atomic_load_explicit(&((TSP_Stop *)s)->stop, memory_order_relaxed)) {
+        return true;
+    }
+    return stop_check(s);
+}
+
+/*****
+ * Called by iterated_local_search() each time it finds a better tour
+ *****/
+typedef void (*TSP_Improved)(const TSP_Path *tour, void *arg);
+
 struct TSP_Data {
-    int **dist;
+    DistMatrix *dist;
     TSP_Path *hk_path;
     TSP_Path *nn_path;
     int pos;
@@ -76,9 +195,18 @@ typedef enum {
 /*****
  * TSP Functions
  *****/
-TSP_Path* make_tsp_path(int path[SIZE + 1], int cost);
+TSP_Path* make_tsp_path(const int *path, int n, int cost);
 void destroy_tsp_path(TSP_Path *path);
 
+double stop_now(void);
+void stop_init(TSP_Stop *s, const TSP_Options *opt);
+void stop_progress(const TSP_Stop *s, TSP_Solver solver, double done,
+        int best);
+
+TSP_Workspace* create_workspace(void);
+void destroy_workspace(TSP_Workspace *ws);
+bool workspace_reserve(TSP_Workspace *ws, int n, bool hk);
+
 TSP_Data* init_tsp_data(void);
 void destroy_tsp_data(TSP_Data *data);
 
@@ -86,14 +214,98 @@ void destroy_tsp_data(TSP_Data *data);
  * Nearest Neighbor Functions
  * nearestneighbor.c
  *****/
-int find_nearest_neighbor(const int cur, int **table, const bool visited[SIZE]);
-TSP_Path* nearest_neighbor(int **dist);
+int find_nearest_neighbor(const int cur, const DistMatrix *table,
+        const bool *visited);
+TSP_Path* nearest_neighbor(const DistMatrix *dist);
+TSP_Path* nearest_neighbor_ws(const DistMatrix *dist, TSP_Workspace *ws,
+        const TSP_Stop *stop);
+TSP_Path* nearest_neighbor_graph(const TSP_Graph *g);
+TSP_Path* nearest_neighbor_cand(const DistMatrix *dist, const TSP_Graph *cand,
+        const TSP_Stop *stop);
+TSP_Path* nearest_neighbor_grid(const TSP_Coords *c, int metric,
+        const TSP_Stop *stop);
 
 /*****
  * Held-Karp Functions
  * heldkarp.c
  *****/
-TSP_Path* held_karp(int **dist, int start);
+TSP_Path* held_karp(const DistMatrix *dist, int start);
+TSP_Path* held_karp_ws(const DistMatrix *dist, int start, TSP_Workspace *ws,
+        const TSP_Stop *stop);
+TSP_Path* held_karp_graph(const TSP_Graph *g, int start,
+        const TSP_Stop *stop);
+
+/*****
+ * 2-opt Functions
+ * twoopt.c
+ *****/
+bool two_opt(const DistMatrix *dist, const TSP_Graph *cand, TSP_Path *tour,
+        const TSP_Stop *stop);
+bool two_opt_init(TwoOpt *s, const TSP_Path *tour, const DistMatrix *dist);
+void two_opt_free(TwoOpt *s);
+void two_opt_wake(TwoOpt *s, int a);
+bool two_opt_run(TwoOpt *s, const DistMatrix *dist, const TSP_Graph *cand,
+        const TSP_Stop *stop);
+void two_opt_undo(TwoOpt *s);
+void two_opt_tour(const TwoOpt *s, TSP_Path *tour);
+
+/*****
+ * Iterated Local Search
+ * ils.c
+ *****/
+bool iterated_local_search(const DistMatrix *dist, const TSP_Graph *cand,
+        TSP_Path *tour, int kicks, TSP_Rng *rng, const TSP_Stop *stop,
+        TSP_Improved improved, void *arg);
+
+/*****
+ * Portfolio
+ * portfolio.c
+ *****/
+TSP_Path* solve_portfolio(const TSP_Instance *inst, const TSP_Options *opt,
+        const TSP_Stop *stop, TSP_Solver *used, bool *stopped);
+
+/*****
+ * Edge Elimination Functions
+ * reduce.c
+ *****/
+TSP_Graph* reduce_edges(const DistMatrix *dist, const TSP_Path *incumbent,
+        TSP_ReduceStats *stats);
+void print_reduce_stats(FILE *out, const TSP_ReduceStats *stats);
+
+/*****
+ * libtsp.c - the parts of the library the command line shares
+ *****/
+TSP_Instance* load_instance(const char *fname, int matrix, bool verify);
+TSP_Path* solve_instance(const TSP_Instance *inst, const TSP_Options *opt,
+        TSP_Workspace *ws, TSP_Solver *used, bool *stopped, TSP_Error *err,
+        TSP_ReduceStats *rs);
+TSP_Graph* instance_candidates(const TSP_Instance *inst,
+        const TSP_Options *opt);
+TSP_Path* two_opt_start(const DistMatrix *dist, const TSP_Graph *cand,
+        const TSP_Stop *stop);
+TSP_Handle* wrap_instance(TSP_Instance *inst);
+TSP_Error solve_handle(const TSP_Handle *h, const TSP_Options *opt,
+        TSP_Workspace *ws, TSP_Cache *cache, TSP_Result *res);
+void tsp_log(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+/*****
+ * select.c
+ *****/
+double select_memory(void);
+TSP_Solver select_solver(const TSP_Instance *inst, const TSP_Options *opt,
+        TSP_Selection *sel);
+
+/*****
+ * cache.c
+ *****/
+TSP_Path* cache_solve(TSP_Cache *cache, const TSP_Instance *inst,
+        const TSP_Options *opt, TSP_Workspace *ws, TSP_Solver *used,
+        bool *stopped, TSP_Error *err, TSP_ReduceStats *rs);
+
+/*****
+ * cli.c
+ *****/
+int cli_main(int argc, char **argv);
 
 /*****
  * main_loop.c
@@ -0,0 +1,238 @@
+/*
+* TSP
+* Copyright (C) Zach Wilder 2024
+* 
+* This file is a part of TSP
+*
+* TSP is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+* 
+* TSP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+* 
+* You should have received a copy of the GNU General Public License
+* along with TSP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <tsp.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+/*****
+ * Batch solving
+ *
+ * The pool's threads are started once and then sleep on a condition variable
+ * between batches. Within a batch the instances are handed out one at a time
+ * with an atomic counter, so a thread that draws a slow one doesn't hold the
+ * rest up, and every result is written straight into its own slot - no
+ * locking, and the output order is the input order however the work was
+ * split. The thread calling tsp_pool_solve() works too, as thread 0.
+ *
+ * Each thread has its own TSP_Workspace, so after the largest instance of the
+ * first batch the Held-Karp table and nearest neighbor buffers are never
+ * allocated again. (2-opt still builds its candidate lists per instance.)
+ *****/
+
+typedef struct {
+    TSP_Pool *pool;
+    TSP_Workspace *ws;
+} PoolWorker;
+
+struct TSP_Pool {
+    int nthreads;           // Including the caller
+    int started;            // Background threads running, nthreads - 1 if
+                            // they all started
+    pthread_t *threads;
+    PoolWorker *workers;    // workers[0] is the caller's
+    pthread_mutex_t batch;  // Held for a whole tsp_pool_solve()
+    pthread_mutex_t lock;   // Everything below
+    pthread_cond_t wake;    // New batch, or shutting down
+    pthread_cond_t idle;    // The last background thread finished a batch
+    unsigned long gen;      // Batches started
+    int running;            // Background threads still on this batch
+    bool quit;
+
+    TSP_Cache *cache;       // Looked in before solving, can be NULL
+    TSP_Handle *const *handles;
+    const TSP_Options *opt;
+    TSP_Result *results;
+    int count;
+    atomic_int next;
+};
+
+static void pool_run(TSP_Pool *pool, TSP_Workspace *ws) {
+    /* Solve instances from the current batch until there are none left */
+    int i = 0;
+    while((i = atomic_fetch_add(&pool->next, 1)) < pool->count) {
+        solve_handle(pool->handles[i], pool->opt, ws, pool->cache,
+                &pool->results[i]);
+    }
+}
+
+static void* pool_worker(void *arg) {
+    PoolWorker *w = arg;
+    TSP_Pool *pool = w->pool;
+    unsigned long seen = 0;
+    pthread_mutex_lock(&pool->lock);
+    while(true) {
+        while(!pool->quit && pool->gen == seen) {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+        if(pool->quit) break;
+        seen = pool->gen;
+        pthread_mutex_unlock(&pool->lock);
+        pool_run(pool, w->ws);
+        pthread_mutex_lock(&pool->lock);
+        if(--pool->running == 0) pthread_cond_signal(&pool->idle);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+TSP_Pool* tsp_pool_create(int nthreads) {
+    /* Start a pool of nthreads threads (counting the one that will call
+     * tsp_pool_solve()), nthreads <= 0 for one per core. If some threads can't
+     * be started the pool runs with fewer. */
+    TSP_Pool *pool = NULL;
+    int t = 0;
+    if(nthreads <= 0) nthreads = dm_default_threads();
+    pool = calloc(1, sizeof(TSP_Pool));
+    if(!pool) return NULL;
+    pool->nthreads = nthreads;
+    pool->threads = malloc(nthreads * sizeof(pthread_t));
+    pool->workers = calloc(nthreads, sizeof(PoolWorker));
+    if(!pool->threads || !pool->workers) {
+        free(pool->threads);
+        free(pool->workers);
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->batch, NULL);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->idle, NULL);
+    atomic_init(&pool->next, 0);
+    for(t = 0; t < nthreads; t++) {
+        pool->workers[t].pool = pool;
+        pool->workers[t].ws = create_workspace();
+        if(!pool->workers[t].ws) {
+            pool->nthreads = t;
+            tsp_pool_destroy(pool);
+            return NULL;
+        }
+    }
+    for(t = 1; t < nthreads; t++) {
+        if(pthread_create(&pool->threads[t], NULL, pool_worker,
+                    &pool->workers[t]) != 0) {
+            break;
+        }
+        pool->started++;
+    }
+    return pool;
+}
+
+void tsp_pool_destroy(TSP_Pool *pool) {
+    /* Stop the threads (waiting for a running batch first) and free it all */
+    int t = 0;
+    if(!pool) return;
+    if(pool->started) {
+        pthread_mutex_lock(&pool->lock);
+        pool->quit = true;
+        pthread_cond_broadcast(&pool->wake);
+        pthread_mutex_unlock(&pool->lock);
+        for(t = 1; t <= pool->started; t++) {
+            pthread_join(pool->threads[t], NULL);
+        }
+    }
+    for(t = 0; t < pool->nthreads; t++) {
+        destroy_workspace(pool->workers[t].ws);
+    }
+    pthread_mutex_destroy(&pool->batch);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->wake);
+    pthread_cond_destroy(&pool->idle);
+    free(pool->threads);
+    free(pool->workers);
+    free(pool);
+}
+
+int tsp_pool_threads(const TSP_Pool *pool) {
+    return pool ? pool->started + 1 : 0;
+}
+
+void tsp_pool_set_cache(TSP_Pool *pool, TSP_Cache *cache) {
+    /* Answer from (and add to) cache in every batch from now on, NULL to
+     * stop. Not while a batch is running. */
+    pool->cache = cache;
+}
+
+TSP_Error tsp_pool_solve(TSP_Pool *pool, TSP_Handle *const *handles,
+        int count, const TSP_Options *opt, TSP_Result *results,
+        TSP_BatchStats *stats) {
+    /* Solve handles[0..count) into results[0..count), and fill in stats if it
+     * isn't NULL. TSP_OK means the batch ran - whether each instance solved is
+     * in its result's status. */
+    struct timespec t0, t1;
+    int i = 0;
+    if(!pool || !handles || !results || count < 0) return TSP_ERR_ARG;
+    pthread_mutex_lock(&pool->batch);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->handles = handles;
+    pool->opt = opt;
+    pool->results = results;
+    pool->count = count;
+    atomic_store(&pool->next, 0);
+    pool->running = pool->started;
+    pool->gen++;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    pool_run(pool, pool->workers[0].ws);
+
+    pthread_mutex_lock(&pool->lock);
+    while(pool->running > 0) pthread_cond_wait(&pool->idle, &pool->lock);
+    pool->handles = NULL;
+    pool->results = NULL;
+    pthread_mutex_unlock(&pool->lock);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    pthread_mutex_unlock(&pool->batch);
+
+    if(stats) {
+        memset(stats, 0, sizeof(TSP_BatchStats));
+        stats->count = count;
+        stats->threads = pool->started + 1;
+        stats->seconds = (t1.tv_sec - t0.tv_sec) +
+            (t1.tv_nsec - t0.tv_nsec) / 1e9;
+        for(i = 0; i < count; i++) {
+            stats->solve_seconds += results[i].seconds;
+            if(results[i].status != TSP_OK) {
+                stats->failed++;
+                continue;
+            }
+            stats->solved++;
+            stats->by_solver[results[i].solver]++;
+        }
+        stats->per_second = (stats->seconds > 0) ? count / stats->seconds : 0;
+    }
+    return TSP_OK;
+}
+
+TSP_Error tsp_solve_batch(TSP_Handle *const *handles, int count,
+        const TSP_Options *opt, int nthreads, TSP_Result *results,
+        TSP_BatchStats *stats) {
+    /* One batch on a pool made just for it */
+    TSP_Pool *pool = NULL;
+    TSP_Error err = TSP_OK;
+    if(!handles || !results || count < 0) return TSP_ERR_ARG;
+    if(nthreads > count) nthreads = count ? count : 1;
+    pool = tsp_pool_create(nthreads);
+    if(!pool) return TSP_ERR_NOMEM;
+    err = tsp_pool_solve(pool, handles, count, opt, results, stats);
+    tsp_pool_destroy(pool);
+    return err;
+}
@@ -0,0 +1,542 @@
+/*
+* TSP
+* Copyright (C) Zach Wilder 2024
+*
+* This file is a part of TSP
+*
+* TSP is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* TSP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with TSP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <tsp.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*****
+ * Result cache
+ *
+ * Tours are filed under a 64 bit FNV-1a hash of the instance and the options
+ * that affect the answer (solver, 2-opt candidates, time limit, whether
+ * distances are quantized). Coordinate instances are hashed with their cities
+ * sorted by (x, y), so the same stops sent in a different order still hit; the
+ * tour is stored in that sorted order and mapped back to the caller's
+ * numbering on the way out. Matrix instances are hashed as they are, row by
+ * row.
+ *
+ * A 64 bit hash can collide, so every hit is checked before it's handed back:
+ * the tour has to visit each city once and add up to the stored cost on this
+ * instance. That's O(n), next to nothing beside solving.
+ *
+ * Two tiers, one lock:
+ *  - memory: a chained hash table of up to 'entries' tours with an LRU list
+ *    through them, the least recently used dropped when it's full
+ *  - disk (optional): an mmap'd file that survives restarts,
+ *    [CacheFileHeader][CacheSlot x nslots][records...]. The slots are an open
+ *    addressed table of key -> record offset; records are appended and never
+ *    removed, and the file grows as they're added. Once the slots are 3/4
+ *    full nothing more goes to disk. The file is flock()ed, so only one
+ *    process uses it at a time.
+ *  A disk hit is copied into memory, so it's a memory hit next time.
+ *****/
+
+#define CACHE_MAGIC "TSPCACH1"
+#define CACHE_VERSION 1
+#define CACHE_SLOTS (1 << 16)
+#define CACHE_GROW (1 << 20)    // Bytes the disk file grows by, at least
+#define CACHE_ENTRIES 4096      // Memory tier size if none is given
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t nslots;        // Power of two
+    uint64_t used;          // Bytes of the file in use, records included
+    uint64_t entries;
+} CacheFileHeader;
+
+typedef struct {
+    uint64_t key;           // 0 for an empty slot
+    uint64_t off;           // Byte offset of the CacheRecord
+} CacheSlot;
+
+typedef struct {
+    uint64_t key;
+    int32_t n;
+    int32_t cost;
+    int32_t solver;
+    int32_t pad;
+} CacheRecord;              // Followed by n int32 cities, padded to 8 bytes
+
+typedef struct CacheEntry CacheEntry;
+struct CacheEntry {
+    uint64_t key;
+    TSP_Solver solver;
+    TSP_Path *tour;         // Cities in canonical order
+    CacheEntry *next;       // Hash chain
+    CacheEntry *newer;      // LRU list
+    CacheEntry *older;
+};
+
+struct TSP_Cache {
+    pthread_mutex_t lock;
+    int max;
+    int count;
+    int nbuckets;           // Power of two
+    CacheEntry **buckets;
+    CacheEntry *newest;
+    CacheEntry *oldest;
+
+    int fd;                 // Disk tier, -1 if there isn't one
+    char *map;
+    size_t maplen;
+
+    TSP_CacheStats stats;
+};
+
+/*****
+ * Keys
+ *****/
+
+typedef struct {
+    double x;
+    double y;
+    int id;
+} CacheCity;
+
+static int cache_cmp_city(const void *a, const void *b) {
+    const CacheCity *ca = a, *cb = b;
+    if(ca->x != cb->x) return (ca->x < cb->x) ? -1 : 1;
+    if(ca->y != cb->y) return (ca->y < cb->y) ? -1 : 1;
+    return 0;
+}
+
+static uint64_t cache_key(const TSP_Instance *inst, const TSP_Options *opt,
+        int **perm) {
+    /* Hash inst and opt. For coordinate instances *perm is set to the sorted
+     * order (perm[k] is the k'th city after sorting), otherwise it's NULL.
+     * Returns 0 if there isn't the memory to work it out. */
+    int32_t head[5];
+    CacheCity *cities = NULL;
+    int *row = NULL;
+    uint64_t h = FNV64_INIT;
+    int i = 0;
+
+    *perm = NULL;
+    head[0] = inst->n;
+    head[1] = inst->coords ? inst->metric : METRIC_EXPLICIT;
+    head[2] = opt ? opt->solver : TSP_SOLVER_AUTO;
+    head[3] = opt ? opt->candidates : 0;
+    head[4] = (inst->dist->mode == DM_QUANT16);
+    h = fnv1a64(h, head, sizeof(head));
+    if(opt && opt->time_limit > 0) {
+        h = fnv1a64(h, &opt->time_limit, sizeof(double));
+    }
+    if(opt && opt->solver == TSP_SOLVER_AUTO && opt->quality) {
+        h = fnv1a64(h, &opt->quality, sizeof(TSP_Quality));
+    }
+    if(opt && opt->roads_only) {
+        h = fnv1a64(h, &opt->roads_only, sizeof(bool));
+    }
+    if(opt && opt->candidates_kind) {
+        h = fnv1a64(h, &opt->candidates_kind, sizeof(TSP_CandidateKind));
+    }
+    if(opt && opt->reduce) {
+        h = fnv1a64(h, &opt->reduce, sizeof(bool));
+    }
+
+    if(inst->coords && inst->metric != METRIC_EXPLICIT) {
+        cities = malloc(inst->n * sizeof(CacheCity));
+        *perm = malloc(inst->n * sizeof(int));
+        if(!cities || !*perm) {
+            free(cities);
+            free(*perm);
+            *perm = NULL;
+            return 0;
+        }
+        for(i = 0; i < inst->n; i++) {
+            // + 0.0 so -0.0 hashes the same as 0.0
+            cities[i].x = inst->coords->x[i] + 0.0;
+            cities[i].y = inst->coords->y[i] + 0.0;
+            cities[i].id = i;
+        }
+        qsort(cities, inst->n, sizeof(CacheCity), cache_cmp_city);
+        for(i = 0; i < inst->n; i++) {
+            h = fnv1a64(h, &cities[i].x, sizeof(double));
+            h = fnv1a64(h, &cities[i].y, sizeof(double));
+            (*perm)[i] = cities[i].id;
+        }
+        free(cities);
+    } else {
+        row = malloc(inst->n * sizeof(int));
+        if(!row) return 0;
+        for(i = 0; i < inst->n; i++) {
+            dm_get_row(inst->dist, i, 0, inst->n, row);
+            h = fnv1a64(h, row, inst->n * sizeof(int));
+        }
+        free(row);
+    }
+    return h ? h : 1; // 0 marks an empty disk slot
+}
+
+static bool cache_check(const TSP_Instance *inst, const int *tour, int n,
+        int cost) {
+    /* Is tour a real tour of inst that costs cost? */
+    bool *seen = NULL;
+    long total = 0;
+    int i = 0;
+    bool ok = (n == inst->n);
+    if(!ok) return false;
+    seen = calloc(n, sizeof(bool));
+    if(!seen) return false;
+    for(i = 0; ok && i < n; i++) {
+        if(tour[i] < 0 || tour[i] >= n || seen[tour[i]]) ok = false;
+        else seen[tour[i]] = true;
+    }
+    for(i = 0; ok && i < n; i++) {
+        total += dm_get(inst->dist, tour[i], tour[(i + 1) % n]);
+    }
+    free(seen);
+    return ok && total == cost;
+}
+
+static TSP_Path* cache_unmap(const int *canon, int n, int cost,
+        const int *perm) {
+    /* A tour in canonical order back in the instance's numbering, starting at
+     * city 0 like the solvers' */
+    int *path = malloc(n * sizeof(int));
+    TSP_Path *tour = NULL;
+    int i = 0, start = 0;
+    if(!path) return NULL;
+    for(i = 0; i < n; i++) {
+        path[i] = perm ? perm[canon[i]] : canon[i];
+        if(path[i] == 0) start = i;
+    }
+    tour = malloc(sizeof(TSP_Path));
+    if(tour) tour->path = malloc((n + 1) * sizeof(int));
+    if(!tour || !tour->path) {
+        free(tour);
+        free(path);
+        return NULL;
+    }
+    for(i = 0; i < n; i++) tour->path[i] = path[(start + i) % n];
+    tour->path[n] = tour->path[0];
+    tour->n = n;
+    tour->cost = cost;
+    free(path);
+    return tour;
+}
+
+/*****
+ * Memory tier
+ *****/
+
+static void lru_unlink(TSP_Cache *cache, CacheEntry *e) {
+    if(e->newer) e->newer->older = e->older;
+    else cache->newest = e->older;
+    if(e->older) e->older->newer = e->newer;
+    else cache->oldest = e->newer;
+    e->newer = e->older = NULL;
+}
+
+static void lru_push(TSP_Cache *cache, CacheEntry *e) {
+    /* Make e the most recently used */
+    e->older = cache->newest;
+    e->newer = NULL;
+    if(cache->newest) cache->newest->newer = e;
+    cache->newest = e;
+    if(!cache->oldest) cache->oldest = e;
+}
+
+static CacheEntry* mem_find(TSP_Cache *cache, uint64_t key) {
+    CacheEntry *e = cache->buckets[key & (cache->nbuckets - 1)];
+    while(e && e->key != key) e = e->next;
+    return e;
+}
+
+static void mem_remove(TSP_Cache *cache, CacheEntry *e) {
+    CacheEntry **link = &cache->buckets[e->key & (cache->nbuckets - 1)];
+    while(*link != e) link = &(*link)->next;
+    *link = e->next;
+    lru_unlink(cache, e);
+    destroy_tsp_path(e->tour);
+    free(e);
+    cache->count--;
+}
+
+static void mem_put(TSP_Cache *cache, uint64_t key, const int *canon, int n,
+        int cost, TSP_Solver solver) {
+    /* Add (or replace) key, making room if the tier is full */
+    CacheEntry *e = mem_find(cache, key);
+    if(e) mem_remove(cache, e);
+    if(cache->count == cache->max) {
+        mem_remove(cache, cache->oldest);
+        cache->stats.evictions++;
+    }
+    e = calloc(1, sizeof(CacheEntry));
+    if(!e) return;
+    e->tour = make_tsp_path(canon, n, cost);
+    if(!e->tour) {
+        free(e);
+        return;
+    }
+    e->key = key;
+    e->solver = solver;
+    e->next = cache->buckets[key & (cache->nbuckets - 1)];
+    cache->buckets[key & (cache->nbuckets - 1)] = e;
+    lru_push(cache, e);
+    cache->count++;
+}
+
+/*****
+ * Disk tier
+ *****/
+
+static CacheFileHeader* disk_header(const TSP_Cache *cache) {
+    return (CacheFileHeader *)cache->map;
+}
+
+static CacheSlot* disk_slots(const TSP_Cache *cache) {
+    return (CacheSlot *)(cache->map + sizeof(CacheFileHeader));
+}
+
+static bool disk_map(TSP_Cache *cache, size_t len) {
+    /* (Re)map the first len bytes of the file, growing it if need be */
+    struct stat st;
+    void *map = NULL;
+    if(fstat(cache->fd, &st) != 0) return false;
+    if((size_t)st.st_size < len && ftruncate(cache->fd, len) != 0) {
+        return false;
+    }
+    if((size_t)st.st_size > len) len = st.st_size;
+    map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, cache->fd, 0);
+    if(map == MAP_FAILED) return false;
+    if(cache->map) munmap(cache->map, cache->maplen);
+    cache->map = map;
+    cache->maplen = len;
+    return true;
+}
+
+static bool disk_open(TSP_Cache *cache, const char *path) {
+    /* Open (or start) the cache file at path */
+    CacheFileHeader *hdr = NULL;
+    struct stat st;
+    size_t base = sizeof(CacheFileHeader) + CACHE_SLOTS * sizeof(CacheSlot);
+    cache->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if(cache->fd < 0) return false;
+    if(flock(cache->fd, LOCK_EX | LOCK_NB) != 0 ||
+            fstat(cache->fd, &st) != 0) {
+        return false;
+    }
+    if(st.st_size == 0) {
+        if(!disk_map(cache, base + CACHE_GROW)) return false;
+        hdr = disk_header(cache);
+        memcpy(hdr->magic, CACHE_MAGIC, sizeof(hdr->magic));
+        hdr->version = CACHE_VERSION;
+        hdr->nslots = CACHE_SLOTS;
+        hdr->used = base;
+        hdr->entries = 0;
+        return true;
+    }
+    if((size_t)st.st_size < sizeof(CacheFileHeader) ||
+            !disk_map(cache, st.st_size)) {
+        return false;
+    }
+    hdr = disk_header(cache);
+    return memcmp(hdr->magic, CACHE_MAGIC, sizeof(hdr->magic)) == 0 &&
+        hdr->version == CACHE_VERSION && hdr->nslots > 0 &&
+        (hdr->nslots & (hdr->nslots - 1)) == 0 &&
+        sizeof(CacheFileHeader) + hdr->nslots * sizeof(CacheSlot) <=
+            hdr->used && hdr->used <= cache->maplen;
+}
+
+static CacheRecord* disk_find(const TSP_Cache *cache, uint64_t key) {
+    /* key's record, or NULL. Anything pointing outside the file is ignored. */
+    CacheFileHeader *hdr = disk_header(cache);
+    CacheSlot *slots = disk_slots(cache);
+    CacheRecord *rec = NULL;
+    uint32_t mask = hdr->nslots - 1;
+    uint32_t i = key & mask;
+    while(slots[i].key != 0) {
+        if(slots[i].key == key) {
+            if(slots[i].off + sizeof(CacheRecord) > hdr->used) return NULL;
+            rec = (CacheRecord *)(cache->map + slots[i].off);
+            if(rec->key != key || rec->n <= 0 || slots[i].off +
+                    sizeof(CacheRecord) + (size_t)rec->n * sizeof(int32_t) >
+                    hdr->used) {
+                return NULL;
+            }
+            return rec;
+        }
+        i = (i + 1) & mask;
+    }
+    return NULL;
+}
+
+static void disk_put(TSP_Cache *cache, uint64_t key, const int *canon, int n,
+        int cost, TSP_Solver solver) {
+    /* Append a record for key. The slot is filled in last, so a record that
+     * didn't get written all the way is never found. */
+    CacheFileHeader *hdr = disk_header(cache);
+    CacheSlot *slots = NULL;
+    CacheRecord *rec = NULL;
+    size_t len = (sizeof(CacheRecord) + n * sizeof(int32_t) + 7) & ~(size_t)7;
+    uint64_t off = 0;
+    uint32_t i = 0, mask = 0;
+    if(hdr->entries >= hdr->nslots / 4 * 3 || disk_find(cache, key)) return;
+    if(hdr->used + len > cache->maplen) {
+        if(!disk_map(cache, hdr->used + len + CACHE_GROW)) return;
+        hdr = disk_header(cache);
+    }
+    off = hdr->used;
+    rec = (CacheRecord *)(cache->map + off);
+    rec->key = key;
+    rec->n = n;
+    rec->cost = cost;
+    rec->solver = solver;
+    rec->pad = 0;
+    memcpy(rec + 1, canon, n * sizeof(int32_t));
+    hdr->used += len;
+
+    slots = disk_slots(cache);
+    mask = hdr->nslots - 1;
+    for(i = key & mask; slots[i].key != 0; i = (i + 1) & mask);
+    slots[i].off = off;
+    slots[i].key = key;
+    hdr->entries++;
+}
+
+/*****
+ * Cache functions
+ *****/
+
+TSP_Cache* tsp_cache_create(int entries, const char *path) {
+    /* A cache holding up to entries tours in memory (0 for the default),
+     * backed by the file at path if it isn't NULL. NULL if the file can't be
+     * opened, is locked by another process or isn't a cache file. */
+    TSP_Cache *cache = calloc(1, sizeof(TSP_Cache));
+    if(!cache) return NULL;
+    cache->fd = -1;
+    cache->max = (entries > 0) ? entries : CACHE_ENTRIES;
+    cache->nbuckets = 16;
+    while(cache->nbuckets < cache->max) cache->nbuckets *= 2;
+    cache->buckets = calloc(cache->nbuckets, sizeof(CacheEntry *));
+    pthread_mutex_init(&cache->lock, NULL);
+    if(!cache->buckets || (path && !disk_open(cache, path))) {
+        tsp_cache_destroy(cache);
+        return NULL;
+    }
+    return cache;
+}
+
+void tsp_cache_destroy(TSP_Cache *cache) {
+    if(!cache) return;
+    while(cache->oldest) mem_remove(cache, cache->oldest);
+    if(cache->map) {
+        msync(cache->map, cache->maplen, MS_ASYNC);
+        munmap(cache->map, cache->maplen);
+    }
+    if(cache->fd >= 0) close(cache->fd);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->buckets);
+    free(cache);
+}
+
+void tsp_cache_stats(TSP_Cache *cache, TSP_CacheStats *stats) {
+    pthread_mutex_lock(&cache->lock);
+    *stats = cache->stats;
+    stats->hits = stats->mem_hits + stats->disk_hits;
+    stats->entries = cache->count;
+    stats->disk_entries = cache->map ? disk_header(cache)->entries : 0;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+static TSP_Path* cache_get(TSP_Cache *cache, const TSP_Instance *inst,
+        uint64_t key, const int *perm, TSP_Solver *used) {
+    /* The stored tour for key, in inst's numbering, or NULL */
+    CacheEntry *e = NULL;
+    CacheRecord *rec = NULL;
+    TSP_Path *tour = NULL;
+    bool disk = false;
+
+    pthread_mutex_lock(&cache->lock);
+    e = mem_find(cache, key);
+    if(!e && cache->map && (rec = disk_find(cache, key)) != NULL) {
+        mem_put(cache, key, (const int *)(rec + 1), rec->n, rec->cost,
+                rec->solver);
+        e = mem_find(cache, key);
+        disk = true;
+    }
+    if(e) {
+        lru_unlink(cache, e);
+        lru_push(cache, e);
+        *used = e->solver;
+        tour = cache_unmap(e->tour->path, e->tour->n, e->tour->cost, perm);
+    }
+    if(tour && !cache_check(inst, tour->path, tour->n, tour->cost)) {
+        destroy_tsp_path(tour); // Hash collision
+        tour = NULL;
+    }
+    if(!tour) cache->stats.misses++;
+    else if(disk) cache->stats.disk_hits++;
+    else cache->stats.mem_hits++;
+    pthread_mutex_unlock(&cache->lock);
+    return tour;
+}
+
+static void cache_put(TSP_Cache *cache, uint64_t key, const TSP_Path *tour,
+        const int *perm, TSP_Solver used) {
+    /* File tour (in the instance's numbering) under key */
+    int *canon = NULL;
+    int *rank = NULL;
+    int i = 0;
+    canon = malloc(tour->n * sizeof(int));
+    if(perm) rank = malloc(tour->n * sizeof(int));
+    if(!canon || (perm && !rank)) {
+        free(canon);
+        free(rank);
+        return;
+    }
+    for(i = 0; perm && i < tour->n; i++) rank[perm[i]] = i;
+    for(i = 0; i < tour->n; i++) {
+        canon[i] = perm ? rank[tour->path[i]] : tour->path[i];
+    }
+    pthread_mutex_lock(&cache->lock);
+    mem_put(cache, key, canon, tour->n, tour->cost, used);
+    if(cache->map) disk_put(cache, key, canon, tour->n, tour->cost, used);
+    pthread_mutex_unlock(&cache->lock);
+    free(canon);
+    free(rank);
+}
+
+TSP_Path* cache_solve(TSP_Cache *cache, const TSP_Instance *inst,
+        const TSP_Options *opt, TSP_Workspace *ws, TSP_Solver *used,
+        bool *stopped, TSP_Error *err, TSP_ReduceStats *rs) {
+    /* solve_instance(), but looked up in cache first (if it isn't NULL) and
+     * filed there after - unless the solve was cut short, since the next
+     * one might get further. rs is left alone on a hit. */
+    TSP_Path *tour = NULL;
+    int *perm = NULL;
+    uint64_t key = 0;
+    if(!cache) return solve_instance(inst, opt, ws, used, stopped, err, rs);
+    key = cache_key(inst, opt, &perm);
+    *stopped = false;
+    *err = TSP_OK;
+    if(key) tour = cache_get(cache, inst, key, perm, used);
+    if(!tour) {
+        tour = solve_instance(inst, opt, ws, used, stopped, err, rs);
+        if(tour && key && !*stopped) cache_put(cache, key, tour, perm, *used);
+    }
+    free(perm);
+    return tour;
+}
@@ -0,0 +1,668 @@
+/*
+* TSP
+* Copyright (C) Zach Wilder 2024
+*
+* This file is a part of TSP
+*
+* TSP is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* TSP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with TSP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <tsp.h>
+#include <getopt.h>
+#include <signal.h>
+
+/*****
+ * Command line mode
+ *
+ * With any arguments, main() hands off to cli_main() before the terminal is
+ * set up - no alternate screen, no termios, no screen buffer - so the solvers
+ * can be run from scripts, pipelines and cron. Results go to stdout (or -o
+ * FILE), everything else to stderr.
+ *****/
+
+typedef enum {
+    OUT_TEXT        = 0,    // "name cost city city ..." one line per instance
+    OUT_TSPLIB      = 1     // TSPLIB .tour
+} CLIFormat;
+
+typedef struct {
+    TSP_Options solve;
+    CLIFormat format;
+    int mode;           // TSP_MATRIX_*
+    bool verify;        // Check .tspb checksums
+    bool stats;         // Timing on stderr
+    int jobs;           // Batch mode threads, 0 for one per core, -1 for off
+    TSP_Cache *cache;   // Result cache, NULL for none
+    TSP_Calibration cal;
+} CLIOptions;
+
+#define CLI_BATCH 1024  // Instances loaded (and solved) at a time in batch mode
+
+static TSP_Cancel *cli_cancel = NULL;   // Cancelled by the first SIGINT
+
+static void cli_usage(FILE *f) {
+    fprintf(f,
+"Usage: TSP [options] [file ...]\n"
+"Solve each file (TSPLIB .tsp, binary .tspb or a road network edge list -\n"
+"\"n m\" then m lines of \"u v w\") and print the tour. With no files, or a\n"
+"file named -, read a TSPLIB instance from stdin. With no arguments at all,\n"
+"start the interactive demo instead.\n"
+"\n"
+"  -s, --solver NAME   hk (Held-Karp, exact, n <= %d), nn (nearest neighbor),\n"
+"                      2opt (nearest neighbor + 2-opt), ils (2-opt, then\n"
+"                      iterated local search), portfolio (hk, 2opt and ils\n"
+"                      racing on their own threads), auto (default: the\n"
+"                      fastest that meets -Q in the time and memory there\n"
+"                      is - -t says why)\n"
+"  -Q, --quality LEVEL For auto: optimal (default, hk), high (ils), good\n"
+"                      (2opt) or any (nn) - the best that fits if nothing\n"
+"                      this good does\n"
+"      --memory SIZE   Memory auto may plan on, like 512M or 2G (default:\n"
+"                      what the system and cgroup have free)\n"
+"      --calibrate FILE  Time the solvers on this machine, save it to FILE\n"
+"                      and exit\n"
+"      --calibration FILE  Use timings from --calibrate for auto\n"
+"  -T, --time-limit S  Stop each solve after S seconds with the best tour so\n"
+"                      far (ils and portfolio keep improving until then).\n"
+"                      Also auto's time budget, otherwise %gs\n"
+"  -P, --progress      Report each solve's progress on stderr\n"
+"      --roads-only    Edge list files: only travel the roads given, with\n"
+"                      hk or nn (otherwise the shortest path between every\n"
+"                      pair of cities can be used)\n"
+"      --candidates KIND  2opt/ils/portfolio neighbour lists: quadrant\n"
+"                      (default: the nearest few in each quadrant) or\n"
+"                      delaunay (those plus the Delaunay triangulation -\n"
+"                      better tours on clustered or road-like cities)\n"
+"      --reduce        hk and 2opt: first drop the edges a 2-opt tour rules\n"
+"                      out, and say how many with -t (speeds up hk; 2opt\n"
+"                      gets a better tour but much more slowly)\n"
+"  -m, --matrix MODE   full, sym, oracle or quant16 distance matrix (default:\n"
+"                      sym, oracle past 20000 cities)\n"
+"  -f, --format FMT    text (default): name cost city city ... per line\n"
+"                      tsplib: TSPLIB TOUR format, cities numbered from 1\n"
+"  -o, --output FILE   Write tours to FILE instead of stdout\n"
+"      --verify        Check .tspb checksums\n"
+"  -t, --stats         Print timings to stderr\n"
+"  -j, --jobs N        Batch mode: solve the files on a pool of N threads (0\n"
+"                      for one per core). Tours still come out in the order\n"
+"                      the files were given, with a throughput summary on\n"
+"                      stderr at the end\n"
+"  -l, --list FILE     Also solve the files named in FILE, one per line (- for\n"
+"                      stdin)\n"
+"      --cache FILE    Keep solved tours in FILE (made if it doesn't exist)\n"
+"                      and answer repeats of an instance from it\n"
+"      --cache-mem N   Tours the cache keeps in memory (default 4096); on its\n"
+"                      own, a cache that only lives as long as the process\n"
+"      --serve PATH    Run as a server on the Unix socket PATH instead,\n"
+"                      solving JSON or binary requests (see server.h) on -j\n"
+"                      threads until SIGINT/SIGTERM\n"
+"      --generate KIND Write a random instance instead: uniform, clustered,\n"
+"                      grid, ring or road, made on -j threads. TSPLIB to\n"
+"                      stdout, or to -o FILE (binary if it ends in .tspb)\n"
+"  -n, --cities N      Cities to generate (default 1000)\n"
+"      --seed S        Seed to generate from (default 1); a seed always\n"
+"                      gives the same instance, whatever -j is\n"
+"      --groups K      Blobs, rings or towns to generate (default: grows\n"
+"                      with -n)\n"
+"  -h, --help          This help\n"
+"\n"
+"Ctrl-C stops the solves under way (and any still to come) with the best\n"
+"tours so far; a second one quits.\n",
+            HK_MAX_N, TSP_AUTO_SECONDS);
+}
+
+static double cli_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void cli_sigint(int sig) {
+    /* First Ctrl-C: wrap up with the tours found so far. SA_RESETHAND puts
+     * the default back for the second. */
+    (void)sig;
+    tsp_cancel(cli_cancel);
+}
+
+static void cli_progress(const TSP_Progress *p, void *arg) {
+    /* -P: one line per report, on stderr */
+    (void)arg;
+    fprintf(stderr, "progress: %.3fs %s", p->seconds,
+            tsp_solver_name(p->solver));
+    if(p->done >= 0) fprintf(stderr, " %.1f%%", 100 * p->done);
+    if(p->best != INT_MAX) fprintf(stderr, " best %d", p->best);
+    fputc('\n', stderr);
+}
+
+static void cli_write(FILE *out, const char *name, const TSP_Path *tour,
+        CLIFormat format) {
+    int i = 0;
+    if(format == OUT_TSPLIB) {
+        fprintf(out, "NAME : %s.tour\nCOMMENT : Length = %d\nTYPE : TOUR\n"
+                "DIMENSION : %d\nTOUR_SECTION\n", name, tour->cost, tour->n);
+        for(i = 0; i < tour->n; i++) fprintf(out, "%d\n", tour->path[i] + 1);
+        fprintf(out, "-1\nEOF\n");
+        return;
+    }
+    fprintf(out, "%s %d", name, tour->cost);
+    for(i = 0; i < tour->n; i++) fprintf(out, " %d", tour->path[i]);
+    fputc('\n', out);
+}
+
+static bool cli_run_one(const char *fname, const CLIOptions *opt, FILE *out) {
+    /* Load, solve and print one instance. Returns false if it failed. */
+    TSP_Instance *inst = NULL;
+    TSP_Path *tour = NULL;
+    TSP_Solver used = TSP_SOLVER_AUTO;
+    TSP_Error err = TSP_OK;
+    TSP_Selection sel;
+    TSP_ReduceStats rs;
+    bool stopped = false;
+    const char *name = (strcmp(fname, "-") == 0) ? "stdin" : fname;
+    double t0 = cli_now(), t1 = 0, t2 = 0;
+
+    memset(&rs, 0, sizeof(rs));  // Untouched on a cache hit
+
+    inst = load_instance(fname, opt->mode, opt->verify);
+    if(!inst) {
+        fprintf(stderr, "%s: couldn't read instance\n", name);
+        return false;
+    }
+    if(opt->stats && opt->solve.solver == TSP_SOLVER_AUTO) {
+        select_solver(inst, &opt->solve, &sel);
+        fprintf(stderr, "%s: auto: %s\n", name, sel.why);
+    }
+    t1 = cli_now();
+    tour = cache_solve(opt->cache, inst, &opt->solve, NULL, &used, &stopped,
+            &err, &rs);
+    t2 = cli_now();
+    if(!tour) {
+        fprintf(stderr, "%s: %s (%s, %d cities)\n", name, tsp_strerror(err),
+                tsp_solver_name(used), inst->n);
+        destroy_instance(inst);
+        return false;
+    }
+    cli_write(out, name, tour, opt->format);
+    if(opt->stats) {
+        fprintf(stderr, "%s: n %d solver %s cost %d load %.3fs solve %.3fs%s\n",
+                name, inst->n, tsp_solver_name(used), tour->cost, t1 - t0,
+                t2 - t1, stopped ? " (stopped)" : "");
+        if(rs.edges) print_reduce_stats(stderr, &rs);
+    }
+    destroy_tsp_path(tour);
+    destroy_instance(inst);
+    return true;
+}
+
+static void cli_write_result(FILE *out, const char *name,
+        const TSP_Result *res, CLIFormat format) {
+    /* cli_write() for a TSP_Result - the tour just isn't closed */
+    TSP_Path tour;
+    tour.cost = res->cost;
+    tour.n = res->n;
+    tour.path = res->tour;
+    cli_write(out, name, &tour, format);
+}
+
+static int cli_run_batch(const char **names, int count, const CLIOptions *opt,
+        FILE *out) {
+    /* Solve names[] on a thread pool, CLI_BATCH instances at a time so a long
+     * list never has to be in memory all at once. Returns how many failed. */
+    TSP_Pool *pool = NULL;
+    TSP_Instance *inst = NULL;
+    TSP_Handle **handles = NULL;
+    TSP_Result *results = NULL;
+    TSP_BatchStats bs, total;
+    TSP_Selection sel;
+    const char *name = NULL;
+    int first = 0, len = 0, i = 0, failed = 0;
+    double t0 = cli_now(), load = 0, t1 = 0;
+
+    pool = tsp_pool_create(opt->jobs);
+    handles = malloc(CLI_BATCH * sizeof(TSP_Handle *));
+    results = malloc(CLI_BATCH * sizeof(TSP_Result));
+    if(!pool || !handles || !results) {
+        fprintf(stderr, "Failed to start the batch pool\n");
+        tsp_pool_destroy(pool);
+        free(handles);
+        free(results);
+        return count;
+    }
+    tsp_pool_set_cache(pool, opt->cache);
+    memset(&total, 0, sizeof(TSP_BatchStats));
+    for(first = 0; first < count; first += CLI_BATCH) {
+        len = (count - first < CLI_BATCH) ? count - first : CLI_BATCH;
+        t1 = cli_now();
+        for(i = 0; i < len; i++) {
+            inst = load_instance(names[first + i], opt->mode, opt->verify);
+            handles[i] = inst ? wrap_instance(inst) : NULL;
+        }
+        load += cli_now() - t1;
+        tsp_pool_solve(pool, handles, len, &opt->solve, results, &bs);
+
+        for(i = 0; i < len; i++) {
+            name = names[first + i];
+            if(strcmp(name, "-") == 0) name = "stdin";
+            if(!handles[i]) {
+                fprintf(stderr, "%s: couldn't read instance\n", name);
+                failed++;
+            } else if(results[i].status != TSP_OK) {
+                fprintf(stderr, "%s: %s (%s, %d cities)\n", name,
+                        tsp_strerror(results[i].status),
+                        tsp_solver_name(results[i].solver),
+                        tsp_size(handles[i]));
+                failed++;
+            } else {
+                cli_write_result(out, name, &results[i], opt->format);
+                if(opt->stats && opt->solve.solver == TSP_SOLVER_AUTO) {
+                    tsp_select_solver(handles[i], &opt->solve, &sel);
+                    fprintf(stderr, "%s: auto: %s\n", name, sel.why);
+                }
+                if(opt->stats) {
+                    fprintf(stderr, "%s: n %d solver %s cost %d solve "
+                            "%.3fs%s\n", name, results[i].n,
+                            tsp_solver_name(results[i].solver),
+                            results[i].cost, results[i].seconds,
+                            results[i].stopped ? " (stopped)" : "");
+                }
+            }
+            tsp_free_result(&results[i]);
+            tsp_close(handles[i]);
+        }
+        total.seconds += bs.seconds;
+        total.solve_seconds += bs.solve_seconds;
+        total.threads = bs.threads;
+        for(i = 0; i < TSP_SOLVERS; i++) {
+            total.by_solver[i] += bs.by_solver[i];
+        }
+    }
+    t1 = cli_now() - t0;
+    fprintf(stderr, "batch: %d instances, %d failed, %d threads, %.3fs "
+            "(%.1f/s): load %.3fs, solve %.3fs (%.3fs thread time); "
+            "hk %d nn %d 2opt %d ils %d\n", count, failed, total.threads, t1,
+            (t1 > 0) ? count / t1 : 0.0, load, total.seconds,
+            total.solve_seconds, total.by_solver[TSP_SOLVER_HK],
+            total.by_solver[TSP_SOLVER_NN], total.by_solver[TSP_SOLVER_2OPT],
+            total.by_solver[TSP_SOLVER_ILS]);
+    tsp_pool_destroy(pool);
+    free(handles);
+    free(results);
+    return failed;
+}
+
+static bool cli_read_list(const char *fname, char ***names, int *count,
+        int *cap) {
+    /* Append the (non-blank) lines of fname to names */
+    FILE *f = (strcmp(fname, "-") == 0) ? stdin : fopen(fname, "r");
+    char *line = NULL, **grow = NULL;
+    size_t linecap = 0;
+    ssize_t len = 0;
+    bool ok = true;
+    if(!f) {
+        fprintf(stderr, "Can't open %s\n", fname);
+        return false;
+    }
+    while(ok && (len = getline(&line, &linecap, f)) != -1) {
+        while(len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+            line[--len] = '\0';
+        }
+        if(len == 0) continue;
+        if(*count == *cap) {
+            grow = realloc(*names, 2 * (*cap) * sizeof(char *));
+            if(!grow) {
+                ok = false;
+                break;
+            }
+            *names = grow;
+            *cap *= 2;
+        }
+        (*names)[*count] = strdup(line);
+        if(!(*names)[*count]) ok = false;
+        else (*count)++;
+    }
+    if(!ok) fprintf(stderr, "Failed to allocate memory for %s\n", fname);
+    free(line);
+    if(f != stdin) fclose(f);
+    return ok;
+}
+
+static double cli_size(const char *arg) {
+    /* "512M" and the like in bytes, 0 if it isn't a size */
+    char *end = NULL;
+    double size = strtod(arg, &end);
+    switch(*end) {
+        case 'k': case 'K': size *= 1024; end++; break;
+        case 'm': case 'M': size *= 1024 * 1024; end++; break;
+        case 'g': case 'G': size *= 1024.0 * 1024 * 1024; end++; break;
+        default: break;
+    }
+    return (end == arg || *end != '\0' || size <= 0) ? 0 : size;
+}
+
+static int cli_generate(const GenOptions *g, const char *outname, int jobs,
+        bool stats) {
+    /* --generate: make the instance and write it out, never as a matrix */
+    TSP_Instance *inst = NULL;
+    TSP_Coords *c = NULL;
+    const char *ext = outname ? strrchr(outname, '.') : NULL;
+    char name[64];
+    double t0 = cli_now(), t1 = 0;
+    bool ok = false;
+    c = generate_coords(g, jobs);
+    if(!c) {
+        fprintf(stderr, "Couldn't generate %d cities\n", g->n);
+        return 1;
+    }
+    t1 = cli_now();
+    // Don't write out what nothing will read back in
+    if(!(coord_tour_bound(c, METRIC_EUC_2D) <= INT_MAX)) {
+        fprintf(stderr, "%d cities this far apart could overflow a tour's "
+                "cost\n", g->n);
+        destroy_coords(c);
+        return 1;
+    }
+    inst = create_instance_coords(c, METRIC_EUC_2D, DM_ORACLE); // Takes c
+    if(inst) {
+        snprintf(name, sizeof(name), "%s%d-%llu", gen_kind_name(g->kind),
+                g->n, (unsigned long long)g->seed);
+        if(ext && strcmp(ext, ".tspb") == 0) {
+            ok = save_instance_bin(inst, outname);
+        } else {
+            ok = save_instance_tsplib(inst, outname ? outname : "-", name);
+        }
+    }
+    if(!ok) fprintf(stderr, "Can't write to %s\n", outname ? outname : "-");
+    if(ok && stats) {
+        fprintf(stderr, "%s: %d cities in %.3fs, written in %.3fs\n", name,
+                g->n, t1 - t0, cli_now() - t1);
+    }
+    destroy_instance(inst);
+    return ok ? 0 : 1;
+}
+
+static void cli_close_cache(TSP_Cache *cache) {
+    /* Report on the cache, then close it */
+    TSP_CacheStats cs;
+    if(!cache) return;
+    tsp_cache_stats(cache, &cs);
+    fprintf(stderr, "cache: %ld hits (%ld memory, %ld disk), %ld misses, "
+            "%ld evicted; %d in memory, %ld on disk\n", cs.hits, cs.mem_hits,
+            cs.disk_hits, cs.misses, cs.evictions, cs.entries,
+            cs.disk_entries);
+    tsp_cache_destroy(cache);
+}
+
+int cli_main(int argc, char **argv) {
+    /* Parse argv, solve every instance named, exit status 0 if they all
+     * solved, 1 if any failed, 2 for bad arguments */
+    static const struct option longopts[] = {
+        {"solver", required_argument, NULL, 's'},
+        {"matrix", required_argument, NULL, 'm'},
+        {"format", required_argument, NULL, 'f'},
+        {"output", required_argument, NULL, 'o'},
+        {"verify", no_argument, NULL, 'V'},
+        {"stats", no_argument, NULL, 't'},
+        {"jobs", required_argument, NULL, 'j'},
+        {"list", required_argument, NULL, 'l'},
+        {"time-limit", required_argument, NULL, 'T'},
+        {"progress", no_argument, NULL, 'P'},
+        {"quality", required_argument, NULL, 'Q'},
+        {"memory", required_argument, NULL, 'R'},
+        {"calibrate", required_argument, NULL, 'K'},
+        {"calibration", required_argument, NULL, 'k'},
+        {"serve", required_argument, NULL, 'S'},
+        {"cache", required_argument, NULL, 'C'},
+        {"cache-mem", required_argument, NULL, 'M'},
+        {"generate", required_argument, NULL, 'G'},
+        {"cities", required_argument, NULL, 'n'},
+        {"seed", required_argument, NULL, 'E'},
+        {"groups", required_argument, NULL, 'g'},
+        {"roads-only", no_argument, NULL, 'r'},
+        {"reduce", no_argument, NULL, 'x'},
+        {"candidates", required_argument, NULL, 'c'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    CLIOptions opt;
+    struct sigaction sa;
+    FILE *out = stdout;
+    const char *outname = NULL;
+    const char *listname = NULL;
+    const char *servepath = NULL;
+    const char *cachepath = NULL;
+    const char *calpath = NULL;
+    int cachemem = -1;
+    GenOptions gen;
+    bool generate = false;
+    char **names = NULL;
+    int c = 0, i = 0, failed = 0, count = 0, cap = 64, listed = 0;
+
+    tsp_default_options(&opt.solve);
+    opt.format = OUT_TEXT;
+    opt.mode = TSP_MATRIX_AUTO;
+    opt.verify = false;
+    opt.stats = false;
+    opt.jobs = -1;
+    opt.cache = NULL;
+    memset(&gen, 0, sizeof(gen));
+    gen.n = 1000;
+    gen.seed = 1;
+    gen.size = GEN_SIZE;
+    while((c = getopt_long(argc, argv, "s:m:f:o:tj:l:T:PQ:n:h", longopts,
+                    NULL))
+            != -1) {
+        switch(c) {
+            case 's':
+                for(i = 0; i < TSP_SOLVERS; i++) {
+                    if(strcmp(optarg, tsp_solver_name(i)) == 0) break;
+                }
+                if(i == TSP_SOLVERS) {
+                    fprintf(stderr, "Unknown solver '%s'\n", optarg);
+                    return 2;
+                }
+                opt.solve.solver = i;
+                break;
+            case 'm':
+                if(strcmp(optarg, "full") == 0) opt.mode = DM_FULL;
+                else if(strcmp(optarg, "sym") == 0) opt.mode = DM_SYMMETRIC;
+                else if(strcmp(optarg, "oracle") == 0) opt.mode = DM_ORACLE;
+                else if(strcmp(optarg, "quant16") == 0) opt.mode = DM_QUANT16;
+                else {
+                    fprintf(stderr, "Unknown matrix mode '%s'\n", optarg);
+                    return 2;
+                }
+                break;
+            case 'f':
+                if(strcmp(optarg, "text") == 0) opt.format = OUT_TEXT;
+                else if(strcmp(optarg, "tsplib") == 0) opt.format = OUT_TSPLIB;
+                else {
+                    fprintf(stderr, "Unknown format '%s'\n", optarg);
+                    return 2;
+                }
+                break;
+            case 'o': outname = optarg; break;
+            case 'V': opt.verify = true; break;
+            case 't': opt.stats = true; break;
+            case 'j':
+                opt.jobs = atoi(optarg);
+                if(opt.jobs < 0) {
+                    fprintf(stderr, "Bad job count '%s'\n", optarg);
+                    return 2;
+                }
+                break;
+            case 'l': listname = optarg; break;
+            case 'T':
+                opt.solve.time_limit = atof(optarg);
+                if(opt.solve.time_limit <= 0) {
+                    fprintf(stderr, "Bad time limit '%s'\n", optarg);
+                    return 2;
+                }
+                break;
+            case 'P':
+                opt.solve.progress = cli_progress;
+                break;
+            case 'Q':
+                for(i = 0; i <= TSP_QUALITY_ANY; i++) {
+                    if(strcmp(optarg, tsp_quality_name(i)) == 0) break;
+                }
+                if(i > TSP_QUALITY_ANY) {
+                    fprintf(stderr, "Unknown quality '%s'\n", optarg);
+                    return 2;
+                }
+                opt.solve.quality = i;
+                break;
+            case 'R':
+                opt.solve.memory_limit = cli_size(optarg);
+                if(opt.solve.memory_limit <= 0) {
+                    fprintf(stderr, "Bad memory size '%s'\n", optarg);
+                    return 2;
+                }
+                break;
+            case 'K':
+                if(!tsp_calibrate(&opt.cal) ||
+                        !tsp_calibration_save(optarg, &opt.cal)) {
+                    fprintf(stderr, "Couldn't calibrate to %s\n", optarg);
+                    return 1;
+                }
+                fprintf(stderr, "%s: hk %g nn %g 2opt %g ils %g ns/step\n",
+                        optarg, opt.cal.hk, opt.cal.nn, opt.cal.two_opt,
+                        opt.cal.ils);
+                return 0;
+            case 'k': calpath = optarg; break;
+            case 'r': opt.solve.roads_only = true; break;
+            case 'x': opt.solve.reduce = true; break;
+            case 'c':
+                if(strcmp(optarg, "quadrant") == 0) {
+                    opt.solve.candidates_kind = TSP_CAND_QUADRANT;
+                } else if(strcmp(optarg, "delaunay") == 0) {
+                    opt.solve.candidates_kind = TSP_CAND_DELAUNAY;
+                } else {
+                    fprintf(stderr, "Unknown candidate kind '%s'\n", optarg);
+                    return 2;
+                }
+                break;
+            case 'S': servepath = optarg; break;
+            case 'C': cachepath = optarg; break;
+            case 'M':
+                cachemem = atoi(optarg);
+                if(cachemem <= 0) {
+                    fprintf(stderr, "Bad cache size '%s'\n", optarg);
+                    return 2;
+                }
+                break;
+            case 'G':
+                for(i = 0; i < GEN_KINDS; i++) {
+                    if(strcmp(optarg, gen_kind_name(i)) == 0) break;
+                }
+                if(i == GEN_KINDS) {
+                    fprintf(stderr, "Unknown instance kind '%s'\n", optarg);
+                    return 2;
+                }
+                gen.kind = i;
+                generate = true;
+                break;
+            case 'n':
+                gen.n = atoi(optarg);
+                if(gen.n <= 0) {
+                    fprintf(stderr, "Bad city count '%s'\n", optarg);
+                    return 2;
+                }
+                break;
+            case 'E': gen.seed = strtoull(optarg, NULL, 0); break;
+            case 'g':
+                gen.groups = atoi(optarg);
+                if(gen.groups <= 0) {
+                    fprintf(stderr, "Bad group count '%s'\n", optarg);
+                    return 2;
+                }
+                break;
+            case 'h':
+                cli_usage(stdout);
+                return 0;
+            default:
+                cli_usage(stderr);
+                return 2;
+        }
+    }
+
+    if(generate) {
+        return cli_generate(&gen, outname, (opt.jobs < 0) ? 0 : opt.jobs,
+                opt.stats);
+    }
+    if(calpath) {
+        if(!tsp_calibration_load(calpath, &opt.cal)) {
+            fprintf(stderr, "Can't read calibration %s\n", calpath);
+            return 2;
+        }
+        opt.solve.calibration = &opt.cal;
+    }
+    if(cachepath || cachemem > 0) {
+        opt.cache = tsp_cache_create(cachemem, cachepath);
+        if(!opt.cache) {
+            fprintf(stderr, "Can't use %s as a cache (or it's in use)\n",
+                    cachepath ? cachepath : "memory");
+            return 1;
+        }
+    }
+    if(servepath) {
+        failed = run_server(servepath, &opt.solve, opt.mode,
+                (opt.jobs < 0) ? 0 : opt.jobs, opt.cache, opt.stats);
+        cli_close_cache(opt.cache);
+        return failed;
+    }
+
+    // The server has its own SIGINT handling; here it cancels the solves
+    cli_cancel = tsp_cancel_create();
+    if(cli_cancel) {
+        opt.solve.cancel = cli_cancel;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = cli_sigint;
+        sa.sa_flags = SA_RESETHAND;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGINT, &sa, NULL);
+    }
+
+    // argv's names first, then the list's (which are the only ones freed)
+    cap += argc - optind;
+    names = malloc(cap * sizeof(char *));
+    if(!names) return 1;
+    for(i = optind; i < argc; i++) names[count++] = argv[i];
+    listed = count;
+    if(listname && !cli_read_list(listname, &names, &count, &cap)) {
+        failed++;
+    }
+    if(count == 0 && !listname) names[count++] = "-";
+
+    if(outname) {
+        out = fopen(outname, "w");
+        if(!out) fprintf(stderr, "Can't write to %s\n", outname);
+    }
+    if(out && !failed) {
+        if(opt.jobs >= 0) {
+            failed += cli_run_batch((const char **)names, count, &opt, out);
+        } else {
+            for(i = 0; i < count; i++) {
+                failed += !cli_run_one(names[i], &opt, out);
+            }
+        }
+    }
+    if(!out) failed++;
+    else if(out != stdout && fclose(out) != 0) failed++;
+    for(i = listed; i < count; i++) free(names[i]);
+    free(names);
+    if(opt.stats || opt.jobs >= 0) cli_close_cache(opt.cache);
+    else tsp_cache_destroy(opt.cache);
+    signal(SIGINT, SIG_DFL);
+    tsp_cancel_destroy(cli_cancel);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,237 @@
+/*
+* TSP
+* Copyright (C) Zach Wilder 2024
+*
+* This file is a part of TSP
+*
+* TSP is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* TSP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with TSP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <tsp.h>
+
+/*****
+ * TSP_Coords
+ *
+ * City coordinates, stored as a struct of arrays, plus the distance metrics that
+ * work on them. A DistMatrix in DM_ORACLE mode points at one of these and
+ * calculates distances as they're asked for, instead of storing n^2 of them -
+ * this is what the comment in held_karp() was wishing for.
+ *
+ * The batch functions (coord_dist_row/coord_dist_gather) measure one city
+ * against many. The loops are written so that the compiler can turn them into
+ * SIMD code (see the omp simd pragmas, enabled with -fopenmp-simd).
+ *****/
+
+#define GEO_PI 3.141592
+#define GEO_RRR 6378.388
+
+TSP_Coords* create_coords(int n) {
+    /* Allocate coordinates for n cities, all set to 0,0 */
+    TSP_Coords *c = NULL;
+    size_t bytes;
+    if(n <= 0) return NULL;
+    c = malloc(sizeof(TSP_Coords));
+    if(!c) return NULL;
+    // Round up to a whole number of cache lines, for aligned_alloc
+    bytes = (((size_t)n * sizeof(double) + DM_ALIGN - 1) / DM_ALIGN) * DM_ALIGN;
+    c->n = n;
+    c->x = aligned_alloc(DM_ALIGN, bytes);
+    c->y = aligned_alloc(DM_ALIGN, bytes);
+    if(!c->x || !c->y) {
+        tsp_log("Failed to allocate memory for %d coordinates!", n);
+        destroy_coords(c);
+        return NULL;
+    }
+    memset(c->x, 0, bytes);
+    memset(c->y, 0, bytes);
+    return c;
+}
+
+TSP_Coords* create_coords_from_vec(const Vec2i *points, int n) {
+    /* Copy an array of Vec2i into a new TSP_Coords */
+    int i;
+    TSP_Coords *c = create_coords(n);
+    if(!c) return NULL;
+    for(i = 0; i < n; i++) {
+        c->x[i] = points[i].x;
+        c->y[i] = points[i].y;
+    }
+    return c;
+}
+
+void destroy_coords(TSP_Coords *c) {
+    if(!c) return;
+    if(c->x) {
+        free(c->x);
+    }
+    if(c->y) {
+        free(c->y);
+    }
+    free(c);
+}
+
+static double geo_rad(double v) {
+    /* TSPLIB GEO coordinates are DDD.MM - degrees, then minutes after the
+     * decimal point. Convert to radians the way the TSPLIB spec does. */
+    int deg = (int)v;
+    double min = v - deg;
+    return GEO_PI * (deg + 5.0 * min / 3.0) / 180.0;
+}
+
+int geo_dist(const TSP_Coords *c, int i, int j) {
+    /* Great circle distance (km, truncated) between i and j, per TSPLIB */
+    double lati = geo_rad(c->x[i]);
+    double loni = geo_rad(c->y[i]);
+    double latj = geo_rad(c->x[j]);
+    double lonj = geo_rad(c->y[j]);
+    double q1 = cos(loni - lonj);
+    double q2 = cos(lati - latj);
+    double q3 = cos(lati + latj);
+    if(i == j) return 0;
+    return (int)(GEO_RRR * acos(0.5 * ((1.0 + q1) * q2 - (1.0 - q1) * q3)) + 1.0);
+}
+
+double coord_tour_bound(const TSP_Coords *c, int metric) {
+    /* Most a tour the solvers come up with can cost. They all start from
+     * nearest neighbor (or do better, like Held-Karp) and only get shorter,
+     * bar an ILS kick's three new edges before 2-opt settles it. Nearest
+     * neighbor is within (ceil(log2 n) + 1) / 2 of the optimum (Rosenkrantz,
+     * Stearns and Lewis), and the optimum within sqrt(2 n w h) + 2 (w + h),
+     * plus the edge back, for a w x h box (Few) - n times the longest
+     * distance the box allows is a bound too, and for a few cities the
+     * better one. Both get a little to spare for the rounding. Tour costs are
+     * ints, so coordinates where this doesn't fit could overflow, and past
+     * INT_MAX a single distance is undefined to convert. Infinite for
+     * coordinates that aren't finite numbers. */
+    double xmin = INFINITY, xmax = -INFINITY;
+    double ymin = INFINITY, ymax = -INFINITY;
+    double dx, dy, n = c->n, longest = 0, scale = 0, opt = 0, nn = INFINITY;
+    int i;
+    if(c->n <= 0) return 0;
+    for(i = 0; i < c->n; i++) {
+        if(!isfinite(c->x[i]) || !isfinite(c->y[i])) return INFINITY;
+        xmin = fmin(xmin, c->x[i]);
+        xmax = fmax(xmax, c->x[i]);
+        ymin = fmin(ymin, c->y[i]);
+        ymax = fmax(ymax, c->y[i]);
+    }
+    dx = xmax - xmin;
+    dy = ymax - ymin;
+    // scale takes a Euclidean length to this metric's, at most
+    switch(metric) {
+        case METRIC_MAN_2D:
+            longest = dx + dy;
+            scale = sqrt(2);
+            break;
+        case METRIC_EUC_2D:
+        case METRIC_CEIL_2D:
+            longest = sqrt(dx * dx + dy * dy);
+            scale = 1;
+            break;
+        case METRIC_ATT:
+            longest = sqrt((dx * dx + dy * dy) / 10.0);
+            scale = 1 / sqrt(10);
+            break;
+        case METRIC_GEO:
+            // Half way round the world at most, but geo_rad() takes the
+            // degrees as an int
+            if(fmax(fabs(xmin), fabs(xmax)) >= INT_MAX ||
+                    fmax(fabs(ymin), fabs(ymax)) >= INT_MAX) {
+                return INFINITY;
+            }
+            longest = GEO_RRR * GEO_PI;
+            break;
+        default: break;
+    }
+    longest += 1;
+    if(scale > 0) {
+        opt = scale * (sqrt(2 * n * dx * dy) + 3 * (dx + dy)) + n;
+        nn = (ceil(log2(n)) + 2) / 2 * opt + 3 * longest;
+    }
+    // 2-opt's gains add up four distances at a time
+    return fmax(fmin(n * longest, nn), 4 * longest);
+}
+
+void coord_dist_row(const TSP_Coords *c, int metric, int i, int from,
+        int count, int *out) {
+    /* out[k] = distance from city i to city (from + k), for k < count */
+    const double *restrict xs = c->x + from;
+    const double *restrict ys = c->y + from;
+    const double xi = c->x[i];
+    const double yi = c->y[i];
+    double dx, dy;
+    int k;
+    switch(metric) {
+        case METRIC_MAN_2D:
+            #pragma omp simd private(dx, dy)
+            for(k = 0; k < count; k++) {
+                dx = xs[k] - xi;
+                dy = ys[k] - yi;
+                out[k] = (int)(fabs(dx) + fabs(dy) + 0.5);
+            }
+            break;
+        case METRIC_EUC_2D:
+            #pragma omp simd private(dx, dy)
+            for(k = 0; k < count; k++) {
+                dx = xs[k] - xi;
+                dy = ys[k] - yi;
+                out[k] = (int)(sqrt(dx * dx + dy * dy) + 0.5);
+            }
+            break;
+        case METRIC_CEIL_2D:
+            #pragma omp simd private(dx, dy)
+            for(k = 0; k < count; k++) {
+                dx = xs[k] - xi;
+                dy = ys[k] - yi;
+                out[k] = (int)ceil(sqrt(dx * dx + dy * dy));
+            }
+            break;
+        default:
+            for(k = 0; k < count; k++) {
+                out[k] = coord_dist(c, metric, i, from + k);
+            }
+            break;
+    }
+}
+
+void coord_dist_gather(const TSP_Coords *c, int metric, int i,
+        const int *js, int count, int *out) {
+    /* out[k] = distance from city i to city js[k], for k < count */
+    const double xi = c->x[i];
+    const double yi = c->y[i];
+    double dx, dy;
+    int k;
+    switch(metric) {
+        case METRIC_MAN_2D:
+            #pragma omp simd private(dx, dy)
+            for(k = 0; k < count; k++) {
+                dx = c->x[js[k]] - xi;
+                dy = c->y[js[k]] - yi;
+                out[k] = (int)(fabs(dx) + fabs(dy) + 0.5);
+            }
+            break;
+        case METRIC_EUC_2D:
+            #pragma omp simd private(dx, dy)
+            for(k = 0; k < count; k++) {
+                dx = c->x[js[k]] - xi;
+                dy = c->y[js[k]] - yi;
+                out[k] = (int)(sqrt(dx * dx + dy * dy) + 0.5);
+            }
+            break;
+        default:
+            for(k = 0; k < count; k++) {
+                out[k] = coord_dist(c, metric, i, js[k]);
+            }
+            break;
+    }
+}
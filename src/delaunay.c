@@ -0,0 +1,560 @@
+/*
+* TSP
+* Copyright (C) Zach Wilder 2024
+*
+* This file is a part of TSP
+*
+* TSP is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* TSP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with TSP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <tsp.h>
+
+/*****
+ * Delaunay candidate graph
+ *
+ * The Delaunay triangulation connects each city to its "natural" neighbours -
+ * at most 3n edges, and (for Euclidean distances) it holds the minimum spanning
+ * tree and almost every edge of a good tour, however the cities are spread
+ * out. k-nearest lists don't have that property: inside a tight cluster all k
+ * neighbours are in the same cluster, and nothing connects the clusters.
+ *
+ * Built with Bowyer-Watson: cities go in one at a time inside a big
+ * "super-triangle"; each new city knocks out the triangles whose circumcircle
+ * it lands in and the hole gets re-triangulated around it. Inserting the cities
+ * in Hilbert curve order means each city lands next to the last one, so the
+ * walk to find its triangle is a step or two - O(N log N) overall, for the
+ * sort.
+ *****/
+
+#define DT_SUPER_SCALE 1000.0L  // Super-triangle size, relative to the cities
+
+typedef struct {
+    int v[3];   // Corners, counter-clockwise
+    int nb[3];  // nb[k] is the triangle across the edge opposite v[k], or -1
+} DT_Tri;
+
+typedef struct {
+    int nv;             // Cities + 3 super-triangle corners
+    long double *x;
+    long double *y;
+    DT_Tri *tri;
+    int ntri;
+    int cap;
+    int *stamp;         // Insertion that last marked a triangle as bad
+    int *bad;           // Cavity triangles for the current insertion
+    int nbad;
+    int badcap;
+    int *start;         // New triangle whose outer edge starts at a vertex
+    int (*edges)[3];    // Cavity boundary: a, b, triangle on the far side
+    int edgecap;
+} DT;
+
+static long double dt_orient(const DT *dt, int a, int b, long double px,
+        long double py) {
+    /* > 0 if a, b, p turn counter-clockwise */
+    return (dt->x[b] - dt->x[a]) * (py - dt->y[a]) -
+        (dt->y[b] - dt->y[a]) * (px - dt->x[a]);
+}
+
+static bool dt_in_circle(const DT *dt, int t, long double px,
+        long double py) {
+    /* Is p strictly inside the circumcircle of triangle t? Worked relative to
+     * p to keep the numbers small. */
+    const int *v = dt->tri[t].v;
+    long double ax = dt->x[v[0]] - px, ay = dt->y[v[0]] - py;
+    long double bx = dt->x[v[1]] - px, by = dt->y[v[1]] - py;
+    long double cx = dt->x[v[2]] - px, cy = dt->y[v[2]] - py;
+    return ((ax * ax + ay * ay) * (bx * cy - cx * by) +
+            (bx * bx + by * by) * (cx * ay - ax * cy) +
+            (cx * cx + cy * cy) * (ax * by - bx * ay)) > 0;
+}
+
+static int dt_new_tri(DT *dt) {
+    DT_Tri *grow = NULL;
+    int *sgrow = NULL;
+    if(dt->ntri == dt->cap) {
+        grow = realloc(dt->tri, 2 * dt->cap * sizeof(DT_Tri));
+        if(!grow) return -1;
+        dt->tri = grow;
+        sgrow = realloc(dt->stamp, 2 * dt->cap * sizeof(int));
+        if(!sgrow) return -1;
+        dt->stamp = sgrow;
+        memset(dt->stamp + dt->cap, 0, dt->cap * sizeof(int));
+        dt->cap *= 2;
+    }
+    return dt->ntri++;
+}
+
+static bool dt_push_bad(DT *dt, int t) {
+    int *grow = NULL;
+    if(dt->nbad == dt->badcap) {
+        grow = realloc(dt->bad, 2 * dt->badcap * sizeof(int));
+        if(!grow) return false;
+        dt->bad = grow;
+        dt->badcap *= 2;
+    }
+    dt->bad[dt->nbad++] = t;
+    return true;
+}
+
+static int dt_locate(const DT *dt, int t, long double px, long double py) {
+    /* Walk from triangle t towards p, crossing any edge p is on the far side
+     * of. Returns the triangle holding p. */
+    int k = 0, steps = 0, a = 0, b = 0;
+    bool moved = true;
+    while(moved) {
+        moved = false;
+        // Start on a different edge each step, so the walk can't circle
+        for(k = 0; k < 3; k++) {
+            a = dt->tri[t].v[(k + steps + 1) % 3];
+            b = dt->tri[t].v[(k + steps + 2) % 3];
+            if(dt_orient(dt, a, b, px, py) < 0 &&
+                    dt->tri[t].nb[(k + steps) % 3] >= 0) {
+                t = dt->tri[t].nb[(k + steps) % 3];
+                moved = true;
+                break;
+            }
+        }
+        if(++steps > 4 * dt->ntri) break; // Shouldn't happen - give up
+    }
+    return t;
+}
+
+static void dt_link(DT *dt, int o, int a, int b, int t) {
+    /* Point triangle o's edge (b,a) at t */
+    int k = 0;
+    if(o < 0) return;
+    for(k = 0; k < 3; k++) {
+        if(dt->tri[o].v[(k + 1) % 3] == b && dt->tri[o].v[(k + 2) % 3] == a) {
+            dt->tri[o].nb[k] = t;
+            return;
+        }
+    }
+}
+
+static int dt_insert(DT *dt, int p, int t0, int id, int *twin) {
+    /* Insert vertex p, starting the search at triangle t0. Returns a triangle
+     * next to p (to start the next search from), or -1 if out of memory. If p
+     * is on top of a vertex that's already in, nothing is inserted and *twin
+     * is set to that vertex. */
+    long double px = dt->x[p], py = dt->y[p];
+    int i = 0, k = 0, t = 0, o = 0, a = 0, b = 0, nt = 0, reuse = 0, last = 0;
+    int stack_top = 0, nedge = 0;
+    int (*grow)[3] = NULL;
+    bool changed = true;
+    DT_Tri *tr = NULL;
+
+    t0 = dt_locate(dt, t0, px, py);
+    for(k = 0; k < 3; k++) {
+        a = dt->tri[t0].v[k];
+        if(dt->x[a] == px && dt->y[a] == py) {
+            *twin = a;
+            return t0;
+        }
+    }
+
+    // Grow the cavity out from t0 through every triangle whose circumcircle
+    // holds p. bad[] doubles as the stack.
+    dt->nbad = 0;
+    dt->stamp[t0] = id;
+    if(!dt_push_bad(dt, t0)) return -1;
+    for(stack_top = 0; stack_top < dt->nbad; stack_top++) {
+        t = dt->bad[stack_top];
+        for(k = 0; k < 3; k++) {
+            o = dt->tri[t].nb[k];
+            if(o < 0 || dt->stamp[o] == id) continue;
+            if(dt_in_circle(dt, o, px, py)) {
+                dt->stamp[o] = id;
+                if(!dt_push_bad(dt, o)) return -1;
+            }
+        }
+    }
+
+    // Rounding can put a triangle in the cavity that p can't "see" all of -
+    // the new fan would fold over. Drop those until the cavity is star shaped
+    // around p.
+    while(changed) {
+        changed = false;
+        for(i = 1; i < dt->nbad; i++) {
+            t = dt->bad[i];
+            for(k = 0; k < 3; k++) {
+                o = dt->tri[t].nb[k];
+                if(o >= 0 && dt->stamp[o] == id) continue;
+                a = dt->tri[t].v[(k + 1) % 3];
+                b = dt->tri[t].v[(k + 2) % 3];
+                if(dt_orient(dt, a, b, px, py) <= 0) break;
+            }
+            if(k < 3) {
+                dt->stamp[t] = 0;
+                dt->bad[i--] = dt->bad[--dt->nbad];
+                changed = true;
+            }
+        }
+    }
+
+    // One new triangle (a, b, p) per edge on the cavity boundary. The bad
+    // triangles' slots get reused first; the cavity edges are collected before
+    // any slot is overwritten.
+    if(3 * dt->nbad > dt->edgecap) {
+        grow = realloc(dt->edges, 6 * dt->nbad * sizeof(*grow));
+        if(!grow) return -1;
+        dt->edges = grow;
+        dt->edgecap = 6 * dt->nbad;
+    }
+    for(i = 0; i < dt->nbad; i++) {
+        t = dt->bad[i];
+        for(k = 0; k < 3; k++) {
+            o = dt->tri[t].nb[k];
+            if(o >= 0 && dt->stamp[o] == id) continue;
+            dt->edges[nedge][0] = dt->tri[t].v[(k + 1) % 3];
+            dt->edges[nedge][1] = dt->tri[t].v[(k + 2) % 3];
+            dt->edges[nedge][2] = o;
+            nedge++;
+        }
+    }
+    for(i = 0; i < dt->nbad; i++) dt->stamp[dt->bad[i]] = 0;
+    for(i = 0; i < nedge; i++) {
+        if(reuse < dt->nbad) {
+            nt = dt->bad[reuse++];
+        } else if((nt = dt_new_tri(dt)) < 0) {
+            return -1;
+        }
+        a = dt->edges[i][0];
+        b = dt->edges[i][1];
+        tr = &dt->tri[nt];
+        tr->v[0] = a;
+        tr->v[1] = b;
+        tr->v[2] = p;
+        tr->nb[2] = dt->edges[i][2];
+        dt_link(dt, dt->edges[i][2], a, b, nt);
+        dt->start[a] = nt;
+        last = nt;
+    }
+    // Stitch the fan together: (a,b,p) meets (b,c,p) along (b,p)
+    for(i = 0; i < nedge; i++) {
+        t = dt->start[dt->edges[i][0]];
+        o = dt->start[dt->edges[i][1]];
+        dt->tri[t].nb[0] = o;
+        dt->tri[o].nb[1] = t;
+    }
+    return last;
+}
+
+static uint32_t hilbert_d(uint32_t x, uint32_t y) {
+    /* Position of (x, y) along a 2^16 x 2^16 Hilbert curve */
+    uint32_t rx = 0, ry = 0, s = 0, d = 0, t = 0;
+    for(s = 1u << 15; s > 0; s >>= 1) {
+        rx = (x & s) > 0;
+        ry = (y & s) > 0;
+        d += s * s * ((3 * rx) ^ ry);
+        if(ry == 0) {
+            if(rx == 1) {
+                x = s - 1 - (x & (s - 1));
+                y = s - 1 - (y & (s - 1));
+            }
+            t = x;
+            x = y;
+            y = t;
+        }
+    }
+    return d;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void dt_free(DT *dt) {
+    free(dt->x);
+    free(dt->y);
+    free(dt->tri);
+    free(dt->stamp);
+    free(dt->bad);
+    free(dt->start);
+    free(dt->edges);
+}
+
+static bool push_key(uint64_t **keys, long *m, long *cap, int a, int b) {
+    /* Add edge (a,b) as a (min << 32 | max) key */
+    uint64_t *grow = NULL;
+    if(*m == *cap) {
+        grow = realloc(*keys, 2 * *cap * sizeof(uint64_t));
+        if(!grow) return false;
+        *keys = grow;
+        *cap *= 2;
+    }
+    (*keys)[(*m)++] = (a < b) ? (((uint64_t)a << 32) | (uint32_t)b) :
+        (((uint64_t)b << 32) | (uint32_t)a);
+    return true;
+}
+
+static long unique_keys(uint64_t *keys, long m) {
+    /* Sort keys and squeeze out repeats, returns how many are left */
+    long i = 0, out = 0;
+    qsort(keys, m, sizeof(uint64_t), cmp_u64);
+    for(i = 0; i < m; i++) {
+        if(out == 0 || keys[i] != keys[out - 1]) keys[out++] = keys[i];
+    }
+    return out;
+}
+
+static uint64_t* delaunay_edges(const TSP_Coords *c, long *nedges) {
+    /* Triangulate c. Returns its edges as (min << 32 | max) keys, sorted, no
+     * repeats. Cities on top of each other share a vertex, so a repeated city
+     * gets its twin's edges, plus one to the twin. */
+    DT dt;
+    uint64_t *order = NULL, *keys = NULL;
+    int *twin = NULL, *deg = NULL;
+    long m = 0, cap = 0, j = 0, base = 0;
+    int n = c->n, i = 0, k = 0, t = 0, p = 0, a = 0, b = 0;
+    long double minx = HUGE_VALL, miny = HUGE_VALL;
+    long double maxx = -HUGE_VALL, maxy = -HUGE_VALL, span = 0, mx = 0, my = 0;
+    bool ok = true;
+
+    memset(&dt, 0, sizeof(dt));
+    dt.nv = n + 3;
+    dt.cap = 2 * n + 16;
+    dt.badcap = 64;
+    dt.x = malloc(dt.nv * sizeof(long double));
+    dt.y = malloc(dt.nv * sizeof(long double));
+    dt.tri = malloc(dt.cap * sizeof(DT_Tri));
+    dt.stamp = calloc(dt.cap, sizeof(int));
+    dt.bad = malloc(dt.badcap * sizeof(int));
+    dt.start = malloc(dt.nv * sizeof(int));
+    order = malloc(n * sizeof(uint64_t));
+    twin = malloc(n * sizeof(int));
+    cap = 3 * (long)n + 16;
+    keys = malloc(cap * sizeof(uint64_t));
+    if(!dt.x || !dt.y || !dt.tri || !dt.stamp || !dt.bad || !dt.start ||
+            !order || !twin || !keys) {
+        ok = false;
+    }
+
+    if(ok) {
+        for(i = 0; i < n; i++) {
+            dt.x[i] = c->x[i];
+            dt.y[i] = c->y[i];
+            if(dt.x[i] < minx) minx = dt.x[i];
+            if(dt.x[i] > maxx) maxx = dt.x[i];
+            if(dt.y[i] < miny) miny = dt.y[i];
+            if(dt.y[i] > maxy) maxy = dt.y[i];
+            twin[i] = i;
+        }
+        span = (maxx - minx > maxy - miny) ? maxx - minx : maxy - miny;
+        if(span <= 0) span = 1;
+        mx = (minx + maxx) / 2;
+        my = (miny + maxy) / 2;
+        // Super-triangle, counter-clockwise, far enough out that its corners
+        // don't bend the triangulation of the real cities
+        dt.x[n] = mx - DT_SUPER_SCALE * span;
+        dt.y[n] = my - DT_SUPER_SCALE * span;
+        dt.x[n + 1] = mx + DT_SUPER_SCALE * span;
+        dt.y[n + 1] = my - DT_SUPER_SCALE * span;
+        dt.x[n + 2] = mx;
+        dt.y[n + 2] = my + DT_SUPER_SCALE * span;
+        dt.ntri = 1;
+        for(k = 0; k < 3; k++) {
+            dt.tri[0].v[k] = n + k;
+            dt.tri[0].nb[k] = -1;
+        }
+        for(i = 0; i < n; i++) {
+            order[i] = ((uint64_t)hilbert_d(
+                        (uint32_t)((c->x[i] - minx) / span * 65535.0),
+                        (uint32_t)((c->y[i] - miny) / span * 65535.0)) << 32) |
+                (uint32_t)i;
+        }
+        qsort(order, n, sizeof(uint64_t), cmp_u64);
+    }
+
+    for(i = 0; ok && i < n; i++) {
+        p = (int)(order[i] & 0xffffffffu);
+        t = dt_insert(&dt, p, t, i + 1, &twin[p]);
+        if(t < 0) ok = false;
+    }
+
+    // Every real edge is in two triangles, once each way round - keep the a<b
+    // copy. Edges to the super-triangle corners are dropped.
+    for(t = 0; ok && t < dt.ntri; t++) {
+        for(k = 0; k < 3; k++) {
+            a = dt.tri[t].v[(k + 1) % 3];
+            b = dt.tri[t].v[(k + 2) % 3];
+            if(a >= n || b >= n || a > b) continue;
+            if(!push_key(&keys, &m, &cap, a, b)) {
+                ok = false;
+                break;
+            }
+        }
+    }
+    if(ok) m = unique_keys(keys, m);
+
+    // Repeated cities: copy the twin's edges. Bucket the edges by their first
+    // city (they're sorted) so each twin's list is a lookup.
+    deg = ok ? calloc(n + 1, sizeof(int)) : NULL;
+    if(ok && !deg) ok = false;
+    if(ok) {
+        for(j = 0; j < m; j++) deg[(keys[j] >> 32) + 1]++;
+        for(i = 0; i < n; i++) deg[i + 1] += deg[i];
+        base = m;
+        for(i = 0; ok && i < n; i++) {
+            if(twin[i] == i) continue;
+            ok = push_key(&keys, &m, &cap, i, twin[i]);
+            // Edges listed under the twin...
+            for(j = deg[twin[i]]; ok && j < deg[twin[i] + 1]; j++) {
+                ok = push_key(&keys, &m, &cap, i,
+                        (int)(keys[j] & 0xffffffffu));
+            }
+            // ...and edges listing the twin second
+            for(j = 0; ok && j < base && (int)(keys[j] >> 32) < twin[i]; j++) {
+                if((int)(keys[j] & 0xffffffffu) == twin[i]) {
+                    ok = push_key(&keys, &m, &cap, i, (int)(keys[j] >> 32));
+                }
+            }
+        }
+        if(ok && m > base) m = unique_keys(keys, m);
+    }
+
+    dt_free(&dt);
+    free(order);
+    free(twin);
+    free(deg);
+    if(!ok) {
+        tsp_log("Failed to allocate memory for Delaunay triangulation!");
+        free(keys);
+        return NULL;
+    }
+    *nedges = m;
+    return keys;
+}
+
+static int quadrant(const TSP_Coords *c, int i, int j) {
+    /* Which quadrant around city i city j sits in, 0-3 counter-clockwise from
+     * +x (a city right on top of i counts as quadrant 0) */
+    double dx = c->x[j] - c->x[i], dy = c->y[j] - c->y[i];
+    if(dx > 0 || (dx == 0 && dy >= 0)) return (dy >= 0) ? 0 : 3;
+    return (dy > 0) ? 1 : 2;
+}
+
+TSP_Graph* create_delaunay_graph(const TSP_Coords *c, int metric, int quad) {
+    /*
+     * Candidate graph from the Delaunay triangulation of c, weighted by metric
+     * (the triangulation itself is always Euclidean - for the other metrics it
+     * is still a good set of candidates, just not an exact one).
+     *
+     * If quad > 0, each city is also joined to its quad nearest cities in each
+     * of the four quadrants around it. They're looked for among the cities two
+     * Delaunay edges away, which is where they almost always are; the quadrant
+     * edges give 2-opt a way out in every direction even at the edge of a
+     * cluster.
+     */
+    TSP_Graph *g = NULL, *dg = NULL;
+    uint64_t *keys = NULL, *grow = NULL;
+    int *eu = NULL, *ev = NULL, *ew = NULL, *seen = NULL;
+    int (*best)[2] = NULL; // Per quadrant: quad (dist, city) slots
+    long m = 0, cap = 0, j = 0;
+    int n = 0, i = 0, a = 0, b = 0, q = 0, k = 0, d = 0, u = 0, v = 0;
+    int cnt[4];
+    bool ok = true;
+    if(!c || c->n < 2) return NULL;
+    n = c->n;
+    keys = delaunay_edges(c, &m);
+    if(!keys) return NULL;
+    cap = m;
+
+    if(quad > 0) {
+        // The Delaunay graph on its own, to walk the 2-ring
+        eu = malloc((m ? m : 1) * sizeof(int));
+        ev = malloc((m ? m : 1) * sizeof(int));
+        ew = calloc((m ? m : 1), sizeof(int));
+        seen = malloc(n * sizeof(int));
+        best = malloc(4 * quad * sizeof(*best));
+        if(!eu || !ev || !ew || !seen || !best) ok = false;
+        for(j = 0; ok && j < m; j++) {
+            eu[j] = (int)(keys[j] >> 32);
+            ev[j] = (int)(keys[j] & 0xffffffffu);
+        }
+        if(ok) dg = create_graph_edges(n, m, eu, ev, ew, true);
+        if(!dg) ok = false;
+        for(i = 0; ok && i < n; i++) seen[i] = -1;
+        for(i = 0; ok && i < n; i++) {
+            for(q = 0; q < 4; q++) cnt[q] = 0;
+            seen[i] = i;
+            for(a = dg->rowptr[i]; a < dg->rowptr[i + 1]; a++) {
+                u = dg->col[a];
+                for(b = -1; b < dg->rowptr[u + 1] - dg->rowptr[u]; b++) {
+                    // b == -1 is u itself, then u's neighbours
+                    v = (b < 0) ? u : dg->col[dg->rowptr[u] + b];
+                    if(seen[v] == i) continue;
+                    seen[v] = i;
+                    q = quadrant(c, i, v);
+                    d = coord_dist(c, metric, i, v);
+                    // Insertion sort into the quadrant's short list
+                    if(cnt[q] == quad && d >= best[q * quad + quad - 1][0]) {
+                        continue;
+                    }
+                    k = (cnt[q] < quad) ? cnt[q]++ : quad - 1;
+                    while(k > 0 && best[q * quad + k - 1][0] > d) {
+                        best[q * quad + k][0] = best[q * quad + k - 1][0];
+                        best[q * quad + k][1] = best[q * quad + k - 1][1];
+                        k--;
+                    }
+                    best[q * quad + k][0] = d;
+                    best[q * quad + k][1] = v;
+                }
+            }
+            for(q = 0; ok && q < 4; q++) {
+                for(k = 0; k < cnt[q]; k++) {
+                    if(m == cap) {
+                        cap = 2 * cap + 16;
+                        grow = realloc(keys, cap * sizeof(uint64_t));
+                        if(!grow) {
+                            ok = false;
+                            break;
+                        }
+                        keys = grow;
+                    }
+                    a = (i < best[q * quad + k][1]) ? i : best[q * quad + k][1];
+                    b = (i < best[q * quad + k][1]) ? best[q * quad + k][1] : i;
+                    keys[m++] = ((uint64_t)a << 32) | (uint32_t)b;
+                }
+            }
+        }
+        if(ok) m = unique_keys(keys, m);
+        destroy_graph(dg);
+        free(eu);
+        free(ev);
+        free(ew);
+        free(seen);
+        free(best);
+        eu = ev = ew = NULL;
+    }
+
+    if(ok) {
+        eu = malloc((m ? m : 1) * sizeof(int));
+        ev = malloc((m ? m : 1) * sizeof(int));
+        ew = malloc((m ? m : 1) * sizeof(int));
+        if(!eu || !ev || !ew) ok = false;
+    }
+    for(j = 0; ok && j < m; j++) {
+        eu[j] = (int)(keys[j] >> 32);
+        ev[j] = (int)(keys[j] & 0xffffffffu);
+        ew[j] = coord_dist(c, metric, eu[j], ev[j]);
+    }
+    if(ok) g = create_graph_edges(n, m, eu, ev, ew, true);
+    else tsp_log("Failed to allocate memory for Delaunay graph!");
+    free(keys);
+    free(eu);
+    free(ev);
+    free(ew);
+    return g;
+}
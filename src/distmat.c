@@ -0,0 +1,361 @@
+/*
+* TSP
+* Copyright (C) Zach Wilder 2024
+*
+* This file is a part of TSP
+*
+* TSP is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* TSP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with TSP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <tsp.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+/*****
+ * DistMatrix
+ *
+ * The distance table used to be an array of separately malloc'd rows (int **),
+ * which meant every lookup chased a pointer and the rows could end up anywhere
+ * in memory. This keeps the whole table in one aligned block instead - row i
+ * starts at data + i * stride, and stride is n rounded up to a full cache line
+ * of ints.
+ *
+ * Symmetric tables can instead be packed (create_sym_dist_matrix), keeping only
+ * the upper triangle. See dm_sym_index() in distmat.h for the layout.
+ *
+ * Or, for instances too big to store at all, an oracle matrix
+ * (create_oracle_dist_matrix) keeps no table and works distances out from the
+ * coordinates on demand.
+ *
+ * Or, when the full table is wanted but smaller, a quantized matrix
+ * (create_quantized_dist_matrix) keeps 16 bits per distance.
+ *****/
+
+static int* dm_alloc(size_t bytes) {
+    /* aligned_alloc wants a size that is a multiple of the alignment */
+    int *data = NULL;
+    bytes = ((bytes + DM_ALIGN - 1) / DM_ALIGN) * DM_ALIGN;
+    data = aligned_alloc(DM_ALIGN, bytes);
+    if(data) {
+        memset(data, 0, bytes);
+    }
+    return data;
+}
+
+DistMatrix* create_dist_matrix(int n) {
+    /* Allocate an n x n distance matrix, zeroed (including the padding) */
+    DistMatrix *m = NULL;
+    size_t bytes;
+    if(n <= 0) return NULL;
+    m = calloc(1, sizeof(DistMatrix));
+    if(!m) return NULL;
+    m->n = n;
+    m->stride = ((n + DM_STRIDE_ALIGN - 1) / DM_STRIDE_ALIGN) * DM_STRIDE_ALIGN;
+    m->mode = DM_FULL;
+    bytes = (size_t)n * m->stride * sizeof(int);
+    m->data = dm_alloc(bytes);
+    if(!m->data) {
+        tsp_log("Failed to allocate memory for %dx%d matrix!", n, n);
+        free(m);
+        return NULL;
+    }
+    return m;
+}
+
+DistMatrix* create_sym_dist_matrix(int n) {
+    /* Allocate a packed symmetric n x n matrix, zeroed */
+    DistMatrix *m = NULL;
+    if(n <= 0) return NULL;
+    m = calloc(1, sizeof(DistMatrix));
+    if(!m) return NULL;
+    m->n = n;
+    m->stride = 0;
+    m->mode = DM_SYMMETRIC;
+    m->data = dm_alloc(dm_bytes(m));
+    if(!m->data) {
+        tsp_log("Failed to allocate memory for %dx%d matrix!", n, n);
+        free(m);
+        return NULL;
+    }
+    return m;
+}
+
+DistMatrix* create_oracle_dist_matrix(const TSP_Coords *coords, int metric) {
+    /* Make a matrix that calculates distances from coords on the fly. coords
+     * must outlive the matrix. */
+    DistMatrix *m = NULL;
+    if(!coords || coords->n <= 0) return NULL;
+    m = calloc(1, sizeof(DistMatrix));
+    if(!m) return NULL;
+    m->n = coords->n;
+    m->stride = 0;
+    m->mode = DM_ORACLE;
+    m->coords = coords;
+    m->metric = metric;
+    return m;
+}
+
+DistMatrix* create_quantized_dist_matrix(const DistMatrix *src) {
+    /* Make a 16 bit copy of src (any mode - an oracle source never needs its
+     * full table in memory). Goes through src twice, once to find the range of
+     * distances and pick qoffset/qscale, then again to fill in the table and
+     * measure the worst rounding error, which ends up in qerr. */
+    DistMatrix *m = NULL;
+    int *row = NULL;
+    int i, j, lo = INT_MAX, hi = INT_MIN, err;
+    uint16_t *qrow = NULL;
+    if(!src || src->n <= 0) return NULL;
+    row = malloc(src->n * sizeof(int));
+    m = calloc(1, sizeof(DistMatrix));
+    if(!row || !m) {
+        free(row);
+        free(m);
+        return NULL;
+    }
+    m->n = src->n;
+    m->stride = ((m->n + DM_STRIDE_ALIGN16 - 1) / DM_STRIDE_ALIGN16) *
+        DM_STRIDE_ALIGN16;
+    m->mode = DM_QUANT16;
+    m->q16 = (uint16_t *)dm_alloc((size_t)m->n * m->stride * sizeof(uint16_t));
+    if(!m->q16) {
+        tsp_log("Failed to allocate memory for %dx%d matrix!", m->n, m->n);
+        free(row);
+        free(m);
+        return NULL;
+    }
+
+    for(i = 0; i < m->n; i++) {
+        dm_get_row(src, i, 0, m->n, row);
+        for(j = 0; j < m->n; j++) {
+            if(row[j] < lo) lo = row[j];
+            if(row[j] > hi) hi = row[j];
+        }
+    }
+    // Smallest whole number scale that stretches 0..UINT16_MAX over lo..hi
+    m->qoffset = lo;
+    m->qscale = (int)(((long)hi - lo + UINT16_MAX - 1) / UINT16_MAX);
+    if(m->qscale < 1) m->qscale = 1;
+
+    for(i = 0; i < m->n; i++) {
+        dm_get_row(src, i, 0, m->n, row);
+        qrow = m->q16 + (size_t)i * m->stride;
+        for(j = 0; j < m->n; j++) {
+            qrow[j] = dm_quantize(m, row[j]);
+            err = abs(m->qoffset + qrow[j] * m->qscale - row[j]);
+            if(err > m->qerr) m->qerr = err;
+        }
+    }
+    free(row);
+    return m;
+}
+
+size_t dm_bytes(const DistMatrix *m) {
+    /* Bytes of distance data held by m (not counting the struct) */
+    if(m->mode == DM_ORACLE) {
+        return 0;
+    }
+    if(m->mode == DM_QUANT16) {
+        return (size_t)m->n * m->stride * sizeof(uint16_t);
+    }
+    if(m->mode == DM_SYMMETRIC) {
+        return ((size_t)m->n * (m->n + 1) / 2) * sizeof(int);
+    }
+    return (size_t)m->n * m->stride * sizeof(int);
+}
+
+void destroy_dist_matrix(DistMatrix *m) {
+    if(!m) return;
+    if(m->data) {
+        free(m->data);
+    }
+    if(m->q16) {
+        free(m->q16);
+    }
+    free(m);
+}
+
+void dm_fill(DistMatrix *m, int value) {
+    /* Set every (real, not padding) cell in the matrix to value */
+    int i, j;
+    int *row;
+    size_t k;
+    uint16_t q;
+    if(m->mode == DM_ORACLE) {
+        return;
+    }
+    if(m->mode == DM_QUANT16) {
+        q = dm_quantize(m, value);
+        for(k = 0; k < dm_bytes(m) / sizeof(uint16_t); k++) {
+            m->q16[k] = q;
+        }
+        return;
+    }
+    if(m->mode == DM_SYMMETRIC) {
+        for(k = 0; k < dm_bytes(m) / sizeof(int); k++) {
+            m->data[k] = value;
+        }
+        return;
+    }
+    for(i = 0; i < m->n; i++) {
+        row = dm_row(m, i);
+        for(j = 0; j < m->n; j++) {
+            row[j] = value;
+        }
+    }
+}
+
+void dm_get_row(const DistMatrix *m, int i, int from, int count, int *out) {
+    /* out[k] = dm_get(m, i, from + k) for k < count, but in one go */
+    int k;
+    const uint16_t *q = NULL;
+    switch(m->mode) {
+        case DM_QUANT16:
+            // Widen to 32 bits, eight or sixteen at a time
+            q = m->q16 + (size_t)i * m->stride + from;
+            #pragma omp simd
+            for(k = 0; k < count; k++) {
+                out[k] = m->qoffset + q[k] * m->qscale;
+            }
+            break;
+        case DM_FULL:
+            memcpy(out, dm_row(m, i) + from, count * sizeof(int));
+            break;
+        case DM_ORACLE:
+            coord_dist_row(m->coords, m->metric, i, from, count, out);
+            break;
+        default:
+            for(k = 0; k < count; k++) {
+                out[k] = dm_get(m, i, from + k);
+            }
+            break;
+    }
+}
+
+bool dm_is_symmetric(const DistMatrix *m) {
+    /* dist(i,j) == dist(j,i) everywhere? Every solver but Held-Karp and
+     * nearest neighbor counts on it - 2-opt's move gain assumes a reversed
+     * stretch of tour costs the same, and on an asymmetric table it can keep
+     * "improving" forever. Packed and oracle matrices can't be anything
+     * else. */
+    int i, j;
+    if(m->mode == DM_SYMMETRIC || m->mode == DM_ORACLE) return true;
+    for(i = 0; i < m->n; i++) {
+        for(j = i + 1; j < m->n; j++) {
+            if(dm_get(m, i, j) != dm_get(m, j, i)) return false;
+        }
+    }
+    return true;
+}
+
+long dm_tour_bound(const DistMatrix *m) {
+    /* Most any tour can cost - each city is left once, at worst by its
+     * longest edge. Tour costs are ints, so tables where this doesn't fit
+     * could overflow. */
+    long bound = 0;
+    int i, j, d, worst;
+    for(i = 0; i < m->n; i++) {
+        worst = 0;
+        for(j = 0; j < m->n; j++) {
+            d = dm_get(m, i, j);
+            if(d > worst) worst = d;
+        }
+        bound += worst;
+    }
+    return bound;
+}
+
+/*****
+ * Parallel matrix builder
+ *
+ * Rows are handed out DM_BUILD_BLOCK at a time from a shared counter, so a
+ * thread that finishes early just grabs the next block (packed rows get shorter
+ * as they go, so a static split would leave the first thread doing most of the
+ * work). Each row is one coord_dist_row() call straight into the matrix.
+ *****/
+#define DM_BUILD_BLOCK 64
+
+typedef struct {
+    DistMatrix *m;
+    const TSP_Coords *c;
+    int metric;
+    atomic_int next; // First row of the next unclaimed block
+} DMBuildJob;
+
+static void dm_build_row(DistMatrix *m, const TSP_Coords *c, int metric, int i) {
+    if(m->mode == DM_SYMMETRIC) {
+        // Packed row i holds (i,i) .. (i,n-1), all in a row
+        coord_dist_row(c, metric, i, i, m->n - i,
+                m->data + dm_sym_index(m->n, i, i));
+    } else {
+        coord_dist_row(c, metric, i, 0, m->n, dm_row(m, i));
+    }
+}
+
+static void* dm_build_worker(void *arg) {
+    DMBuildJob *job = arg;
+    int start, i, end;
+    while(true) {
+        start = atomic_fetch_add(&job->next, DM_BUILD_BLOCK);
+        if(start >= job->m->n) break;
+        end = start + DM_BUILD_BLOCK;
+        if(end > job->m->n) end = job->m->n;
+        for(i = start; i < end; i++) {
+            dm_build_row(job->m, job->c, job->metric, i);
+        }
+    }
+    return NULL;
+}
+
+int dm_default_threads(void) {
+    /* Number of threads to use when the caller doesn't say */
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    return (ncpu > 0) ? (int)ncpu : 1;
+}
+
+bool dm_build(DistMatrix *m, const TSP_Coords *c, int metric, int nthreads) {
+    /* Fill m with the distances between every pair of cities in c, using
+     * nthreads threads (0 for one per CPU). m must be DM_FULL or DM_SYMMETRIC
+     * and the same size as c (for DM_QUANT16, build an oracle matrix and pass
+     * it to create_quantized_dist_matrix). */
+    DMBuildJob job;
+    pthread_t *threads = NULL;
+    int i, started = 0;
+    if(!m || !c || m->n != c->n) return false;
+    if(m->mode != DM_FULL && m->mode != DM_SYMMETRIC) return false;
+    if(nthreads <= 0) nthreads = dm_default_threads();
+    // No point starting threads that won't get a block
+    if(nthreads > (m->n + DM_BUILD_BLOCK - 1) / DM_BUILD_BLOCK) {
+        nthreads = (m->n + DM_BUILD_BLOCK - 1) / DM_BUILD_BLOCK;
+    }
+    job.m = m;
+    job.c = c;
+    job.metric = metric;
+    atomic_init(&job.next, 0);
+    if(nthreads > 1) {
+        threads = malloc((nthreads - 1) * sizeof(pthread_t));
+    }
+    if(threads) {
+        for(i = 0; i < nthreads - 1; i++) {
+            if(pthread_create(&threads[i], NULL, dm_build_worker, &job) != 0) {
+                break;
+            }
+            started++;
+        }
+    }
+    dm_build_worker(&job); // This thread helps too
+    for(i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    return true;
+}
@@ -40,15 +40,48 @@
 
 Glyph *g_screenbuf = NULL;
 
+/*****
+ * draw_screen() only sends what changed: g_lastframe is what the terminal is
+ * showing now, and each frame is compared with it cell by cell. Changed cells
+ * are written into g_framebuf - a cursor move only where the last write
+ * didn't already leave the cursor there, a color/bold change only where the
+ * cell before had different ones - and the whole frame goes out in one write.
+ * A frame where a few cities light up is a few hundred bytes, not the ~40K of
+ * redrawing every cell with a printf and fflush each.
+ *
+ * The terminal being resized (the screen moves to stay centred) or anything
+ * else drawing on it (draw_invalidate()) means a full redraw next frame.
+ *****/
+#define FRAME_CELL_MAX 40   // Longest a cell gets: move, colors, bold, char
+
+static Glyph *g_lastframe = NULL;
+static char *g_framebuf = NULL;
+static bool g_lastvalid = false;
+static int g_lastW = 0;
+static int g_lastH = 0;
+
 void init_screenbuf(void) {
     g_screenbuf = create_screen();
     clear_screen(g_screenbuf);
+    g_lastframe = create_screen();
+    g_framebuf = malloc(SCREEN_WIDTH * SCREEN_HEIGHT * FRAME_CELL_MAX + 16);
+    g_lastvalid = false;
 }
 
 void close_screenbuf(void) {
     // This function seems pointless but for consistency it exists.
     if(!g_screenbuf) return;
     destroy_screen(g_screenbuf);
+    if(g_lastframe) destroy_screen(g_lastframe);
+    free(g_framebuf);
+    g_lastframe = NULL;
+    g_framebuf = NULL;
+}
+
+void draw_invalidate(void) {
+    /* Something other than draw_screen() has been at the terminal - redraw
+     * everything next time */
+    g_lastvalid = false;
 }
 
 void draw_glyph(int x, int y, Glyph g) {
@@ -62,23 +95,94 @@ void draw_glyph(int x, int y, Glyph g) {
         scr_set_style(ST_NONE);
     }
     scr_pt_clr_char(x+dx,y+dy,g.fg,g.bg,g.ch);
+    if(g_lastframe) g_lastframe[get_screen_index(x,y)] = g;
+}
+
+static bool glyph_same(Glyph a, Glyph b) {
+    return (a.ch == b.ch) && (a.fg == b.fg) && (a.bg == b.bg);
+}
+
+static size_t frame_put_glyph(char *buf, Glyph g, int *fg, int *bg,
+        int *bold) {
+    /* The SGR for whatever of g's colors/bold differs from the last cell
+     * written (-1 for not known yet), then g's char */
+    size_t len = 0;
+    int b = (g.fg >= BRIGHT_BLACK);
+    if(g.fg != *fg || g.bg != *bg || b != *bold) {
+        len += sprintf(buf, "\x1b[");
+        if(*bold < 0) {
+            // First cell of the frame - reset whatever style came before
+            len += sprintf(buf + len, b ? "0;1;" : "0;");
+        } else if(b != *bold) {
+            len += sprintf(buf + len, b ? "1;" : "22;");
+        }
+        if(g.fg != *fg) len += sprintf(buf + len, "38;5;%d;", g.fg);
+        if(g.bg != *bg) len += sprintf(buf + len, "48;5;%d;", g.bg);
+        buf[len - 1] = 'm';
+        *fg = g.fg;
+        *bg = g.bg;
+        *bold = b;
+    }
+    buf[len++] = g.ch;
+    return len;
 }
 
 void draw_screen(Glyph *screen) {
     /* Take a standard array of Glyphs, length SCREEN_WIDTH x SCREEN_HEIGHT, and
-     * render it on the screen. */
-    int x, y, i;
-    for(x = 0; x < SCREEN_WIDTH; x++) {
+     * render it on the screen - just the cells that changed since the last
+     * frame (see above). Glyphs without a char are left as they are. */
+    int w = g_screenW, h = g_screenH;
+    int dx = (w / 2) - (SCREEN_WIDTH / 2);
+    int dy = (h / 2) - (SCREEN_HEIGHT / 2);
+    int x, y, i, curx = -1, cury = -1, fg = -1, bg = -1, bold = -1;
+    size_t len = 0;
+    bool full = !g_lastvalid || (w != g_lastW) || (h != g_lastH);
+    if(!g_lastframe || !g_framebuf) {
+        // No memory for the last frame - draw every glyph the slow way
         for(y = 0; y < SCREEN_HEIGHT; y++) {
+            for(x = 0; x < SCREEN_WIDTH; x++) {
+                i = get_screen_index(x,y);
+                if(screen[i].ch) draw_glyph(x,y,screen[i]);
+            }
+        }
+        return;
+    }
+    if(full && g_lastvalid) {
+        // Resized: the old frame is somewhere else now, clear it away
+        len += sprintf(g_framebuf, "\x1b[0m\x1b[2J");
+    }
+    if(full) {
+        // Cells this frame doesn't draw are unknown, not what was there
+        for(i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; i++) {
+            g_lastframe[i].ch = '\0';
+        }
+    }
+    for(y = 0; y < SCREEN_HEIGHT; y++) {
+        for(x = 0; x < SCREEN_WIDTH; x++) {
             i = get_screen_index(x,y);
-            if(i > (SCREEN_WIDTH * SCREEN_HEIGHT - 1)) {
-                break;
+            if(!screen[i].ch) continue;
+            if(!full && glyph_same(screen[i], g_lastframe[i])) continue;
+            if(x + dx < 0 || x + dx >= w || y + dy < 0 || y + dy >= h) {
+                continue; // Off the edge of a small terminal
             }
-            if(screen[i].ch) {
-                draw_glyph(x,y,screen[i]);
+            if(x + dx != curx || y + dy != cury) {
+                len += sprintf(g_framebuf + len, "\x1b[%d;%dH", y+dy+1,
+                        x+dx+1);
             }
+            len += frame_put_glyph(g_framebuf + len, screen[i], &fg, &bg,
+                    &bold);
+            curx = x + dx + 1;
+            cury = y + dy;
+            g_lastframe[i] = screen[i];
         }
     }
+    g_lastvalid = true;
+    g_lastW = w;
+    g_lastH = h;
+    if(len) {
+        fwrite(g_framebuf, 1, len, stdout);
+        fflush(stdout);
+    }
 }
 
 void draw_str(int x, int y, char *str) {
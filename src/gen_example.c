@@ -31,25 +31,20 @@ void generate_example(void) {
             mt_rand(BRIGHT_BLACK, BRIGHT_WHITE), BLACK);
     draw_screen(g_screenbuf);
 
-    // Temporary, before we start using random numbers for x,y points and
-    // finding distances using man_dist(A,B)
-    int i,x,y;
-    Vec2i *points = malloc(SIZE * sizeof(Vec2i));
+    // Random x,y points, with the distances between them (manhattan, same as
+    // man_dist(A,B)) filled in by dm_build
+    int i;
+    TSP_Coords *points = create_coords(SIZE);
     for(i = 0; i < SIZE; i++) {
-        points[i].x = mt_rand(0,100);
-        points[i].y = mt_rand(0,100);
-    }
-    for(x = 0; x < SIZE; x++) {
-        for(y = 0; y < SIZE; y++) {
-            i = man_dist(points[x],points[y]);
-            g_data->dist[x][y] = i;
-        }
+        points->x[i] = mt_rand(0,100);
+        points->y[i] = mt_rand(0,100);
     }
+    dm_build(g_data->dist, points, METRIC_MAN_2D, 0);
 
     //Generate paths
     g_data->hk_path = held_karp(g_data->dist,0);
     g_data->nn_path = nearest_neighbor(g_data->dist);
-    free(points);
+    destroy_coords(points);
 }
 
 /*
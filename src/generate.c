@@ -0,0 +1,280 @@
+/*
+* TSP
+* Copyright (C) Zach Wilder 2024
+*
+* This file is a part of TSP
+*
+* TSP is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* TSP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with TSP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <tsp.h>
+#include <pthread.h>
+
+/*****
+ * Instance generator (see generate.h)
+ *
+ * The layout (the groups) is drawn first, on the calling thread. Then the
+ * workers take GEN_CHUNK pieces of the coordinate arrays off a counter and
+ * fill them in, each from the piece's own stream.
+ *****/
+#define GEN_ROAD_LINKS 3        // Roads out of each town to its nearest
+#define GEN_ROAD_ON 0.9         // Share of road cities on a road, not in town
+
+static const char *gen_names[GEN_KINDS] = {"uniform", "clustered", "grid",
+    "ring", "road"};
+
+typedef struct {
+    const GenOptions *g;
+    TSP_Coords *c;
+    TSP_Rng *streams;   // Piece k's is streams[k + 1]
+    int pieces;
+    atomic_int next;
+
+    int groups;
+    double *gx;         // Blob/town centres
+    double *gy;
+    double *gs;         // Blob spreads, ring radii
+    double *cum;        // Running total of ring lengths/road lengths, to pick
+                        // one in proportion to its length
+    int *ra;            // Road r runs from town ra[r] to town rb[r]
+    int *rb;
+    int roads;
+} GenJob;
+
+const char* gen_kind_name(GenKind kind) {
+    if(kind < 0 || kind >= GEN_KINDS) return "?";
+    return gen_names[kind];
+}
+
+static double gen_gauss(TSP_Rng *r, double *other) {
+    /* Two standard normals (Box-Muller), one returned, one in *other */
+    double u = 0, v = rng_double(r), m = 0;
+    while(u == 0) u = rng_double(r);
+    m = sqrt(-2 * log(u));
+    *other = m * sin(2 * M_PI * v);
+    return m * cos(2 * M_PI * v);
+}
+
+static int gen_pick(const double *cum, int count, double u) {
+    /* Index of the first cum[] past u * cum[count - 1] */
+    int lo = 0, hi = count - 1, mid = 0;
+    u *= cum[count - 1];
+    while(lo < hi) {
+        mid = (lo + hi) / 2;
+        if(cum[mid] <= u) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static bool gen_layout(GenJob *job, TSP_Rng *r) {
+    /* Centres, spreads, rings and roads for the kinds that have them */
+    const GenOptions *g = job->g;
+    double size = g->size, best[GEN_ROAD_LINKS], d = 0, dx = 0, dy = 0;
+    int k = job->groups, i = 0, j = 0, l = 0, near[GEN_ROAD_LINKS];
+    if(g->kind == GEN_UNIFORM || g->kind == GEN_GRID) return true;
+    job->gx = malloc(k * sizeof(double));
+    job->gy = malloc(k * sizeof(double));
+    job->gs = malloc(k * sizeof(double));
+    job->cum = malloc((size_t)k * GEN_ROAD_LINKS * sizeof(double));
+    job->ra = malloc((size_t)k * GEN_ROAD_LINKS * sizeof(int));
+    job->rb = malloc((size_t)k * GEN_ROAD_LINKS * sizeof(int));
+    if(!job->gx || !job->gy || !job->gs || !job->cum || !job->ra || !job->rb) {
+        return false;
+    }
+    for(i = 0; i < k; i++) {
+        job->gx[i] = rng_double(r) * size;
+        job->gy[i] = rng_double(r) * size;
+        // Blobs anywhere from a quarter to twice the average spacing wide
+        job->gs[i] = size / sqrt(k) * (0.25 + 1.75 * rng_double(r)) / 2;
+    }
+    if(g->kind == GEN_RING) {
+        for(i = 0; i < k; i++) {
+            job->gs[i] = size / 2 * (i + 1) / (k + 1);
+            job->cum[i] = job->gs[i] + (i ? job->cum[i - 1] : 0);
+        }
+    } else if(g->kind == GEN_ROAD) {
+        // Each town to its nearest few - O(k^2), but there aren't many towns
+        for(i = 0; i < k; i++) {
+            for(l = 0; l < GEN_ROAD_LINKS; l++) {
+                best[l] = INFINITY;
+                near[l] = -1;
+            }
+            for(j = 0; j < k; j++) {
+                if(j == i) continue;
+                dx = job->gx[j] - job->gx[i];
+                dy = job->gy[j] - job->gy[i];
+                d = dx * dx + dy * dy;
+                for(l = GEN_ROAD_LINKS; l > 0 && d < best[l - 1]; l--) {
+                    if(l < GEN_ROAD_LINKS) {
+                        best[l] = best[l - 1];
+                        near[l] = near[l - 1];
+                    }
+                }
+                if(l < GEN_ROAD_LINKS) {
+                    best[l] = d;
+                    near[l] = j;
+                }
+            }
+            for(l = 0; l < GEN_ROAD_LINKS && near[l] >= 0; l++) {
+                j = job->roads++;
+                job->ra[j] = i;
+                job->rb[j] = near[l];
+                job->cum[j] = sqrt(best[l]) + (j ? job->cum[j - 1] : 0);
+            }
+        }
+        if(job->roads == 0) job->gs[0] = size / 4; // One town, no roads
+    }
+    return true;
+}
+
+static double gen_clamp(double v, double size) {
+    /* Whole numbers inside [0, size) */
+    v = floor(v);
+    if(v < 0) return 0;
+    if(v > size - 1) return size - 1;
+    return v;
+}
+
+static void gen_piece(GenJob *job, TSP_Rng *r, int from, int to) {
+    /* Cities [from, to) */
+    const GenOptions *g = job->g;
+    double *x = job->c->x, *y = job->c->y;
+    double size = g->size, a = 0, t = 0, e = 0, dx = 0, dy = 0, len = 0;
+    int cols = (int)ceil(sqrt(g->n)), i = 0, k = 0;
+    switch(g->kind) {
+        case GEN_UNIFORM:
+            // The bulk fills straight into the arrays, then one SIMD pass
+            rng_fill_double(r, x + from, to - from);
+            rng_fill_double(r, y + from, to - from);
+            #pragma omp simd
+            for(i = from; i < to; i++) {
+                x[i] = floor(x[i] * size);
+                y[i] = floor(y[i] * size);
+            }
+            break;
+        case GEN_CLUSTERED:
+            for(i = from; i < to; i++) {
+                k = rng_range(r, 0, job->groups - 1);
+                x[i] = gen_clamp(job->gx[k] + job->gs[k] * gen_gauss(r, &e),
+                        size);
+                y[i] = gen_clamp(job->gy[k] + job->gs[k] * e, size);
+            }
+            break;
+        case GEN_GRID:
+            for(i = from; i < to; i++) {
+                x[i] = floor((i % cols + 0.5) * size / cols);
+                y[i] = floor((i / cols + 0.5) * size / cols);
+            }
+            break;
+        case GEN_RING:
+            for(i = from; i < to; i++) {
+                k = gen_pick(job->cum, job->groups, rng_double(r));
+                a = 2 * M_PI * rng_double(r);
+                t = job->gs[k] + size * 0.002 * gen_gauss(r, &e);
+                x[i] = gen_clamp(size / 2 + t * cos(a), size);
+                y[i] = gen_clamp(size / 2 + t * sin(a), size);
+            }
+            break;
+        case GEN_ROAD:
+            for(i = from; i < to; i++) {
+                if(job->roads == 0 || rng_double(r) >= GEN_ROAD_ON) {
+                    // In (well, around) a town
+                    k = rng_range(r, 0, job->groups - 1);
+                    x[i] = gen_clamp(job->gx[k] + size * 0.005 *
+                            gen_gauss(r, &e), size);
+                    y[i] = gen_clamp(job->gy[k] + size * 0.005 * e, size);
+                    continue;
+                }
+                // Somewhere along a road, a little to one side of it
+                k = gen_pick(job->cum, job->roads, rng_double(r));
+                t = rng_double(r);
+                dx = job->gx[job->rb[k]] - job->gx[job->ra[k]];
+                dy = job->gy[job->rb[k]] - job->gy[job->ra[k]];
+                len = sqrt(dx * dx + dy * dy);
+                e = (len > 0) ? size * 0.0005 * gen_gauss(r, &a) / len : 0;
+                x[i] = gen_clamp(job->gx[job->ra[k]] + t * dx - e * dy, size);
+                y[i] = gen_clamp(job->gy[job->ra[k]] + t * dy + e * dx, size);
+            }
+            break;
+    }
+}
+
+static void* gen_worker(void *arg) {
+    GenJob *job = arg;
+    int k = 0, from = 0, to = 0;
+    while((k = atomic_fetch_add(&job->next, 1)) < job->pieces) {
+        from = k * GEN_CHUNK;
+        to = (from + GEN_CHUNK < job->g->n) ? from + GEN_CHUNK : job->g->n;
+        gen_piece(job, &job->streams[k + 1], from, to);
+    }
+    return NULL;
+}
+
+TSP_Coords* generate_coords(const GenOptions *g, int nthreads) {
+    /* An instance's worth of coordinates as g describes, made on nthreads
+     * threads (0 for one per CPU). NULL if g is no good or there's no
+     * memory. */
+    GenJob job;
+    pthread_t *threads = NULL;
+    TSP_Coords *c = NULL;
+    int i = 0, started = 0;
+    bool ok = false;
+    if(!g || g->n <= 0 || g->size < 1 || g->kind < 0 || g->kind >= GEN_KINDS) {
+        return NULL;
+    }
+    memset(&job, 0, sizeof(job));
+    job.g = g;
+    job.pieces = (g->n + GEN_CHUNK - 1) / GEN_CHUNK;
+    atomic_init(&job.next, 0);
+    job.groups = g->groups;
+    if(job.groups <= 0) {
+        switch(g->kind) {
+            case GEN_RING: job.groups = 4; break;
+            case GEN_ROAD: job.groups = (int)sqrt(g->n) / 10 + 2; break;
+            default: job.groups = g->n / 100 + 1; break;
+        }
+    }
+    c = create_coords(g->n);
+    job.c = c;
+    job.streams = malloc((job.pieces + 1) * sizeof(TSP_Rng));
+    if(c && job.streams) {
+        rng_split(g->seed, job.streams, job.pieces + 1);
+        ok = gen_layout(&job, &job.streams[0]);
+    }
+
+    if(ok) {
+        if(nthreads <= 0) nthreads = dm_default_threads();
+        if(nthreads > job.pieces) nthreads = job.pieces;
+        threads = malloc(nthreads * sizeof(pthread_t));
+        for(i = 1; threads && i < nthreads; i++) {
+            if(pthread_create(&threads[i], NULL, gen_worker, &job) != 0) break;
+            started++;
+        }
+        gen_worker(&job);
+        for(i = 1; i <= started; i++) pthread_join(threads[i], NULL);
+        free(threads);
+    } else {
+        tsp_log("Failed to allocate memory for %d cities!", g->n);
+        destroy_coords(c);
+        c = NULL;
+    }
+    free(job.streams);
+    free(job.gx);
+    free(job.gy);
+    free(job.gs);
+    free(job.cum);
+    free(job.ra);
+    free(job.rb);
+    return c;
+}
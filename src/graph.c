@@ -0,0 +1,396 @@
+/*
+* TSP
+* Copyright (C) Zach Wilder 2024
+*
+* This file is a part of TSP
+*
+* TSP is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* TSP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with TSP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <tsp.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+/*****
+ * TSP_Graph
+ *
+ * Sparse graphs, for when not every Node is connected to every other Node (road
+ * networks). A graph can be solved directly with nearest_neighbor_graph() /
+ * held_karp_graph(), which only ever look at arcs that exist, or completed into
+ * a full DistMatrix with graph_shortest_paths() - the distance between two
+ * Nodes becomes the length of the shortest road between them.
+ *****/
+
+typedef struct {
+    int idx;
+    int w;
+} GraphArc;
+
+static int cmp_arc(const void *a, const void *b) {
+    const GraphArc *x = a, *y = b;
+    if(x->w != y->w) return (x->w < y->w) ? -1 : 1;
+    return x->idx - y->idx;
+}
+
+static long graph_tour_bound(const TSP_Graph *g) {
+    /* Most a tour on g's arcs can cost: a tour leaves each node once, over
+     * at most the node's dearest arc (the last, rows are sorted). Tours and
+     * Held-Karp's partial paths are added up in ints, so this has to fit. */
+    long bound = 0;
+    int i = 0;
+    for(i = 0; i < g->n; i++) {
+        if(g->rowptr[i + 1] > g->rowptr[i]) bound += g->w[g->rowptr[i + 1] - 1];
+    }
+    return bound;
+}
+
+TSP_Graph* create_graph_edges(int n, int m, const int *u, const int *v,
+        const int *w, bool undirected) {
+    /* Build a CSR graph from an edge list of m edges u[i] -> v[i] costing w[i].
+     * If undirected, every edge is stored in both directions. */
+    TSP_Graph *g = NULL;
+    GraphArc *tmp = NULL, *grow = NULL;
+    int *fill = NULL;
+    int i = 0, k = 0, a = 0, len = 0, narcs = 0;
+    if(n <= 0 || m < 0) return NULL;
+    for(i = 0; i < m; i++) {
+        if(u[i] < 0 || u[i] >= n || v[i] < 0 || v[i] >= n || w[i] < 0 ||
+                w[i] >= GRAPH_INF) {
+            tsp_log("Bad edge %d: %d -> %d (%d)!", i, u[i], v[i], w[i]);
+            return NULL;
+        }
+    }
+    narcs = undirected ? 2 * m : m;
+    g = calloc(1, sizeof(TSP_Graph));
+    if(!g) return NULL;
+    g->n = n;
+    g->narcs = narcs;
+    g->rowptr = calloc(n + 1, sizeof(int));
+    g->col = malloc((narcs ? narcs : 1) * sizeof(int));
+    g->w = malloc((narcs ? narcs : 1) * sizeof(int));
+    fill = malloc(n * sizeof(int));
+    if(!g->rowptr || !g->col || !g->w || !fill) {
+        tsp_log("Failed to allocate memory for graph!");
+        free(fill);
+        destroy_graph(g);
+        return NULL;
+    }
+
+    // Counting sort on the source node: count, prefix sum, scatter
+    for(i = 0; i < m; i++) {
+        g->rowptr[u[i] + 1]++;
+        if(undirected) g->rowptr[v[i] + 1]++;
+    }
+    for(i = 0; i < n; i++) {
+        g->rowptr[i + 1] += g->rowptr[i];
+        fill[i] = g->rowptr[i];
+    }
+    for(i = 0; i < m; i++) {
+        a = fill[u[i]]++;
+        g->col[a] = v[i];
+        g->w[a] = w[i];
+        if(undirected) {
+            a = fill[v[i]]++;
+            g->col[a] = u[i];
+            g->w[a] = w[i];
+        }
+    }
+    free(fill);
+
+    // Sort each row cheapest first, so nearest neighbor can stop at the first
+    // unvisited arc
+    for(i = 0; i < n; i++) {
+        len = g->rowptr[i + 1] - g->rowptr[i];
+        if(len < 2) continue;
+        grow = realloc(tmp, len * sizeof(GraphArc));
+        if(!grow) {
+            tsp_log("Failed to allocate memory for graph!");
+            free(tmp);
+            destroy_graph(g);
+            return NULL;
+        }
+        tmp = grow;
+        for(k = 0; k < len; k++) {
+            tmp[k].idx = g->col[g->rowptr[i] + k];
+            tmp[k].w = g->w[g->rowptr[i] + k];
+        }
+        qsort(tmp, len, sizeof(GraphArc), cmp_arc);
+        for(k = 0; k < len; k++) {
+            g->col[g->rowptr[i] + k] = tmp[k].idx;
+            g->w[g->rowptr[i] + k] = tmp[k].w;
+        }
+    }
+    free(tmp);
+    return g;
+}
+
+void destroy_graph(TSP_Graph *g) {
+    if(!g) return;
+    free(g->rowptr);
+    free(g->col);
+    free(g->w);
+    free(g);
+}
+
+TSP_Graph* load_graph_edges(const char *fname) {
+    /* Read an undirected graph from a text edge list:
+     *     n m
+     *     u v w     (m lines, Nodes numbered from 0)
+     * Lines starting with '#' are skipped. */
+    FILE *f = fopen(fname, "r");
+    TSP_Graph *g = NULL;
+    int *u = NULL, *v = NULL, *w = NULL;
+    int n = 0, m = 0, i = 0, c = 0;
+    if(!f) {
+        tsp_log("Can't open %s!", fname);
+        return NULL;
+    }
+    // Skip comment lines before the header
+    while((c = fgetc(f)) == '#') {
+        while((c = fgetc(f)) != EOF && c != '\n');
+    }
+    if(c != EOF) ungetc(c, f);
+    if(fscanf(f, "%d %d", &n, &m) != 2 || n <= 0 || m < 0) {
+        tsp_log("%s: bad header, expected \"n m\"!", fname);
+        fclose(f);
+        return NULL;
+    }
+    u = malloc((m ? m : 1) * sizeof(int));
+    v = malloc((m ? m : 1) * sizeof(int));
+    w = malloc((m ? m : 1) * sizeof(int));
+    if(!u || !v || !w) {
+        tsp_log("Failed to allocate memory for edges!");
+        m = -1;
+    }
+    for(i = 0; i < m; i++) {
+        while((c = fgetc(f)) == '#' || c == '\n' || c == ' ' || c == '\t' ||
+                c == '\r') {
+            if(c == '#') while((c = fgetc(f)) != EOF && c != '\n');
+        }
+        if(c != EOF) ungetc(c, f);
+        if(fscanf(f, "%d %d %d", &u[i], &v[i], &w[i]) != 3) {
+            tsp_log("%s: expected %d edges, got %d!", fname, m, i);
+            m = -1;
+            break;
+        }
+    }
+    fclose(f);
+    if(m >= 0) g = create_graph_edges(n, m, u, v, w, true);
+    // Only for the instance itself - candidate graphs are never toured, and
+    // a heavy arc there is just one 2-opt won't take
+    if(g && graph_tour_bound(g) > INT_MAX) {
+        tsp_log("%s: edge weights too large, a tour could overflow an int!",
+                fname);
+        destroy_graph(g);
+        g = NULL;
+    }
+    free(u);
+    free(v);
+    free(w);
+    return g;
+}
+
+TSP_Instance* load_instance_graph(const char *fname) {
+    /* A road network from an edge list (load_graph_edges()) as an instance:
+     * the shortest paths between every pair of Nodes to solve on, with the
+     * graph kept alongside for TSP_Options roads_only. NULL if the graph
+     * won't load or isn't connected. */
+    TSP_Graph *g = load_graph_edges(fname);
+    DistMatrix *m = NULL;
+    TSP_Instance *inst = NULL;
+    if(!g) return NULL;
+    m = graph_shortest_paths(g, 0);
+    if(m) inst = create_instance_matrix(m);
+    if(!inst) {
+        destroy_dist_matrix(m);
+        destroy_graph(g);
+        return NULL;
+    }
+    inst->graph = g;
+    return inst;
+}
+
+int graph_arc_weight(const TSP_Graph *g, int u, int v) {
+    /* Weight of the arc u -> v, GRAPH_INF if there isn't one. Rows are sorted
+     * by weight, not by node, so this is a scan of u's arcs. */
+    int a = 0;
+    for(a = g->rowptr[u]; a < g->rowptr[u + 1]; a++) {
+        if(g->col[a] == v) return g->w[a];
+    }
+    return GRAPH_INF;
+}
+
+/*****
+ * All pairs shortest paths
+ *
+ * Dijkstra from every Node, the sources handed out to threads one at a time
+ * with an atomic counter. Each thread has its own heap, which is a plain
+ * binary heap of (distance, node) pairs - a node can be pushed more than once
+ * and stale entries are skipped when popped, which is cheaper than a
+ * decrease-key for graphs this sparse.
+ *****/
+typedef struct {
+    int d;
+    int node;
+} HeapItem;
+
+typedef struct {
+    HeapItem *items;
+    int len;
+    int cap;
+} DijkstraHeap;
+
+static bool heap_push(DijkstraHeap *h, int d, int node) {
+    HeapItem *grow = NULL;
+    int i = 0, p = 0;
+    if(h->len == h->cap) {
+        grow = realloc(h->items, 2 * h->cap * sizeof(HeapItem));
+        if(!grow) return false;
+        h->items = grow;
+        h->cap *= 2;
+    }
+    // Sift up
+    i = h->len++;
+    while(i > 0) {
+        p = (i - 1) / 2;
+        if(h->items[p].d <= d) break;
+        h->items[i] = h->items[p];
+        i = p;
+    }
+    h->items[i].d = d;
+    h->items[i].node = node;
+    return true;
+}
+
+static HeapItem heap_pop(DijkstraHeap *h) {
+    HeapItem top = h->items[0];
+    HeapItem last = h->items[--h->len];
+    int i = 0, c = 0;
+    // Sift the last item down from the root
+    while((c = 2 * i + 1) < h->len) {
+        if(c + 1 < h->len && h->items[c + 1].d < h->items[c].d) c++;
+        if(last.d <= h->items[c].d) break;
+        h->items[i] = h->items[c];
+        i = c;
+    }
+    h->items[i] = last;
+    return top;
+}
+
+typedef struct {
+    const TSP_Graph *g;
+    DistMatrix *out;
+    atomic_int next;
+    atomic_long unreachable;
+} APSPJob;
+
+static void* apsp_worker(void *arg) {
+    APSPJob *job = arg;
+    const TSP_Graph *g = job->g;
+    int n = g->n;
+    int src = 0, i = 0, a = 0, nd = 0;
+    int *row = NULL;
+    long missing = 0;
+    HeapItem it;
+    DijkstraHeap h;
+    h.cap = 64;
+    h.len = 0;
+    h.items = malloc(h.cap * sizeof(HeapItem));
+    if(!h.items) return (void *)1;
+
+    while((src = atomic_fetch_add(&job->next, 1)) < n) {
+        // Rows of a DM_FULL matrix are written in place, nothing else touches
+        // this one
+        row = dm_row(job->out, src);
+        for(i = 0; i < n; i++) row[i] = GRAPH_INF;
+        row[src] = 0;
+        h.len = 0;
+        heap_push(&h, 0, src);
+        while(h.len) {
+            it = heap_pop(&h);
+            if(it.d > row[it.node]) continue; // Stale
+            for(a = g->rowptr[it.node]; a < g->rowptr[it.node + 1]; a++) {
+                nd = it.d + g->w[a];
+                if(nd < row[g->col[a]]) {
+                    row[g->col[a]] = nd;
+                    if(!heap_push(&h, nd, g->col[a])) {
+                        free(h.items);
+                        return (void *)1;
+                    }
+                }
+            }
+        }
+        for(i = 0; i < n; i++) {
+            if(row[i] == GRAPH_INF) missing++;
+        }
+    }
+    atomic_fetch_add(&job->unreachable, missing);
+    free(h.items);
+    return NULL;
+}
+
+DistMatrix* graph_shortest_paths(const TSP_Graph *g, int nthreads) {
+    /* Complete g into a full DM_FULL distance matrix of shortest path lengths,
+     * so any of the regular solvers can be used on it. NULL if g isn't
+     * connected - there's no tour through Nodes that can't reach each other,
+     * and a GRAPH_INF standing in for the missing paths would just be added
+     * into tour costs. Also NULL if the paths are so long a tour could
+     * overflow an int. nthreads <= 0 uses every core. */
+    DistMatrix *m = NULL;
+    pthread_t *threads = NULL;
+    APSPJob job;
+    void *ret = NULL;
+    bool ok = true;
+    int t = 0, started = 0;
+    if(!g) return NULL;
+    m = create_dist_matrix(g->n);
+    if(!m) return NULL;
+    if(nthreads <= 0) nthreads = dm_default_threads();
+    if(nthreads > g->n) nthreads = g->n;
+
+    job.g = g;
+    job.out = m;
+    atomic_init(&job.next, 0);
+    atomic_init(&job.unreachable, 0);
+    threads = malloc(nthreads * sizeof(pthread_t));
+    if(threads) {
+        for(t = 1; t < nthreads; t++) {
+            if(pthread_create(&threads[t], NULL, apsp_worker, &job) != 0) break;
+            started++;
+        }
+    }
+    // This thread works too, and picks up everything if no threads started
+    if(apsp_worker(&job) != NULL) ok = false;
+    for(t = 1; t <= started; t++) {
+        pthread_join(threads[t], &ret);
+        if(ret != NULL) ok = false;
+    }
+    free(threads);
+    if(!ok) {
+        tsp_log("Failed to allocate memory for Dijkstra heap!");
+        destroy_dist_matrix(m);
+        return NULL;
+    }
+    if(atomic_load(&job.unreachable) > 0) {
+        tsp_log("Graph is not connected: %ld pairs have no path!",
+                atomic_load(&job.unreachable));
+        destroy_dist_matrix(m);
+        return NULL;
+    }
+    if(dm_tour_bound(m) > INT_MAX) {
+        tsp_log("Shortest paths too long - a tour could overflow an int!");
+        destroy_dist_matrix(m);
+        return NULL;
+    }
+    return m;
+}
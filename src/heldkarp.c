@@ -19,7 +19,8 @@
 */
 #include <tsp.h>
 
-TSP_Path* held_karp(int **dist, int start) {
+TSP_Path* held_karp_ws(const DistMatrix *dist, int start, TSP_Workspace *ws,
+        const TSP_Stop *stop) {
     /*
      * Held-Karp Algorithm - Dynamic Programming
      * This uses some bitmath magic to keep track of path costs/visited nodes
@@ -29,61 +30,73 @@ TSP_Path* held_karp(int **dist, int start) {
      *  - End is the last node in the current path
      *  - dp[subset][end] stores the minimum cost to reach 'end' after visiting
      *    nodes in 'subset'
-     *  - Since this current implementation uses a fixed SIZE for the number of
-     *    nodes, the upper limit of SIZE would be 30 (2^31 is more than
-     *    INT_MAX). This could (probably) be improved by allocating memory
-     *    dynamically - or if the points are on an X,Y grid calculating the
-     *    distance (manhattan) instead of storing the costs.
+     *  - The subset is an int bitmask, so the upper limit of n is HK_MAX_N
+     *    (30, 2^31 is more than INT_MAX). The distances themselves can come
+     *    from any DistMatrix - including an oracle one that calculates them
+     *    from the coordinates instead of storing the costs - but the dp table
+     *    is still 2^n * n, and memory runs out well before n hits 30.
+     *
+     * dp/prev live in the workspace as flat 2^n * n blocks (row 'subset' is
+     * dp + subset * n), so solving a stream of instances reuses one table
+     * instead of allocating 2^n rows each time.
+     *
+     * With a stop token it checks every 4096 subsets, and returns NULL if it
+     * was told to stop - half a DP table isn't a tour.
      */
-    int **dp;
-    int **prev;
-    int path[SIZE + 1];
+    int *dp;
+    int *prev;
+    int *path;
+    int n = dist->n;
     int subset, last, newcost, cost, end, i, cur, next;
     int result = INT_MAX;
 
-    // Allocate memory for dp/prev
-    dp = malloc((1 << SIZE) * sizeof(int *));
-    prev = malloc((1 << SIZE) * sizeof(int *));
-    if(!dp || !prev) {
-        printf("Failed to allocate memory for dp/prev!\n");
+    if(n > HK_MAX_N) {
+        tsp_log("Held-Karp can't handle %d nodes (max %d)!", n, HK_MAX_N);
         return NULL;
     }
-    for(i = 0; i < (1 << SIZE); i++) {
-        dp[i] = malloc(SIZE * sizeof(int));
-        prev[i] = malloc(SIZE * sizeof(int));
-        if(!(dp[i]) || !(prev[i])) {
-            printf("Failed to allocate memory for [%d]!\n",i);
-            return NULL;
-        }
+    if(!workspace_reserve(ws, n, true)) {
+        tsp_log("Failed to allocate memory for dp/prev!");
+        return NULL;
     }
+    dp = ws->dp;
+    prev = ws->prev;
+    path = ws->path;
 
     // Start by filling the dp table with absurdly high values
-    for(subset = 0; subset < (1 << SIZE); subset++) {
-        for(i = 0; i < SIZE; i++) {
-            dp[subset][i] = INT_MAX;
+    for(subset = 0; subset < (1 << n); subset++) {
+        if((subset & 0xffff) == 0 && tsp_stopped(stop)) return NULL;
+        for(i = 0; i < n; i++) {
+            dp[(size_t)subset * n + i] = INT_MAX;
         }
     }
 
-    dp[1 << start][start] = 0; // Starting point has no cost
+    dp[(size_t)(1 << start) * n + start] = 0; // Starting point has no cost
 
     /*
      * Iterate over subsets - for each subset of nodes, calculate the cost of
      * reaching each node 'last' by extending paths from every other node 'i'
      */
-    for(subset = 0; subset < (1 << SIZE); subset++) {
-        for(last = 0; last < SIZE; last++) {
+    for(subset = 0; subset < (1 << n); subset++) {
+        if((subset & 0xfff) == 0) {
+            if(tsp_stopped(stop)) return NULL;
+            if((subset & 0xffff) == 0) {
+                stop_progress(stop, TSP_SOLVER_HK,
+                        (double)subset / (1 << n), INT_MAX);
+            }
+        }
+        for(last = 0; last < n; last++) {
             if(!(subset & (1 << last))) {
                 continue;
             }
 
             // Try visiting each possible previous node
-            for(i = 0; i < SIZE; i++) {
+            for(i = 0; i < n; i++) {
                 if(i == last || !(subset & (1 << i))) {
                     continue;
                 }
 
                 // check this bit magic. 
-                if (dp[subset ^ (1 << last)][i] != INT_MAX) {    
+                if (dp[(size_t)(subset ^ (1 << last)) * n + i] != INT_MAX) {    
                     /*
                      * subset ^ (1 << last) removes the 'last' node from the
                      * subset.
@@ -109,10 +122,11 @@ TSP_Path* held_karp(int **dist, int start) {
                      *  => New cost is the minimum cost to vist A,B (ending at
                      *    B), added to the cost of visiting C from B.
                      */
-                    newcost = dp[subset ^ (1 << last)][i] + dist[i][last]; 
-                    if(newcost < dp[subset][last]) {
-                        dp[subset][last] = newcost;
-                        prev[subset][last] = i; // track path
+                    newcost = dp[(size_t)(subset ^ (1 << last)) * n + i] +
+                        dm_get(dist,i,last);
+                    if(newcost < dp[(size_t)subset * n + last]) {
+                        dp[(size_t)subset * n + last] = newcost;
+                        prev[(size_t)subset * n + last] = i; // track path
                     }
                 }
             }
@@ -120,8 +134,9 @@ TSP_Path* held_karp(int **dist, int start) {
     }
     
     // Calculate the cost of returning to the start node (completing the tour)
-    for(last = 0; last < SIZE; last++) {
-        cost = dp[(1 << SIZE) - 1][last] + dist[last][start];
+    end = start;
+    for(last = 0; last < n; last++) {
+        cost = dp[(size_t)((1 << n) - 1) * n + last] + dm_get(dist,last,start);
         if(cost < result) {
             result = cost;
             end = last;
@@ -129,11 +144,11 @@ TSP_Path* held_karp(int **dist, int start) {
     }
 
     // Backtrack to reconstruct the path
-    cur = (1 << SIZE) - 1;
-    for(i = SIZE - 1; i > 0; i--) {
+    cur = (1 << n) - 1;
+    for(i = n - 1; i > 0; i--) {
         path[i] = end;
         next = cur ^ (1 << end);
-        end = prev[cur][end];
+        end = prev[(size_t)cur * n + end];
         cur = next;
     }
     path[0] = start;
@@ -141,21 +156,130 @@ TSP_Path* held_karp(int **dist, int start) {
     // Print the results!
     //print_path(path, result);
 
-    // Free allocated memory
-    for(i = 0; i < (1 << SIZE); i++) {
-        if(dp[i]) {
-            free(dp[i]);
+    return make_tsp_path(path, n, result);
+}
+
+TSP_Path* held_karp(const DistMatrix *dist, int start) {
+    /* held_karp_ws() with a workspace just for this call */
+    TSP_Workspace *ws = create_workspace();
+    TSP_Path *tour = NULL;
+    if(!ws) {
+        tsp_log("Failed to allocate memory for dp/prev!");
+        return NULL;
+    }
+    tour = held_karp_ws(dist, start, ws, NULL);
+    destroy_workspace(ws);
+    return tour;
+}
+
+TSP_Path* held_karp_graph(const TSP_Graph *g, int start,
+        const TSP_Stop *stop) {
+    /*
+     * Held-Karp on a sparse graph. Same dp[subset][end] table as held_karp(),
+     * but filled forwards: every reachable (subset, last) state is pushed out
+     * along the arcs that actually leave 'last', instead of trying all n
+     * possible previous Nodes and looking up a distance that might not exist.
+     * Work is 2^n * (number of arcs) rather than 2^n * n^2. The table is one
+     * flat block of 2^n * n entries.
+     *
+     * Returns NULL if the graph has no Hamiltonian cycle, or if stop (which
+     * can be NULL) says so - it's checked every 4096 subsets.
+     */
+    int *dp = NULL;
+    int *prev = NULL;
+    int *path = NULL;
+    int n = g->n;
+    int subset, last, next, newcost, cost, end, i, a, cur, full;
+    int result = INT_MAX;
+    size_t s = 0, idx = 0;
+    TSP_Path *tour = NULL;
+
+    if(n > HK_MAX_N) {
+        tsp_log("Held-Karp can't handle %d nodes (max %d)!", n, HK_MAX_N);
+        return NULL;
+    }
+    full = (1 << n) - 1;
+    path = malloc((n + 1) * sizeof(int));
+    dp = malloc(((size_t)1 << n) * n * sizeof(int));
+    prev = malloc(((size_t)1 << n) * n * sizeof(int));
+    if(!dp || !prev || !path) {
+        tsp_log("Failed to allocate memory for dp/prev!");
+        free(dp);
+        free(prev);
+        free(path);
+        return NULL;
+    }
+    for(s = 0; s < ((size_t)1 << n) * n; s++) {
+        dp[s] = INT_MAX;
+    }
+    dp[(size_t)(1 << start) * n + start] = 0;
+
+    // Subsets only ever grow, so by the time a subset is reached every way
+    // into it has already been pushed
+    for(subset = 0; subset <= full; subset++) {
+        if((subset & 0xfff) == 0) {
+            if(tsp_stopped(stop)) {
+                free(dp);
+                free(prev);
+                free(path);
+                return NULL;
+            }
+            if((subset & 0xffff) == 0) {
+                stop_progress(stop, TSP_SOLVER_HK,
+                        (double)subset / (full + 1), INT_MAX);
+            }
         }
-        if(prev[i]) {
-            free(prev[i]);
+        if(!(subset & (1 << start))) continue;
+        for(last = 0; last < n; last++) {
+            idx = (size_t)subset * n + last;
+            if(dp[idx] == INT_MAX) continue;
+            for(a = g->rowptr[last]; a < g->rowptr[last + 1]; a++) {
+                next = g->col[a];
+                if(subset & (1 << next)) continue;
+                newcost = dp[idx] + g->w[a];
+                s = (size_t)(subset | (1 << next)) * n + next;
+                if(newcost < dp[s]) {
+                    dp[s] = newcost;
+                    prev[s] = last;
+                }
+            }
         }
     }
-    if(dp) {
-        free(dp);
+
+    // Close the tour over an arc back to start
+    end = -1;
+    for(last = 0; last < n; last++) {
+        if(last == start && n > 1) continue;
+        if(dp[(size_t)full * n + last] == INT_MAX) continue;
+        cost = graph_arc_weight(g, last, start);
+        if(n == 1) cost = 0;
+        if(cost == GRAPH_INF) continue;
+        cost += dp[(size_t)full * n + last];
+        if(cost < result) {
+            result = cost;
+            end = last;
+        }
     }
-    if(prev) {
+    if(end < 0) {
+        tsp_log("Graph has no tour through all %d nodes!", n);
+        free(dp);
         free(prev);
+        free(path);
+        return NULL;
     }
-    
-    return make_tsp_path(path, result);
+
+    cur = full;
+    for(i = n - 1; i > 0; i--) {
+        path[i] = end;
+        next = cur ^ (1 << end);
+        end = prev[(size_t)cur * n + end];
+        cur = next;
+    }
+    path[0] = start;
+
+    free(dp);
+    free(prev);
+    tour = make_tsp_path(path, n, result);
+    free(path);
+    return tour;
 }
@@ -0,0 +1,146 @@
+/*
+* TSP
+* Copyright (C) Zach Wilder 2024
+*
+* This file is a part of TSP
+*
+* TSP is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* TSP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with TSP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <tsp.h>
+
+static void wake_around(TwoOpt *s, const TSP_Graph *cand, int a) {
+    /* Wake a, and the cities with a on their candidate lists - their best
+     * move could be onto a's new edge. The lists are close to symmetric, so
+     * a's own list stands in for them. */
+    int k = 0;
+    two_opt_wake(s, a);
+    if(!cand) return;
+    for(k = cand->rowptr[a]; k < cand->rowptr[a + 1]; k++) {
+        two_opt_wake(s, cand->col[k]);
+    }
+}
+
+static int bridge(TwoOpt *s, const DistMatrix *dist, const TSP_Graph *cand,
+        int *tmp, int p1, int p2, int p3, bool wake) {
+    /* Cut s's tour at positions p1 < p2 < p3 into A B C D and put it back
+     * together as A C B D - a change 2-opt can't undo in one move. Only the
+     * three joins change, so 2-opt only has to look around their six ends.
+     * Returns what it adds to the cost. bridge(p1, p1 + p3 - p2, p3) puts it
+     * back. */
+    int *t = s->t, n = s->n, i = 0;
+    int a = t[p1 - 1], b1 = t[p1], b2 = t[p2 - 1];
+    int c1 = t[p2], c2 = t[p3 - 1], d = t[p3 % n];
+    int delta = dm_get(dist, a, c1) + dm_get(dist, c2, b1) +
+        dm_get(dist, b2, d) - dm_get(dist, a, b1) - dm_get(dist, b2, c1) -
+        dm_get(dist, c2, d);
+    memcpy(tmp, t + p2, (p3 - p2) * sizeof(int));
+    memcpy(tmp + (p3 - p2), t + p1, (p2 - p1) * sizeof(int));
+    memcpy(t + p1, tmp, (p3 - p1) * sizeof(int));
+    for(i = p1; i < p3; i++) s->pos[t[i]] = i;
+    if(!wake) return delta;
+    wake_around(s, cand, a);
+    wake_around(s, cand, b1);
+    wake_around(s, cand, b2);
+    wake_around(s, cand, c1);
+    wake_around(s, cand, c2);
+    wake_around(s, cand, d);
+    return delta;
+}
+
+bool iterated_local_search(const DistMatrix *dist, const TSP_Graph *cand,
+        TSP_Path *tour, int kicks, TSP_Rng *rng, const TSP_Stop *stop,
+        TSP_Improved improved, void *arg) {
+    /*
+     * Iterated Local Search - tour should already be 2-opt optimal. Kick it
+     * with a random double bridge, let 2-opt settle it again, and keep the
+     * result if it's shorter than the best so far; otherwise go back to the
+     * best and kick again. 2-opt gets stuck in the first local optimum it
+     * finds, the kicks get it out without throwing away what's good.
+     *
+     * One TwoOpt lasts the whole run: a kick wakes just the cities around its
+     * joins, 2-opt works out from those, the cost moves by the kick's and the
+     * moves' deltas, and going back to the best is undoing the moves and the
+     * kick - nothing is copied, recounted or swept per kick unless it's an
+     * improvement.
+     *
+     * Runs kicks times (ILS_KICKS if 0) or until stop says so. improved (if
+     * not NULL) and stop's progress callback are told about each better tour
+     * as it's found. tour ends up as the
+     * best found, still starting at the same city. Returns true if it got
+     * shorter. The kicks are drawn from rng - parallel searches should each
+     * get their own stream (rng_split()) - or if it's NULL, from a generator
+     * seeded from n. Either way a run is repeatable.
+     */
+    int n = tour->n;
+    TwoOpt s;
+    int *tmp = NULL;
+    TSP_Rng own;
+    int k = 0, p1 = 0, p2 = 0, p3 = 0, best = 0;
+    bool better = false;
+    if(n < 8) return false;
+    if(kicks <= 0) kicks = ILS_KICKS;
+    if(!rng) {
+        rng_seed(&own, (uint64_t)n);
+        rng = &own;
+    }
+    tmp = malloc(n * sizeof(int));
+    if(!tmp || !two_opt_init(&s, tour, dist)) {
+        tsp_log("Failed to allocate memory for ILS!");
+        if(tmp) two_opt_free(&s);
+        free(tmp);
+        return false;
+    }
+    // Settles tour if it wasn't 2-opt optimal after all, and leaves every
+    // don't-look bit set for the kicks. tour's cost is copied back either
+    // way, since it's now measured on dist
+    better = two_opt_run(&s, dist, cand, stop);
+    two_opt_tour(&s, tour);
+    best = s.cost;
+    s.logging = true;
+
+    for(k = 0; k < kicks && !tsp_stopped(stop); k++) {
+        // A always starts at position 0, so the positions stay in order
+        p1 = rng_range(rng, 1, n - 3);
+        p2 = rng_range(rng, p1 + 1, n - 2);
+        p3 = rng_range(rng, p2 + 1, n - 1);
+        s.nundo = 0;
+        s.lost = false;
+        s.cost += bridge(&s, dist, cand, tmp, p1, p2, p3, true);
+        two_opt_run(&s, dist, cand, stop);
+        if(s.cost < best) {
+            best = s.cost;
+            two_opt_tour(&s, tour);
+            better = true;
+            if(improved) improved(tour, arg);
+            stop_progress(stop, TSP_SOLVER_ILS,
+                    (kicks == INT_MAX) ? -1 : (double)k / kicks, tour->cost);
+        } else if(!s.lost) {
+            two_opt_undo(&s);
+            // Back to the best, which 2-opt had already settled
+            bridge(&s, dist, cand, tmp, p1, p1 + p3 - p2, p3,
+                    false);
+            s.cost = best;
+        } else {
+            // The undo log ran out of memory - start over from the best
+            two_opt_free(&s);
+            if(!two_opt_init(&s, tour, dist)) break;
+            two_opt_run(&s, dist, cand, NULL);
+            s.logging = true;
+        }
+    }
+
+    two_opt_free(&s);
+    free(tmp);
+    return better;
+}
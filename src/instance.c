@@ -0,0 +1,315 @@
+/*
+* TSP
+* Copyright (C) Zach Wilder 2024
+*
+* This file is a part of TSP
+*
+* TSP is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* TSP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with TSP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <tsp.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*****
+ * TSP_Instance
+ *
+ * Bundles up the coordinates and distance matrix for one problem, and reads and
+ * writes them in the binary (.tspb) format described in instance.h. Loading a
+ * .tspb file maps it into memory and points the TSP_Coords/DistMatrix structs
+ * straight at the mapped pages - the solvers read the distances out of the page
+ * cache.
+ *****/
+
+#define FNV_PRIME 0x100000001b3ULL
+
+static size_t tspb_pad(size_t bytes) {
+    /* Round bytes up to the next section boundary */
+    return ((bytes + TSPB_ALIGN - 1) / TSPB_ALIGN) * TSPB_ALIGN;
+}
+
+TSP_Instance* create_instance_coords(TSP_Coords *coords, int metric,
+        int mode) {
+    /* Make an instance out of coords (the instance takes ownership of them).
+     * mode is the DistMatrixMode to use - DM_FULL, DM_SYMMETRIC or DM_QUANT16
+     * build the table now, DM_ORACLE calculates distances as they're needed. */
+    TSP_Instance *inst = NULL;
+    DistMatrix *oracle = NULL;
+    if(!coords) return NULL;
+    inst = malloc(sizeof(TSP_Instance));
+    if(!inst) return NULL;
+    inst->n = coords->n;
+    inst->metric = metric;
+    inst->coords = coords;
+    inst->graph = NULL;
+    inst->map = NULL;
+    inst->maplen = 0;
+    switch(mode) {
+        case DM_FULL: inst->dist = create_dist_matrix(coords->n); break;
+        case DM_SYMMETRIC: inst->dist = create_sym_dist_matrix(coords->n); break;
+        case DM_QUANT16:
+            // Quantize straight from the coordinates, no int table in between
+            oracle = create_oracle_dist_matrix(coords, metric);
+            inst->dist = create_quantized_dist_matrix(oracle);
+            destroy_dist_matrix(oracle);
+            break;
+        default: inst->dist = create_oracle_dist_matrix(coords, metric); break;
+    }
+    if(!inst->dist) {
+        free(inst);
+        return NULL;
+    }
+    if(mode == DM_FULL || mode == DM_SYMMETRIC) {
+        dm_build(inst->dist, coords, metric, 0);
+    }
+    return inst;
+}
+
+TSP_Instance* create_instance_matrix(DistMatrix *dist) {
+    /* Make an instance out of a distance table (which the instance now owns) */
+    TSP_Instance *inst = NULL;
+    if(!dist) return NULL;
+    inst = malloc(sizeof(TSP_Instance));
+    if(!inst) return NULL;
+    inst->n = dist->n;
+    inst->metric = METRIC_EXPLICIT;
+    inst->coords = NULL;
+    inst->dist = dist;
+    inst->graph = NULL;
+    inst->map = NULL;
+    inst->maplen = 0;
+    return inst;
+}
+
+void destroy_instance(TSP_Instance *inst) {
+    if(!inst) return;
+    destroy_graph(inst->graph);
+    if(inst->map) {
+        // The data belongs to the mapping, only the structs were malloc'd
+        free(inst->coords);
+        free(inst->dist);
+        munmap(inst->map, inst->maplen);
+    } else {
+        // Oracle matrices point at coords, so the matrix goes first
+        destroy_dist_matrix(inst->dist);
+        destroy_coords(inst->coords);
+    }
+    free(inst);
+}
+
+uint64_t fnv1a64(uint64_t h, const void *buf, size_t len) {
+    /* Continue a 64 bit FNV-1a hash h over len bytes of buf. Start with
+     * h = FNV64_INIT to begin a new hash. */
+    const unsigned char *p = buf;
+    size_t i;
+    for(i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+static bool tspb_write(FILE *f, const void *buf, size_t len, uint64_t *h) {
+    /* fwrite, and add what was written to the checksum */
+    *h = fnv1a64(*h, buf, len);
+    return (fwrite(buf, 1, len, f) == len);
+}
+
+static bool tspb_write_pad(FILE *f, size_t len, uint64_t *h) {
+    /* Write len zero bytes, to get to the next section boundary */
+    static const char zeros[TSPB_ALIGN] = {0};
+    return tspb_write(f, zeros, len, h);
+}
+
+bool save_instance_bin(const TSP_Instance *inst, const char *fname) {
+    /* Write inst to fname in the .tspb format. Coordinates are written if the
+     * instance has them, the matrix is written if it's a DM_FULL/DM_SYMMETRIC
+     * table. Oracle matrices are rebuilt from the coordinates on load instead,
+     * and so are quantized ones (as an oracle - quantize again after loading
+     * if that's wanted). */
+    TSP_BinHeader hdr;
+    FILE *f = NULL;
+    uint64_t h = FNV64_INIT;
+    size_t cbytes = 0, mbytes = 0, off = sizeof(TSP_BinHeader);
+    bool ok = true;
+    const DistMatrix *m = NULL;
+    if(!inst || !fname) return false;
+    m = inst->dist;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, TSPB_MAGIC, sizeof(hdr.magic));
+    hdr.version = TSPB_VERSION;
+    hdr.n = inst->n;
+    hdr.metric = inst->metric;
+    hdr.elem_type = TSPB_ELEM_NONE;
+    if(inst->coords) {
+        hdr.flags |= TSPB_HAS_COORDS;
+        hdr.coords_off = off;
+        cbytes = tspb_pad(inst->n * sizeof(double));
+        off += 2 * cbytes;
+    }
+    if(m && (m->mode == DM_FULL || m->mode == DM_SYMMETRIC)) {
+        hdr.flags |= TSPB_HAS_MATRIX;
+        hdr.elem_type = TSPB_ELEM_I32;
+        if(m->mode == DM_SYMMETRIC) {
+            hdr.flags |= TSPB_SYMMETRIC;
+        }
+        hdr.stride = m->stride;
+        hdr.matrix_off = off;
+        mbytes = dm_bytes(m);
+        off += tspb_pad(mbytes);
+    }
+    if(!(hdr.flags & (TSPB_HAS_COORDS | TSPB_HAS_MATRIX))) return false;
+    hdr.payload_len = off - sizeof(TSP_BinHeader);
+
+    f = fopen(fname, "wb");
+    if(!f) return false;
+    // Header goes in twice - once to hold the space, then again at the end
+    // once the checksum is known
+    ok = (fwrite(&hdr, sizeof(hdr), 1, f) == 1);
+    if(ok && inst->coords) {
+        ok = tspb_write(f, inst->coords->x, inst->n * sizeof(double), &h) &&
+            tspb_write_pad(f, cbytes - inst->n * sizeof(double), &h) &&
+            tspb_write(f, inst->coords->y, inst->n * sizeof(double), &h) &&
+            tspb_write_pad(f, cbytes - inst->n * sizeof(double), &h);
+    }
+    if(ok && (hdr.flags & TSPB_HAS_MATRIX)) {
+        ok = tspb_write(f, m->data, mbytes, &h) &&
+            tspb_write_pad(f, tspb_pad(mbytes) - mbytes, &h);
+    }
+    if(ok) {
+        hdr.checksum = h;
+        ok = (fseek(f, 0, SEEK_SET) == 0) &&
+            (fwrite(&hdr, sizeof(hdr), 1, f) == 1);
+    }
+    if(fclose(f) != 0) ok = false;
+    return ok;
+}
+
+static bool tspb_fits(uint64_t off, uint64_t len, size_t filelen) {
+    /* Whether len bytes at off are inside the file - written so that nothing
+     * from the header can wrap around */
+    return off <= filelen && len <= filelen - off;
+}
+
+static bool tspb_check_header(const TSP_BinHeader *hdr, size_t filelen) {
+    /* Make sure the header describes something that fits in the file */
+    uint64_t cbytes = tspb_pad((uint64_t)hdr->n * sizeof(double));
+    uint64_t mbytes = 0, stride = hdr->stride;
+    if(memcmp(hdr->magic, TSPB_MAGIC, sizeof(hdr->magic)) != 0) return false;
+    if(hdr->version != TSPB_VERSION) return false;
+    if(hdr->n == 0 || hdr->n > INT_MAX) return false;
+    // Anything else would quietly come out of coord_dist() as 0
+    if(hdr->metric > METRIC_ATT) return false;
+    if(hdr->metric == METRIC_EXPLICIT && !(hdr->flags & TSPB_HAS_MATRIX)) {
+        return false;
+    }
+    if(!tspb_fits(sizeof(TSP_BinHeader), hdr->payload_len, filelen)) {
+        return false;
+    }
+    if(hdr->flags & TSPB_HAS_COORDS) {
+        if(hdr->coords_off % TSPB_ALIGN != 0) return false;
+        // n <= INT_MAX, so 2 * cbytes is nowhere near wrapping
+        if(!tspb_fits(hdr->coords_off, 2 * cbytes, filelen)) return false;
+    }
+    if(hdr->flags & TSPB_HAS_MATRIX) {
+        if(hdr->elem_type != TSPB_ELEM_I32) return false;
+        if(hdr->matrix_off % TSPB_ALIGN != 0) return false;
+        if(hdr->flags & TSPB_SYMMETRIC) {
+            mbytes = (uint64_t)hdr->n * (hdr->n + 1) / 2 * sizeof(int);
+        } else {
+            // stride is the header's too - n * stride could wrap
+            if(stride < hdr->n) return false;
+            if(stride > UINT64_MAX / sizeof(int) / hdr->n) return false;
+            mbytes = (uint64_t)hdr->n * stride * sizeof(int);
+        }
+        if(!tspb_fits(hdr->matrix_off, mbytes, filelen)) return false;
+    } else if(!(hdr->flags & TSPB_HAS_COORDS)) {
+        return false;
+    }
+    return true;
+}
+
+TSP_Instance* load_instance_bin(const char *fname, bool verify) {
+    /* Map a .tspb file and wrap an instance around it. If verify is set the
+     * checksum is checked, which means reading the whole file - leave it off
+     * to only touch the pages the solver actually uses. */
+    TSP_Instance *inst = NULL;
+    TSP_BinHeader hdr;
+    struct stat st;
+    unsigned char *map = NULL;
+    DistMatrix *m = NULL;
+    int fd = open(fname, O_RDONLY);
+    if(fd < 0) return NULL;
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(TSP_BinHeader)) {
+        close(fd);
+        return NULL;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); // The mapping keeps the file open
+    if(map == MAP_FAILED) return NULL;
+
+    memcpy(&hdr, map, sizeof(hdr));
+    if(!tspb_check_header(&hdr, st.st_size)) {
+        tsp_log("%s is not a valid .tspb file!", fname);
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    if(verify && fnv1a64(FNV64_INIT, map + sizeof(hdr),
+                hdr.payload_len) != hdr.checksum) {
+        tsp_log("%s failed its checksum!", fname);
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    inst = calloc(1, sizeof(TSP_Instance));
+    if(!inst) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    inst->n = hdr.n;
+    inst->metric = hdr.metric;
+    inst->map = map;
+    inst->maplen = st.st_size;
+    if(hdr.flags & TSPB_HAS_COORDS) {
+        inst->coords = malloc(sizeof(TSP_Coords));
+        if(!inst->coords) {
+            destroy_instance(inst);
+            return NULL;
+        }
+        inst->coords->n = hdr.n;
+        inst->coords->x = (double *)(map + hdr.coords_off);
+        inst->coords->y = (double *)(map + hdr.coords_off +
+                tspb_pad(hdr.n * sizeof(double)));
+    }
+    m = calloc(1, sizeof(DistMatrix));
+    if(!m) {
+        destroy_instance(inst);
+        return NULL;
+    }
+    m->n = hdr.n;
+    m->coords = inst->coords;
+    m->metric = hdr.metric;
+    if(hdr.flags & TSPB_HAS_MATRIX) {
+        m->mode = (hdr.flags & TSPB_SYMMETRIC) ? DM_SYMMETRIC : DM_FULL;
+        m->stride = hdr.stride;
+        m->data = (int *)(map + hdr.matrix_off);
+    } else {
+        m->mode = DM_ORACLE;
+        m->stride = 0;
+        m->data = NULL;
+    }
+    inst->dist = m;
+    return inst;
+}
@@ -0,0 +1,436 @@
+/*
+* TSP
+* Copyright (C) Zach Wilder 2024
+*
+* This file is a part of TSP
+*
+* TSP is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* TSP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with TSP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <tsp.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+/*****
+ * TSP_KDTree
+ *
+ * Built by splitting each run at its median (quickselect) along whichever
+ * axis the run is most spread out on, so the tree is balanced and building is
+ * O(n log n). Searches carry the bounding box of the subtree they're in down
+ * with them, and skip any box that's further away than the worst candidate
+ * found so far.
+ *****/
+
+#define KD_CHUNK 256    // Cities per batch handed to a query thread
+
+static inline double kd_axis(const TSP_KDTree *t, int pos, int axis) {
+    return axis ? t->y[pos] : t->x[pos];
+}
+
+static inline void kd_swap(TSP_KDTree *t, int a, int b) {
+    double d = t->x[a];
+    int i = t->idx[a];
+    t->x[a] = t->x[b];
+    t->x[b] = d;
+    d = t->y[a];
+    t->y[a] = t->y[b];
+    t->y[b] = d;
+    t->idx[a] = t->idx[b];
+    t->idx[b] = i;
+}
+
+static void kd_select(TSP_KDTree *t, int lo, int hi, int k, int axis) {
+    /* Quickselect: rearrange [lo, hi) so position k holds the element that
+     * belongs there in sorted order along axis, smaller-or-equal before it and
+     * greater-or-equal after. Three way partition, so grids and repeated
+     * cities (long runs of equal values) don't make it quadratic. */
+    int lt = 0, gt = 0, i = 0, mid = 0;
+    double pivot = 0, a = 0, b = 0, c = 0;
+    hi--;
+    while(lo < hi) {
+        // Median of three for the pivot
+        mid = lo + (hi - lo) / 2;
+        a = kd_axis(t, lo, axis);
+        b = kd_axis(t, mid, axis);
+        c = kd_axis(t, hi, axis);
+        pivot = (a < b) ? ((b < c) ? b : (a < c) ? c : a) :
+            ((a < c) ? a : (b < c) ? c : b);
+        // [lo, lt) < pivot, [lt, i) == pivot, (gt, hi] > pivot
+        lt = lo;
+        gt = hi;
+        i = lo;
+        while(i <= gt) {
+            if(kd_axis(t, i, axis) < pivot) {
+                kd_swap(t, lt++, i++);
+            } else if(kd_axis(t, i, axis) > pivot) {
+                kd_swap(t, i, gt--);
+            } else {
+                i++;
+            }
+        }
+        if(k < lt) {
+            hi = lt - 1;
+        } else if(k > gt) {
+            lo = gt + 1;
+        } else {
+            return;
+        }
+    }
+}
+
+static void kd_build(TSP_KDTree *t, int lo, int hi) {
+    double x0 = HUGE_VAL, x1 = -HUGE_VAL, y0 = HUGE_VAL, y1 = -HUGE_VAL;
+    int i = 0, mid = 0, axis = 0;
+    while(hi - lo > KD_LEAF) {
+        for(i = lo; i < hi; i++) {
+            if(t->x[i] < x0) x0 = t->x[i];
+            if(t->x[i] > x1) x1 = t->x[i];
+            if(t->y[i] < y0) y0 = t->y[i];
+            if(t->y[i] > y1) y1 = t->y[i];
+        }
+        axis = (y1 - y0 > x1 - x0);
+        mid = lo + (hi - lo) / 2;
+        kd_select(t, lo, hi, mid, axis);
+        t->dim[mid] = axis;
+        kd_build(t, lo, mid);
+        // Loop on the right half instead of recursing
+        lo = mid + 1;
+        x0 = y0 = HUGE_VAL;
+        x1 = y1 = -HUGE_VAL;
+    }
+}
+
+TSP_KDTree* create_kdtree(const TSP_Coords *c) {
+    /* Build a tree over c, which has to outlive it */
+    TSP_KDTree *t = NULL;
+    int i = 0;
+    if(!c || c->n <= 0) return NULL;
+    t = calloc(1, sizeof(TSP_KDTree));
+    if(!t) return NULL;
+    t->n = c->n;
+    t->coords = c;
+    t->x = malloc(c->n * sizeof(double));
+    t->y = malloc(c->n * sizeof(double));
+    t->idx = malloc(c->n * sizeof(int));
+    t->dim = calloc(c->n, sizeof(unsigned char));
+    if(!t->x || !t->y || !t->idx || !t->dim) {
+        tsp_log("Failed to allocate memory for k-d tree!");
+        destroy_kdtree(t);
+        return NULL;
+    }
+    memcpy(t->x, c->x, c->n * sizeof(double));
+    memcpy(t->y, c->y, c->n * sizeof(double));
+    for(i = 0; i < c->n; i++) t->idx[i] = i;
+    kd_build(t, 0, c->n);
+    return t;
+}
+
+void destroy_kdtree(TSP_KDTree *t) {
+    if(!t) return;
+    free(t->x);
+    free(t->y);
+    free(t->idx);
+    free(t->dim);
+    free(t);
+}
+
+/*****
+ * Queries
+ *
+ * Each query keeps up to k candidates in a max-heap on squared distance (the
+ * worst one on top, to be bumped by anything closer). Quadrant queries keep
+ * four heaps, one per quadrant around the query point, and a subtree is only
+ * skipped if it can't improve any heap whose quadrant its box reaches into -
+ * so a city on the edge of the map doesn't search the whole tree for
+ * neighbours in an empty quadrant.
+ *****/
+typedef struct {
+    int k;
+    int len[4];
+    double *d;      // 4 * k, heap q is d[q * k] .. d[q * k + k - 1]
+    int *city;
+    int nheap;      // 1, or 4 for quadrants
+    double qx, qy;
+    int exclude;
+} KDQuery;
+
+static void kd_heap_push(KDQuery *q, int h, double d, int city) {
+    double *hd = q->d + h * q->k;
+    int *hc = q->city + h * q->k;
+    int i = 0, c = 0, len = q->len[h];
+    if(len < q->k) {
+        // Sift up from the end
+        i = q->len[h]++;
+        while(i > 0 && hd[(i - 1) / 2] < d) {
+            hd[i] = hd[(i - 1) / 2];
+            hc[i] = hc[(i - 1) / 2];
+            i = (i - 1) / 2;
+        }
+    } else {
+        if(d >= hd[0]) return;
+        // Replace the worst, sift down from the root
+        while((c = 2 * i + 1) < len) {
+            if(c + 1 < len && hd[c + 1] > hd[c]) c++;
+            if(hd[c] <= d) break;
+            hd[i] = hd[c];
+            hc[i] = hc[c];
+            i = c;
+        }
+    }
+    hd[i] = d;
+    hc[i] = city;
+}
+
+static inline int kd_quadrant(double dx, double dy) {
+    /* Quadrants 0-3 counter-clockwise from +x; each takes one of its two
+     * boundary half-axes, and a point right on top of the query goes in 0 */
+    if(dx > 0 && dy >= 0) return 0;
+    if(dx <= 0 && dy > 0) return 1;
+    if(dx < 0 && dy <= 0) return 2;
+    if(dx >= 0 && dy < 0) return 3;
+    return 0;
+}
+
+static inline void kd_consider(const TSP_KDTree *t, KDQuery *q, int pos) {
+    double dx = t->x[pos] - q->qx, dy = t->y[pos] - q->qy;
+    if(t->idx[pos] == q->exclude) return;
+    kd_heap_push(q, (q->nheap == 1) ? 0 : kd_quadrant(dx, dy),
+            dx * dx + dy * dy, t->idx[pos]);
+}
+
+static bool kd_box_wanted(const KDQuery *q, double x0, double x1, double y0,
+        double y1) {
+    /* Could anything in this box make it into a heap? */
+    double dx = (q->qx < x0) ? x0 - q->qx : (q->qx > x1) ? q->qx - x1 : 0;
+    double dy = (q->qy < y0) ? y0 - q->qy : (q->qy > y1) ? q->qy - y1 : 0;
+    double d = dx * dx + dy * dy;
+    bool reach[4];
+    int h = 0;
+    if(q->nheap == 1) {
+        return q->len[0] < q->k || d < q->d[0];
+    }
+    reach[0] = (x1 >= q->qx && y1 >= q->qy);
+    reach[1] = (x0 <= q->qx && y1 >= q->qy);
+    reach[2] = (x0 <= q->qx && y0 <= q->qy);
+    reach[3] = (x1 >= q->qx && y0 <= q->qy);
+    for(h = 0; h < 4; h++) {
+        if(reach[h] && (q->len[h] < q->k || d < q->d[h * q->k])) return true;
+    }
+    return false;
+}
+
+static void kd_search(const TSP_KDTree *t, KDQuery *q, int lo, int hi,
+        double x0, double x1, double y0, double y1) {
+    int i = 0, mid = 0;
+    double split = 0;
+    if(lo >= hi || !kd_box_wanted(q, x0, x1, y0, y1)) return;
+    if(hi - lo <= KD_LEAF) {
+        for(i = lo; i < hi; i++) kd_consider(t, q, i);
+        return;
+    }
+    mid = lo + (hi - lo) / 2;
+    kd_consider(t, q, mid);
+    // Near side first, so the far side is more likely to be pruned
+    if(t->dim[mid] == 0) {
+        split = t->x[mid];
+        if(q->qx < split) {
+            kd_search(t, q, lo, mid, x0, split, y0, y1);
+            kd_search(t, q, mid + 1, hi, split, x1, y0, y1);
+        } else {
+            kd_search(t, q, mid + 1, hi, split, x1, y0, y1);
+            kd_search(t, q, lo, mid, x0, split, y0, y1);
+        }
+    } else {
+        split = t->y[mid];
+        if(q->qy < split) {
+            kd_search(t, q, lo, mid, x0, x1, y0, split);
+            kd_search(t, q, mid + 1, hi, x0, x1, split, y1);
+        } else {
+            kd_search(t, q, mid + 1, hi, x0, x1, split, y1);
+            kd_search(t, q, lo, mid, x0, x1, y0, split);
+        }
+    }
+}
+
+static void kd_query(const TSP_KDTree *t, KDQuery *q, double x, double y,
+        int exclude) {
+    int h = 0;
+    for(h = 0; h < 4; h++) q->len[h] = 0;
+    q->qx = x;
+    q->qy = y;
+    q->exclude = exclude;
+    kd_search(t, q, 0, t->n, -HUGE_VAL, HUGE_VAL, -HUGE_VAL, HUGE_VAL);
+}
+
+int kdtree_nearest(const TSP_KDTree *t, double x, double y, int exclude) {
+    /* The city closest to (x, y), other than exclude (-1 to allow any). -1 if
+     * there isn't one. */
+    double d = 0;
+    int city = -1;
+    KDQuery q;
+    q.k = 1;
+    q.nheap = 1;
+    q.d = &d;
+    q.city = &city;
+    kd_query(t, &q, x, y, exclude);
+    return q.len[0] ? city : -1;
+}
+
+/*****
+ * Candidate lists
+ *
+ * Each city's neighbours go into a fixed K-wide slot of col/w (K = k, or 4k
+ * for quadrants), then the slots are squeezed together into CSR rows. Cities
+ * are queried in tree order, so one batch is a patch of neighbouring cities
+ * touching the same part of the tree.
+ *****/
+typedef struct {
+    const TSP_KDTree *t;
+    int metric;
+    int k;
+    bool quadrant;
+    int width;          // K
+    int *cnt;           // Neighbours found for each city
+    int *col;           // n * K
+    int *w;
+    atomic_int next;
+} KDJob;
+
+static void* kd_worker(void *arg) {
+    KDJob *job = arg;
+    const TSP_KDTree *t = job->t;
+    const TSP_Coords *c = t->coords;
+    KDQuery q;
+    int start = 0, end = 0, pos = 0, city = 0, h = 0, i = 0, j = 0, len = 0;
+    int *col = NULL, *w = NULL, tc = 0, tw = 0;
+    q.k = job->k;
+    q.nheap = job->quadrant ? 4 : 1;
+    q.d = malloc(4 * job->k * sizeof(double));
+    q.city = malloc(4 * job->k * sizeof(int));
+    if(!q.d || !q.city) {
+        free(q.d);
+        free(q.city);
+        return (void *)1;
+    }
+    while((start = atomic_fetch_add(&job->next, KD_CHUNK)) < t->n) {
+        end = (start + KD_CHUNK < t->n) ? start + KD_CHUNK : t->n;
+        for(pos = start; pos < end; pos++) {
+            city = t->idx[pos];
+            kd_query(t, &q, t->x[pos], t->y[pos], city);
+            col = job->col + (size_t)city * job->width;
+            w = job->w + (size_t)city * job->width;
+            len = 0;
+            for(h = 0; h < q.nheap; h++) {
+                for(i = 0; i < q.len[h]; i++) {
+                    tc = q.city[h * q.k + i];
+                    tw = coord_dist(c, job->metric, city, tc);
+                    // Insertion sort by weight
+                    for(j = len++; j > 0 && w[j - 1] > tw; j--) {
+                        w[j] = w[j - 1];
+                        col[j] = col[j - 1];
+                    }
+                    w[j] = tw;
+                    col[j] = tc;
+                }
+            }
+            job->cnt[city] = len;
+        }
+    }
+    free(q.d);
+    free(q.city);
+    return NULL;
+}
+
+TSP_Graph* kdtree_candidates(const TSP_KDTree *t, int metric, int k,
+        bool quadrant, int nthreads) {
+    /*
+     * Candidate lists for every city: its k nearest cities, or with quadrant
+     * set the k nearest in each of the four quadrants around it (so up to 4k,
+     * and never all off to one side). Comes back as a directed TSP_Graph, each
+     * row sorted by weight under metric - ready for two_opt() or
+     * nearest_neighbor_cand(). nthreads <= 0 uses every core.
+     */
+    TSP_Graph *g = NULL;
+    KDJob job;
+    pthread_t *threads = NULL;
+    void *ret = NULL;
+    bool ok = true;
+    size_t src = 0, dst = 0;
+    int i = 0, j = 0, started = 0;
+    if(!t || k <= 0) return NULL;
+    if(k > t->n - 1) k = (t->n > 1) ? t->n - 1 : 1;
+
+    memset(&job, 0, sizeof(job));
+    job.t = t;
+    job.metric = metric;
+    job.k = k;
+    job.quadrant = quadrant;
+    job.width = quadrant ? 4 * k : k;
+    atomic_init(&job.next, 0);
+    g = calloc(1, sizeof(TSP_Graph));
+    job.cnt = malloc(t->n * sizeof(int));
+    job.col = malloc((size_t)t->n * job.width * sizeof(int));
+    job.w = malloc((size_t)t->n * job.width * sizeof(int));
+    if(g) g->rowptr = malloc((t->n + 1) * sizeof(int));
+    if(!g || !g->rowptr || !job.cnt || !job.col || !job.w) {
+        tsp_log("Failed to allocate memory for candidate lists!");
+        free(job.cnt);
+        free(job.col);
+        free(job.w);
+        destroy_graph(g);
+        return NULL;
+    }
+
+    if(nthreads <= 0) nthreads = dm_default_threads();
+    threads = malloc(nthreads * sizeof(pthread_t));
+    if(threads) {
+        for(i = 1; i < nthreads; i++) {
+            if(pthread_create(&threads[i], NULL, kd_worker, &job) != 0) break;
+            started++;
+        }
+    }
+    if(kd_worker(&job) != NULL) ok = false;
+    for(i = 1; i <= started; i++) {
+        pthread_join(threads[i], &ret);
+        if(ret != NULL) ok = false;
+    }
+    free(threads);
+
+    if(ok) {
+        // Squeeze the fixed-width slots into CSR rows, in place
+        g->n = t->n;
+        g->rowptr[0] = 0;
+        for(i = 0; i < t->n; i++) {
+            src = (size_t)i * job.width;
+            for(j = 0; j < job.cnt[i]; j++, dst++) {
+                job.col[dst] = job.col[src + j];
+                job.w[dst] = job.w[src + j];
+            }
+            g->rowptr[i + 1] = dst;
+        }
+        g->narcs = dst;
+        g->col = realloc(job.col, (dst ? dst : 1) * sizeof(int));
+        g->w = realloc(job.w, (dst ? dst : 1) * sizeof(int));
+        // Shrinking can't really fail, but if it does keep the old block
+        if(!g->col) g->col = job.col;
+        if(!g->w) g->w = job.w;
+    } else {
+        tsp_log("Failed to allocate memory for candidate lists!");
+        free(job.col);
+        free(job.w);
+        destroy_graph(g);
+        g = NULL;
+    }
+    free(job.cnt);
+    return g;
+}
@@ -0,0 +1,551 @@
+/*
+* TSP
+* Copyright (C) Zach Wilder 2024
+*
+* This file is a part of TSP
+*
+* TSP is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* TSP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with TSP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <tsp.h>
+#include <fcntl.h>
+#include <stdarg.h>
+
+/*****
+ * libtsp (see libtsp.h)
+ *
+ * A TSP_Handle is just a TSP_Instance; the solvers only ever read it, and
+ * everything they need to write (tours, visited flags, candidate lists) is
+ * allocated per call - or comes from the caller's TSP_Workspace, which is how
+ * the batch pool (batch.c) keeps its workers off malloc.
+ *****/
+
+struct TSP_Handle {
+    TSP_Instance *inst;
+};
+
+#define TSP_TABLE_MAX 20000     // Largest n given a stored table by default
+#define TSP_LOG_MAX 512         // Longest diagnostic, past it they're cut
+
+_Static_assert(TSP_METRIC_MAN_2D == METRIC_MAN_2D &&
+        TSP_METRIC_EUC_2D == METRIC_EUC_2D &&
+        TSP_METRIC_CEIL_2D == METRIC_CEIL_2D &&
+        TSP_METRIC_GEO == METRIC_GEO && TSP_METRIC_ATT == METRIC_ATT,
+        "libtsp.h metrics out of step with coords.h");
+_Static_assert(TSP_MATRIX_FULL == DM_FULL && TSP_MATRIX_SYM == DM_SYMMETRIC &&
+        TSP_MATRIX_ORACLE == DM_ORACLE && TSP_MATRIX_QUANT16 == DM_QUANT16,
+        "libtsp.h matrix modes out of step with distmat.h");
+
+void tsp_default_options(TSP_Options *opt) {
+    opt->solver = TSP_SOLVER_AUTO;
+    opt->candidates = 0;
+    opt->candidates_kind = TSP_CAND_QUADRANT;
+    opt->time_limit = 0;
+    opt->cancel = NULL;
+    opt->progress = NULL;
+    opt->progress_arg = NULL;
+    opt->quality = TSP_QUALITY_OPTIMAL;
+    opt->memory_limit = 0;
+    opt->calibration = NULL;
+    opt->roads_only = false;
+    opt->reduce = false;
+}
+
+static bool is_tspb(const char *fname) {
+    /* Binary instances start with the .tspb magic */
+    char magic[sizeof(TSPB_MAGIC) - 1];
+    int fd = open(fname, O_RDONLY);
+    bool result = false;
+    if(fd < 0) return false;
+    result = (read(fd, magic, sizeof(magic)) == (ssize_t)sizeof(magic)) &&
+        (memcmp(magic, TSPB_MAGIC, sizeof(magic)) == 0);
+    close(fd);
+    return result;
+}
+
+static bool is_edge_list(const char *fname) {
+    /* Road network edge lists (graph.c) start with a number, after any '#'
+     * comment lines - TSPLIB files start with a keyword */
+    char buf[512];
+    int fd = open(fname, O_RDONLY);
+    ssize_t len = 0, i = 0;
+    if(fd < 0) return false;
+    len = read(fd, buf, sizeof(buf));
+    close(fd);
+    while(i < len) {
+        if(buf[i] == '#') {
+            while(i < len && buf[i] != '\n') i++;
+        } else if(buf[i] == ' ' || buf[i] == '\t' || buf[i] == '\r' ||
+                buf[i] == '\n') {
+            i++;
+        } else {
+            return (buf[i] >= '0' && buf[i] <= '9');
+        }
+    }
+    return false;
+}
+
+TSP_Instance* load_instance(const char *fname, int matrix, bool verify) {
+    /* Load a TSPLIB, .tspb or edge list file ("-" for TSPLIB on stdin).
+     * matrix is a DistMatrixMode for TSPLIB coordinates, or
+     * TSP_MATRIX_AUTO. */
+    TSP_Instance *inst = NULL;
+    DistMatrix *table = NULL;
+    // stdin can't be peeked at without eating the bytes, and can't be mapped
+    // anyway - it's always TSPLIB
+    if(strcmp(fname, "-") == 0) {
+        fname = "/dev/stdin";
+    } else if(is_tspb(fname)) {
+        return load_instance_bin(fname, verify);
+    } else if(is_edge_list(fname)) {
+        return load_instance_graph(fname);
+    }
+    // With AUTO, n isn't known until it's parsed - start out with an oracle
+    // (explicit matrices come back as tables regardless)
+    inst = load_instance_tsplib(fname,
+            (matrix == TSP_MATRIX_AUTO) ? DM_ORACLE : matrix);
+    if(inst && matrix == TSP_MATRIX_AUTO && inst->dist->mode == DM_ORACLE &&
+            inst->n <= TSP_TABLE_MAX) {
+        table = create_sym_dist_matrix(inst->n);
+        if(table && dm_build(table, inst->coords, inst->metric, 0)) {
+            destroy_dist_matrix(inst->dist);
+            inst->dist = table;
+        } else {
+            destroy_dist_matrix(table);
+        }
+    }
+    return inst;
+}
+
+TSP_Graph* instance_candidates(const TSP_Instance *inst,
+        const TSP_Options *opt) {
+    /* Candidate lists for 2-opt of the kind opt asks for (NULL for the
+     * defaults), or NULL if inst has no coordinates to build them from (then
+     * every city is a candidate) */
+    TSP_KDTree *tree = NULL;
+    TSP_Graph *cand = NULL;
+    int k = (opt && opt->candidates) ? opt->candidates : TSP_CANDIDATES;
+    if(!inst->coords || inst->metric == METRIC_EXPLICIT) return NULL;
+    if(opt && opt->candidates_kind == TSP_CAND_DELAUNAY) {
+        cand = create_delaunay_graph(inst->coords, inst->metric, k);
+        if(cand) return cand;
+        // Out of memory most likely, but the k-d tree needs less
+    }
+    tree = create_kdtree(inst->coords);
+    if(tree) cand = kdtree_candidates(tree, inst->metric, k, true, 1);
+    destroy_kdtree(tree);
+    return cand;
+}
+
+TSP_Path* two_opt_start(const DistMatrix *dist, const TSP_Graph *cand,
+        const TSP_Stop *stop) {
+    /* Nearest neighbor (on cand if there is one) + 2-opt */
+    TSP_Workspace *ws = NULL;
+    TSP_Path *tour = NULL;
+    if(cand) {
+        tour = nearest_neighbor_cand(dist, cand, stop);
+    } else if((ws = create_workspace()) != NULL) {
+        tour = nearest_neighbor_ws(dist, ws, stop);
+        destroy_workspace(ws);
+    }
+    if(tour) two_opt(dist, cand, tour, stop);
+    return tour;
+}
+
+static TSP_Path* solve_two_opt(const TSP_Instance *inst,
+        const TSP_Options *opt, const TSP_Stop *stop, TSP_ReduceStats *rs) {
+    /* Nearest neighbor + 2-opt, on candidate lists when there are
+     * coordinates to build them from. With rs, that tour then has the edges
+     * it rules out taken away (reduce_edges()) and 2-opt carries on over
+     * every edge left - a richer neighbourhood than the candidate lists, but
+     * the elimination is O(n^2) a step and rarely pays for itself. */
+    TSP_Graph *cand = instance_candidates(inst, opt);
+    TSP_Path *tour = two_opt_start(inst->dist, cand, stop);
+    TSP_Graph *g = NULL;
+    destroy_graph(cand);
+    if(rs && tour && inst->n >= 3 && !tsp_stopped(stop)) {
+        g = reduce_edges(inst->dist, tour, rs);
+        if(g) two_opt(inst->dist, g, tour, stop);
+        destroy_graph(g);
+    }
+    return tour;
+}
+
+static TSP_Path* solve_hk_reduced(const TSP_Instance *inst,
+        const TSP_Options *opt, const TSP_Stop *stop, TSP_Solver *used,
+        TSP_ReduceStats *rs) {
+    /* Held-Karp over just the edges reduce_edges() can't rule out against a
+     * 2-opt tour. Its work is per arc, so it's as much faster as there are
+     * fewer of them. The 2-opt tour comes back (as 2-opt's) if it's
+     * stopped. */
+    TSP_Path *tour = solve_two_opt(inst, opt, stop, NULL);
+    TSP_Path *best = NULL;
+    TSP_Graph *g = NULL;
+    *used = TSP_SOLVER_2OPT;
+    if(!tour || inst->n < 3 || tsp_stopped(stop)) return tour;
+    g = reduce_edges(inst->dist, tour, rs);
+    // The tour's own edges are always left, so there's always an answer
+    if(g) best = held_karp_graph(g, 0, stop);
+    destroy_graph(g);
+    if(!best) return tour;
+    destroy_tsp_path(tour);
+    *used = TSP_SOLVER_HK;
+    return best;
+}
+
+static TSP_Path* solve_ils(const TSP_Instance *inst, const TSP_Options *opt,
+        const TSP_Stop *stop) {
+    /* 2-opt, then iterated local search from there - until the deadline if
+     * there is one */
+    TSP_Graph *cand = instance_candidates(inst, opt);
+    TSP_Path *tour = two_opt_start(inst->dist, cand, stop);
+    if(tour) {
+        iterated_local_search(inst->dist, cand, tour,
+                (stop->deadline > 0) ? INT_MAX : 0, NULL, stop, NULL, NULL);
+    }
+    destroy_graph(cand);
+    return tour;
+}
+
+static TSP_Path* solve_roads(const TSP_Instance *inst, const TSP_Options *opt,
+        TSP_Solver *used, TSP_Error *err) {
+    /* roads_only: a tour over the graph's own arcs - Held-Karp if auto would
+     * pick it, nearest neighbor otherwise, since they're the two that work on
+     * a sparse graph. Either can find there's no such tour. */
+    TSP_Solver solver = opt->solver;
+    TSP_Path *tour = NULL;
+    *err = TSP_OK;
+    if(!inst->graph) {
+        *err = TSP_ERR_ARG;
+        return NULL;
+    }
+    if(solver == TSP_SOLVER_AUTO) {
+        solver = (select_solver(inst, opt, NULL) == TSP_SOLVER_HK) ?
+            TSP_SOLVER_HK : TSP_SOLVER_NN;
+    }
+    *used = solver;
+    switch(solver) {
+        case TSP_SOLVER_HK:
+            if(inst->n > HK_MAX_N) {
+                *err = TSP_ERR_TOO_BIG;
+                return NULL;
+            }
+            tour = held_karp_graph(inst->graph, 0, NULL);
+            break;
+        case TSP_SOLVER_NN:
+            tour = nearest_neighbor_graph(inst->graph);
+            break;
+        default:
+            *err = TSP_ERR_ARG;
+            return NULL;
+    }
+    if(!tour) *err = TSP_ERR_NO_TOUR;
+    return tour;
+}
+
+TSP_Path* solve_instance(const TSP_Instance *inst, const TSP_Options *opt,
+        TSP_Workspace *ws, TSP_Solver *used, bool *stopped, TSP_Error *err,
+        TSP_ReduceStats *rs) {
+    /* Run the solver opt asks for on inst, using ws for scratch space if it
+     * isn't NULL. *used is set to the solver that ran, *stopped to whether
+     * opt's time limit or cancel token cut it short (the tour is then the best
+     * found so far), and *err to why there's no tour if NULL comes back.
+     * With opt->reduce, rs (if it isn't NULL) gets what edge elimination
+     * did - its edges stay 0 if it didn't run. */
+    TSP_ReduceStats own_rs;
+    TSP_Solver solver = opt ? opt->solver : TSP_SOLVER_AUTO;
+    TSP_Workspace *own = NULL;
+    TSP_Path *tour = NULL;
+    TSP_Stop stop;
+    if(rs) memset(rs, 0, sizeof(TSP_ReduceStats));
+    if(opt && opt->roads_only) {
+        *stopped = false;
+        return solve_roads(inst, opt, used, err);
+    }
+    // Only Held-Karp and 2-opt take the reduced graph
+    if(!opt || !opt->reduce) {
+        rs = NULL;
+    } else if(!rs) {
+        rs = &own_rs;
+    }
+    if(solver == TSP_SOLVER_AUTO) solver = select_solver(inst, opt, NULL);
+    *used = solver;
+    *stopped = false;
+    *err = TSP_OK;
+    if(!ws && (solver == TSP_SOLVER_HK || solver == TSP_SOLVER_NN)) {
+        ws = own = create_workspace();
+        if(!ws) {
+            *err = TSP_ERR_NOMEM;
+            return NULL;
+        }
+    }
+    stop_init(&stop, opt);
+    switch(solver) {
+        case TSP_SOLVER_HK:
+            if(inst->n > HK_MAX_N) {
+                *err = TSP_ERR_TOO_BIG;
+                break;
+            }
+            if(rs) {
+                tour = solve_hk_reduced(inst, opt, &stop, used, rs);
+                break;
+            }
+            tour = held_karp_ws(inst->dist, 0, ws, &stop);
+            if(!tour && tsp_stopped(&stop)) {
+                // Nothing to show for half a DP table - a quick tour instead
+                tour = two_opt_start(inst->dist, NULL, NULL);
+                *used = TSP_SOLVER_2OPT;
+            }
+            break;
+        case TSP_SOLVER_NN:
+            // O(n) on a grid when the coordinates allow it, not O(n^2)
+            if(inst->coords && inst->metric != METRIC_EXPLICIT) {
+                tour = nearest_neighbor_grid(inst->coords, inst->metric,
+                        &stop);
+            }
+            if(!tour) tour = nearest_neighbor_ws(inst->dist, ws, &stop);
+            break;
+        case TSP_SOLVER_2OPT:
+            tour = solve_two_opt(inst, opt, &stop, rs);
+            break;
+        case TSP_SOLVER_ILS:
+            tour = solve_ils(inst, opt, &stop);
+            break;
+        case TSP_SOLVER_PORTFOLIO:
+            tour = solve_portfolio(inst, opt, &stop, used, stopped);
+            break;
+        default:
+            *err = TSP_ERR_ARG;
+            break;
+    }
+    destroy_workspace(own);
+    if(*err != TSP_OK) return NULL;
+    if(!tour) {
+        *err = TSP_ERR_NO_TOUR;
+        return NULL;
+    }
+    // Only a check that actually fired counts - not the clock running out
+    // after the solver was done. The portfolio knows better than stop whether
+    // its race was cut short, an engine can trip stop after Held-Karp won.
+    if(solver != TSP_SOLVER_PORTFOLIO && atomic_load(&stop.stop)) {
+        *stopped = true;
+    }
+    stop_progress(&stop, *used, *stopped ? -1 : 1, tour->cost);
+    return tour;
+}
+
+TSP_Handle* wrap_instance(TSP_Instance *inst) {
+    /* Hand inst over to a new handle (it's destroyed if that fails) */
+    TSP_Handle *h = NULL;
+    if(!inst) return NULL;
+    h = malloc(sizeof(TSP_Handle));
+    if(!h) {
+        destroy_instance(inst);
+        return NULL;
+    }
+    h->inst = inst;
+    return h;
+}
+
+TSP_Handle* tsp_open_coords(const double *x, const double *y, int n,
+        int metric, int matrix) {
+    /* Make a handle from n cities at (x[i], y[i]), which are copied. NULL if
+     * they're far enough apart that a tour could overflow an int. */
+    TSP_Coords *c = NULL;
+    if(!x || !y || n <= 0 || metric < 0 || metric > METRIC_ATT ||
+            metric == METRIC_EXPLICIT) {
+        return NULL;
+    }
+    c = create_coords(n);
+    if(!c) return NULL;
+    memcpy(c->x, x, n * sizeof(double));
+    memcpy(c->y, y, n * sizeof(double));
+    if(!(coord_tour_bound(c, metric) <= INT_MAX)) {
+        tsp_log("Coordinates too far apart - a tour could overflow an int!");
+        destroy_coords(c);
+        return NULL;
+    }
+    if(matrix == TSP_MATRIX_AUTO) {
+        matrix = (n <= TSP_TABLE_MAX) ? DM_SYMMETRIC : DM_ORACLE;
+    }
+    return wrap_instance(create_instance_coords(c, metric, matrix));
+}
+
+TSP_Handle* tsp_open_matrix(const int *dist, int n) {
+    /* Make a handle from an n x n row-major distance table, which is copied.
+     * NULL if it isn't symmetric (2-opt and ILS would never finish on it), or
+     * if a tour over it could overflow an int. */
+    DistMatrix *m = NULL;
+    int i = 0;
+    if(!dist || n <= 0) return NULL;
+    m = create_dist_matrix(n);
+    if(!m) return NULL;
+    for(i = 0; i < n; i++) {
+        memcpy(dm_row(m, i), dist + (size_t)i * n, n * sizeof(int));
+    }
+    if(!dm_is_symmetric(m)) {
+        tsp_log("Distance table isn't symmetric!");
+        destroy_dist_matrix(m);
+        return NULL;
+    }
+    if(dm_tour_bound(m) > INT_MAX) {
+        tsp_log("Distances too large - a tour could overflow an int!");
+        destroy_dist_matrix(m);
+        return NULL;
+    }
+    return wrap_instance(create_instance_matrix(m));
+}
+
+TSP_Handle* tsp_open_file(const char *fname, int matrix) {
+    /* Make a handle from a TSPLIB or .tspb file */
+    if(!fname) return NULL;
+    return wrap_instance(load_instance(fname, matrix, false));
+}
+
+void tsp_close(TSP_Handle *h) {
+    if(!h) return;
+    destroy_instance(h->inst);
+    free(h);
+}
+
+int tsp_size(const TSP_Handle *h) {
+    return h ? h->inst->n : 0;
+}
+
+int tsp_distance(const TSP_Handle *h, int i, int j) {
+    return dm_get(h->inst->dist, i, j);
+}
+
+TSP_Error solve_handle(const TSP_Handle *h, const TSP_Options *opt,
+        TSP_Workspace *ws, TSP_Cache *cache, TSP_Result *res) {
+    /* tsp_solve(), with ws for scratch space and cache to look in first
+     * (either can be NULL). The error is returned and kept in res->status. */
+    struct timespec t0, t1;
+    TSP_Path *tour = NULL;
+    TSP_Error err = TSP_OK;
+    if(!res) return TSP_ERR_ARG;
+    memset(res, 0, sizeof(TSP_Result));
+    if(!h) return (res->status = TSP_ERR_ARG);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    tour = cache_solve(cache, h->inst, opt, ws, &res->solver, &res->stopped,
+            &err, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    res->seconds = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    if(!tour) return (res->status = err);
+    res->tour = malloc(tour->n * sizeof(int));
+    if(!res->tour) {
+        destroy_tsp_path(tour);
+        return (res->status = TSP_ERR_NOMEM);
+    }
+    memcpy(res->tour, tour->path, tour->n * sizeof(int));
+    res->n = tour->n;
+    res->cost = tour->cost;
+    destroy_tsp_path(tour);
+    return TSP_OK;
+}
+
+TSP_Error tsp_solve(const TSP_Handle *h, const TSP_Options *opt,
+        TSP_Result *res) {
+    /* Solve h. On TSP_OK res holds the tour (free it with tsp_free_result()),
+     * otherwise res is left empty. opt can be NULL for the defaults. */
+    return solve_handle(h, opt, NULL, NULL, res);
+}
+
+TSP_Error tsp_select_solver(const TSP_Handle *h, const TSP_Options *opt,
+        TSP_Selection *sel) {
+    /* What TSP_SOLVER_AUTO would run on h under opt, and why (see select.c) */
+    if(!h || !sel) return TSP_ERR_ARG;
+    select_solver(h->inst, opt, sel);
+    return TSP_OK;
+}
+
+TSP_Error tsp_solve_cached(TSP_Cache *cache, const TSP_Handle *h,
+        const TSP_Options *opt, TSP_Result *res) {
+    /* tsp_solve(), answered from cache if h has been solved with the same
+     * options before. res->seconds is just the lookup on a hit. */
+    return solve_handle(h, opt, NULL, cache, res);
+}
+
+void tsp_free_result(TSP_Result *res) {
+    if(!res) return;
+    free(res->tour);
+    res->tour = NULL;
+    res->n = 0;
+}
+
+const char* tsp_solver_name(TSP_Solver solver) {
+    /* Short name for solver, as the command line takes it */
+    static const char *names[TSP_SOLVERS] = {"auto", "hk", "nn", "2opt",
+        "ils", "portfolio"};
+    if(solver < 0 || solver >= TSP_SOLVERS) return "unknown";
+    return names[solver];
+}
+
+TSP_Cancel* tsp_cancel_create(void) {
+    TSP_Cancel *c = malloc(sizeof(TSP_Cancel));
+    if(c) atomic_init(&c->cancelled, false);
+    return c;
+}
+
+void tsp_cancel_destroy(TSP_Cancel *c) {
+    free(c);
+}
+
+void tsp_cancel(TSP_Cancel *c) {
+    /* Stop every solve using c. Safe from any thread, or a signal handler. */
+    atomic_store(&c->cancelled, true);
+}
+
+void tsp_cancel_reset(TSP_Cancel *c) {
+    /* Let c be used for new solves */
+    atomic_store(&c->cancelled, false);
+}
+
+static void log_stderr(const char *msg, void *arg) {
+    (void)arg;
+    fprintf(stderr, "%s\n", msg);
+}
+
+static TSP_LogFn log_fn = log_stderr;
+static void *log_arg = NULL;
+
+void tsp_set_log(TSP_LogFn fn, void *arg) {
+    /* Send diagnostics to fn (NULL for nowhere). Set it before any solves
+     * start - the solvers' threads read it without a lock. */
+    log_fn = fn;
+    log_arg = arg;
+}
+
+void tsp_log(const char *fmt, ...) {
+    /* A printf()-style diagnostic, to wherever tsp_set_log() said */
+    char msg[TSP_LOG_MAX];
+    va_list args;
+    if(!log_fn) return;
+    va_start(args, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, args);
+    va_end(args);
+    log_fn(msg, log_arg);
+}
+
+const char* tsp_strerror(TSP_Error err) {
+    switch(err) {
+        case TSP_OK: return "success";
+        case TSP_ERR_ARG: return "bad argument";
+        case TSP_ERR_NOMEM: return "out of memory";
+        case TSP_ERR_TOO_BIG: return "too many cities for this solver";
+        case TSP_ERR_IO: return "couldn't read instance";
+        case TSP_ERR_NO_TOUR: return "no tour found";
+        default: break;
+    }
+    return "unknown error";
+}
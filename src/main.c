@@ -28,6 +28,10 @@ int main(int argc, char** argv) {
      * path... eventually.
      */
     init_genrand(time(NULL)); // Seed the prng
+    if(argc > 1) {
+        // Command line mode, never touches the terminal
+        return cli_main(argc, argv);
+    }
     term_init(); // Initialize terminal interface
     init_screenbuf(); // Start screen buffer
 
@@ -34,6 +34,7 @@ bool main_loop(void) {
     g_data = init_tsp_data(); // Global data
     // Main Loop
     scr_clear();
+    draw_invalidate(); // The terminal's blank now, whatever was drawn before
     draw(); // This advances with keypresses, so need to draw the screen before entering loop
     while(running) {
         running = handle_events();
@@ -114,7 +115,7 @@ void draw(void) {
 
 void draw_example(void) {
     char fstr[180];
-    int i,j,k,hkcolor,nncolor,x,y,xofs,yofs;
+    int i,j,k,d,hkcolor,nncolor,x,y,xofs,yofs;
     bool hkrow,hkcol,nnrow,nncol;
     fstr[0] = '\0';
     hkcolor = mt_rand(RED,CYAN);
@@ -164,16 +165,17 @@ void draw_example(void) {
         //The dist data in the rows
         for(x = 0; x < SIZE; x++) {
             fstr[0] = '\0';
+            d = dm_get(g_data->dist,x,y);
             //Put the number in the right spot - centered in the 3 char wide
             //column
-            if(0 == g_data->dist[x][y]) {
+            if(0 == d) {
                 snprintf(fstr,180,"   ");
-            } else if(g_data->dist[x][y] < 10) {
-                snprintf(fstr,180," %d ", g_data->dist[x][y]);
-            } else if (g_data->dist[x][y] < 100) {
-                snprintf(fstr,180,"%d ", g_data->dist[x][y]);
-            } else if (g_data->dist[x][y] < 1000) {
-                snprintf(fstr,180,"%d", g_data->dist[x][y]);
+            } else if(d < 10) {
+                snprintf(fstr,180," %d ", d);
+            } else if (d < 100) {
+                snprintf(fstr,180,"%d ", d);
+            } else if (d < 1000) {
+                snprintf(fstr,180,"%d", d);
             } else {
                 // If for some reason, theres a 4 digit number in dist, this
                 // replaces it with an x
@@ -200,7 +202,7 @@ void draw_example(void) {
                 draw_colorstr(3 + x + 3*x + xofs,y+yofs,fstr,
                         BRIGHT_WHITE,nncolor);
             } else {
-                if(0 == g_data->dist[x][y]) {
+                if(0 == d) {
                     draw_colorstr(3 + x + 3*x + xofs,y+yofs,fstr,
                             BLACK, BLACK);
                 } else {
@@ -44,18 +44,20 @@
 #include <mt19937.h>
 
 /* Period parameters */  
-#define N 624
+#define N MT_N
 #define M 397
 #define MATRIX_A 0x9908b0dfUL   /* constant vector a */
 #define UPPER_MASK 0x80000000UL /* most significant w-r bits */
 #define LOWER_MASK 0x7fffffffUL /* least significant r bits */
 
-static unsigned long mt[N]; /* the array for the state vector  */
-static int mti=N+1; /* mti==N+1 means mt[N] is not initialized */
+/* The state behind the functions without _r */
+static MT_State mt_default = MT_STATE_INIT;
 
-/* initializes mt[N] with a seed */
-void init_genrand(unsigned long s)
+/* initializes st->mt[N] with a seed */
+void init_genrand_r(MT_State *st, unsigned long s)
 {
+    unsigned long *mt = st->mt;
+    int mti;
     mt[0]= s & 0xffffffffUL;
     for (mti=1; mti<N; mti++) {
         mt[mti] = 
@@ -67,16 +69,18 @@ void init_genrand(unsigned long s)
         mt[mti] &= 0xffffffffUL;
         /* for >32 bit machines */
     }
+    st->mti = mti;
 }
 
 /* initialize by an array with array-length */
 /* init_key is the array for initializing keys */
 /* key_length is its length */
 /* slight change for C++, 2004/2/26 */
-void init_by_array(unsigned long init_key[], int key_length)
+void init_by_array_r(MT_State *st, unsigned long init_key[], int key_length)
 {
+    unsigned long *mt = st->mt;
     int i, j, k;
-    init_genrand(19650218UL);
+    init_genrand_r(st, 19650218UL);
     i=1; j=0;
     k = (N>key_length ? N : key_length);
     for (; k; k--) {
@@ -99,17 +103,18 @@ void init_by_array(unsigned long init_key[], int key_length)
 }
 
 /* generates a random number on [0,0xffffffff]-interval */
-unsigned long genrand_int32(void)
+unsigned long genrand_int32_r(MT_State *st)
 {
+    unsigned long *mt = st->mt;
     unsigned long y;
-    static unsigned long mag01[2]={0x0UL, MATRIX_A};
+    static const unsigned long mag01[2]={0x0UL, MATRIX_A};
     /* mag01[x] = x * MATRIX_A  for x=0,1 */
 
-    if (mti >= N) { /* generate N words at one time */
+    if (st->mti >= N) { /* generate N words at one time */
         int kk;
 
-        if (mti == N+1)   /* if init_genrand() has not been called, */
-            init_genrand(5489UL); /* a default initial seed is used */
+        if (st->mti == N+1)   /* if init_genrand() has not been called, */
+            init_genrand_r(st, 5489UL); /* a default initial seed is used */
 
         for (kk=0;kk<N-M;kk++) {
             y = (mt[kk]&UPPER_MASK)|(mt[kk+1]&LOWER_MASK);
@@ -122,10 +127,10 @@ unsigned long genrand_int32(void)
         y = (mt[N-1]&UPPER_MASK)|(mt[0]&LOWER_MASK);
         mt[N-1] = mt[M-1] ^ (y >> 1) ^ mag01[y & 0x1UL];
 
-        mti = 0;
+        st->mti = 0;
     }
   
-    y = mt[mti++];
+    y = mt[st->mti++];
 
     /* Tempering */
     y ^= (y >> 11);
@@ -137,40 +142,81 @@ unsigned long genrand_int32(void)
 }
 
 /* generates a random number on [0,0x7fffffff]-interval */
-long genrand_int31(void)
+long genrand_int31_r(MT_State *st)
 {
-    return (long)(genrand_int32()>>1);
+    return (long)(genrand_int32_r(st)>>1);
 }
 
 /* generates a random number on [0,1]-real-interval */
-double genrand_real1(void)
+double genrand_real1_r(MT_State *st)
 {
-    return genrand_int32()*(1.0/4294967295.0); 
+    return genrand_int32_r(st)*(1.0/4294967295.0); 
     /* divided by 2^32-1 */ 
 }
 
 /* generates a random number on [0,1)-real-interval */
-double genrand_real2(void)
+double genrand_real2_r(MT_State *st)
 {
-    return genrand_int32()*(1.0/4294967296.0); 
+    return genrand_int32_r(st)*(1.0/4294967296.0); 
     /* divided by 2^32 */
 }
 
 /* generates a random number on (0,1)-real-interval */
-double genrand_real3(void)
+double genrand_real3_r(MT_State *st)
 {
-    return (((double)genrand_int32()) + 0.5)*(1.0/4294967296.0); 
+    return (((double)genrand_int32_r(st)) + 0.5)*(1.0/4294967296.0); 
     /* divided by 2^32 */
 }
 
 /* generates a random number on [0,1) with 53-bit resolution*/
-double genrand_res53(void) 
+double genrand_res53_r(MT_State *st) 
 { 
-    unsigned long a=genrand_int32()>>5, b=genrand_int32()>>6; 
+    unsigned long a=genrand_int32_r(st)>>5, b=genrand_int32_r(st)>>6; 
     return(a*67108864.0+b)*(1.0/9007199254740992.0); 
 } 
 /* These real versions are due to Isaku Wada, 2002/01/09 added */
 
+/* The original interface, on the shared default state */
+void init_genrand(unsigned long s)
+{
+    init_genrand_r(&mt_default, s);
+}
+
+void init_by_array(unsigned long init_key[], int key_length)
+{
+    init_by_array_r(&mt_default, init_key, key_length);
+}
+
+unsigned long genrand_int32(void)
+{
+    return genrand_int32_r(&mt_default);
+}
+
+long genrand_int31(void)
+{
+    return genrand_int31_r(&mt_default);
+}
+
+double genrand_real1(void)
+{
+    return genrand_real1_r(&mt_default);
+}
+
+double genrand_real2(void)
+{
+    return genrand_real2_r(&mt_default);
+}
+
+double genrand_real3(void)
+{
+    return genrand_real3_r(&mt_default);
+}
+
+double genrand_res53(void)
+{
+    return genrand_res53_r(&mt_default);
+}
+
 /*
  * Functions below added by Zach Wilder, 2022, with the same conditions as
  * above.
@@ -179,36 +225,58 @@ double genrand_res53(void)
  * bool mt_bool(void); 
  * bool mt_chance(int chance);
  *
+ * Each has an _r version taking the MT_State to draw from.
  */
-int mt_rand_lim(int limit) {
+int mt_rand_lim_r(MT_State *st, int limit) {
     /* So, the random number functions below with the % operator will introduce
      * skew. Like trying to split ten candies with 3 kids - and not being able
      * to cut anything into smaller pieces. A single piece will be left over...
-     * This takes the candy, divides it by 3, and if the result is greater than
-     * 3 puts it back into the bucket. */
-    int divisor = RAND_MAX/(limit + 1);
-    int retval;
-    do {
-        retval = genrand_int32() / divisor;
-    } while (retval > limit);
-
-    return retval;
+     * This scales the draw into [0, limit] with a multiply (Lemire's method,
+     * see rng_bounded()) and puts it back into the bucket only if it was one
+     * of the left over pieces - rare, where dividing by RAND_MAX/(limit + 1)
+     * threw away half the 32-bit draws or more. */
+    uint32_t range = (uint32_t)limit + 1;
+    uint64_t m = (uint64_t)(uint32_t)genrand_int32_r(st) * range;
+    uint32_t low = (uint32_t)m, t = 0;
+    if(low < range) {
+        t = -range % range;
+        while(low < t) {
+            m = (uint64_t)(uint32_t)genrand_int32_r(st) * range;
+            low = (uint32_t)m;
+        }
+    }
+    return (int)(m >> 32);
 }
 
-int mt_rand(int min, int max) {
-    return (mt_rand_lim(max - min) + min);
+int mt_rand_r(MT_State *st, int min, int max) {
+    return (mt_rand_lim_r(st, max - min) + min);
 }
 
-bool mt_bool() {
-    int result = mt_rand(1,10);
+bool mt_bool_r(MT_State *st) {
+    int result = mt_rand_r(st, 1, 10);
     return (result <= 5);
 }
 
-bool mt_chance(int chance) {
+bool mt_chance_r(MT_State *st, int chance) {
     /* Idea: I want a 1/3 chance of something happening, so I call
      * mt_chance(33). It gets a random number between 1 and 100, and then
      * returns true if the random number is less than the 33. */
-    int result = mt_rand(1,100);
+    int result = mt_rand_r(st, 1, 100);
     return(result <= chance);
 }
 
+int mt_rand_lim(int limit) {
+    return mt_rand_lim_r(&mt_default, limit);
+}
+
+int mt_rand(int min, int max) {
+    return mt_rand_r(&mt_default, min, max);
+}
+
+bool mt_bool() {
+    return mt_bool_r(&mt_default);
+}
+
+bool mt_chance(int chance) {
+    return mt_chance_r(&mt_default, chance);
+}
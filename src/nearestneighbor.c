@@ -19,49 +19,314 @@
 */
 #include <tsp.h>
 
-int find_nearest_neighbor(const int cur, int **table, const bool visited[SIZE]) {
+/*
+ * For matrices that aren't stored row by row (packed, or calculated on the fly)
+ * distances are pulled out a chunk at a time with dm_get_row(), which is small
+ * enough to stay in L1 and lets the oracle use its SIMD batch function.
+ */
+#define NN_CHUNK 256
+
+#define NN_GRID_MAX 1073741824.0    // 2^30, largest coordinate the grid takes
+
+int find_nearest_neighbor(const int cur, const DistMatrix *table,
+        const bool *visited) {
     // Return the node with the lowest cost 
-    int i = 0;
-    int cost = 999;
+    int i = 0, k = 0, len = 0;
+    int cost = INT_MAX;
     int next = cur;
-    for(i = 0; i < SIZE; i++) {
-        if((i != cur) && !visited[i]) {
-            if(table[cur][i] < cost) {
-                cost = table[cur][i];
-                next = i;
+    int n = table->n;
+    const int *row = NULL;
+    int chunk[NN_CHUNK];
+    if(table->mode == DM_FULL) {
+        // Walk the row directly, no index math per lookup
+        row = dm_row(table, cur);
+        for(i = 0; i < n; i++) {
+            if((i != cur) && !visited[i]) {
+                if(row[i] < cost) {
+                    cost = row[i];
+                    next = i;
+                }
+            }
+        }
+        return next;
+    }
+    for(i = 0; i < n; i += NN_CHUNK) {
+        len = (n - i < NN_CHUNK) ? (n - i) : NN_CHUNK;
+        dm_get_row(table, cur, i, len, chunk);
+        for(k = 0; k < len; k++) {
+            if((i + k != cur) && !visited[i + k]) {
+                if(chunk[k] < cost) {
+                    cost = chunk[k];
+                    next = i + k;
+                }
             }
         }
     }
     return next;
 }
 
-TSP_Path* nearest_neighbor(int **dist) {
+static int nn_finish(const DistMatrix *dist, const bool *visited, int *path,
+        int i, int cur) {
+    /* Out of time at step i: the cities not reached yet go on the end of path
+     * in index order, for a tour 2-opt can still work with. Returns what
+     * they add to the cost. */
+    int n = dist->n, c = 0, cost = 0;
+    for(c = 0; c < n && i < n; c++) {
+        if(visited[c]) continue;
+        path[i++] = c;
+        cost += dm_get(dist, cur, c);
+        cur = c;
+    }
+    return cost;
+}
+
+TSP_Path* nearest_neighbor_ws(const DistMatrix *dist, TSP_Workspace *ws,
+        const TSP_Stop *stop) {
     /*
      * Nearest Neighbor Heuristic Algorithm
      * Quick and easy approach to solving the TSP - knowing where we start, all
      * we have to do is keep track of what spots have been visited, then move to
      * the unvisited spot with the lowest cost. 
+     *
+     * visited/path come from the workspace, so with an oracle matrix this runs
+     * in O(n) memory. If stop says so part way, the rest of the cities are
+     * visited in index order (nn_finish()).
      */
-    bool visited[SIZE] = {false};
-    int path[SIZE];
+    int n = dist->n;
+    bool *visited = NULL;
+    int *path = NULL;
     int i = 0;
     int cur = 0; // Start at A, this could be passed in
     int next = 0;
     int cost = 0;
+    if(!workspace_reserve(ws, n, false)) {
+        tsp_log("Failed to allocate memory for visited/path!");
+        return NULL;
+    }
+    visited = ws->visited;
+    path = ws->path;
+    memset(visited, 0, n * sizeof(bool));
 
     visited[cur] = true; // Mark first node as visited
     path[0] = cur;
     // We know where we are at (cur), so we need to figure out where to go.
     // Check unvisited nodes (visited[i] == false), find the smallest cost
-    for(i = 1; i < SIZE; i++) {
+    for(i = 1; i < n; i++) {
+        if((i & 0xff) == 0 && tsp_stopped(stop)) {
+            cost += nn_finish(dist, visited, path, i, cur);
+            cur = path[n - 1];
+            break;
+        }
         next = find_nearest_neighbor(cur, dist, visited);
         path[i] = next;
-        cost += dist[cur][next];
+        cost += dm_get(dist,cur,next);
         cur = next;
         visited[cur] = true;
     }
-    cost += dist[cur][0]; // Add in the cost of the return
+    cost += dm_get(dist,cur,0); // Add in the cost of the return
 
     //print_path(path, cost);
-    return make_tsp_path(path,cost);
+    return make_tsp_path(path,n,cost);
+}
+
+TSP_Path* nearest_neighbor(const DistMatrix *dist) {
+    /* nearest_neighbor_ws() with a workspace just for this call */
+    TSP_Workspace *ws = create_workspace();
+    TSP_Path *result = NULL;
+    if(!ws) {
+        tsp_log("Failed to allocate memory for visited/path!");
+        return NULL;
+    }
+    result = nearest_neighbor_ws(dist, ws, NULL);
+    destroy_workspace(ws);
+    return result;
+}
+
+TSP_Path* nearest_neighbor_graph(const TSP_Graph *g) {
+    /*
+     * Nearest Neighbor on a sparse graph - same idea as nearest_neighbor(), but
+     * only the roads leaving the current Node are looked at. Each row of the
+     * graph is sorted cheapest first, so the first unvisited arc is the one to
+     * take. Greedy can paint itself into a corner on a sparse graph (every road
+     * out leads somewhere already visited, or there's no road home), and then
+     * there's no tour - NULL. graph_shortest_paths() + nearest_neighbor() never
+     * gets stuck, at the cost of an n x n matrix.
+     */
+    TSP_Path *result = NULL;
+    int n = g->n;
+    bool *visited = calloc(n, sizeof(bool));
+    int *path = malloc(n * sizeof(int));
+    int i = 0, a = 0, back = 0;
+    int cur = 0;
+    int next = 0;
+    int cost = 0;
+    if(!visited || !path) {
+        tsp_log("Failed to allocate memory for visited/path!");
+        free(visited);
+        free(path);
+        return NULL;
+    }
+
+    visited[cur] = true;
+    path[0] = cur;
+    for(i = 1; i < n; i++) {
+        next = -1;
+        for(a = g->rowptr[cur]; a < g->rowptr[cur + 1]; a++) {
+            if(!visited[g->col[a]]) {
+                next = g->col[a];
+                cost += g->w[a];
+                break;
+            }
+        }
+        if(next < 0) break; // Dead end
+        path[i] = next;
+        cur = next;
+        visited[cur] = true;
+    }
+    back = graph_arc_weight(g, cur, 0);
+    if(i == n && back != GRAPH_INF) {
+        result = make_tsp_path(path, n, cost + back);
+    } else {
+        tsp_log("Nearest neighbor got stuck after %d of %d nodes!", i, n);
+    }
+    free(visited);
+    free(path);
+    return result;
+}
+
+TSP_Path* nearest_neighbor_cand(const DistMatrix *dist, const TSP_Graph *cand,
+        const TSP_Stop *stop) {
+    /*
+     * Nearest Neighbor with candidate lists (kdtree_candidates(),
+     * create_delaunay_graph()). The closest unvisited city is almost always on
+     * the current city's list, which is sorted cheapest first - so each step is
+     * a walk down a short list instead of a look at every city. Only when the
+     * whole list has been visited does it fall back to the full scan. Stops
+     * like nearest_neighbor_ws().
+     */
+    TSP_Path *result = NULL;
+    int n = dist->n;
+    bool *visited = calloc(n, sizeof(bool));
+    int *path = malloc(n * sizeof(int));
+    int i = 0, a = 0;
+    int cur = 0;
+    int next = 0;
+    int cost = 0;
+    if(!visited || !path) {
+        tsp_log("Failed to allocate memory for visited/path!");
+        free(visited);
+        free(path);
+        return NULL;
+    }
+
+    visited[cur] = true;
+    path[0] = cur;
+    for(i = 1; i < n; i++) {
+        if((i & 0xff) == 0 && tsp_stopped(stop)) {
+            cost += nn_finish(dist, visited, path, i, cur);
+            cur = path[n - 1];
+            break;
+        }
+        next = -1;
+        for(a = cand->rowptr[cur]; a < cand->rowptr[cur + 1]; a++) {
+            if(!visited[cand->col[a]]) {
+                next = cand->col[a];
+                break;
+            }
+        }
+        if(next < 0) next = find_nearest_neighbor(cur, dist, visited);
+        path[i] = next;
+        cost += dm_get(dist, cur, next);
+        cur = next;
+        visited[cur] = true;
+    }
+    cost += dm_get(dist, cur, 0);
+
+    result = make_tsp_path(path, n, cost);
+    free(visited);
+    free(path);
+    return result;
+}
+
+TSP_Path* nearest_neighbor_grid(const TSP_Coords *c, int metric,
+        const TSP_Stop *stop) {
+    /*
+     * Nearest Neighbor straight from the coordinates, using a SpatialGrid to
+     * find the closest unvisited city - visited cities are removed from the
+     * grid, so each step only looks at the cells around the current city and
+     * the whole tour is about O(n) instead of O(n^2), with no distance table.
+     *
+     * The grid measures exact squared straight line (or taxicab) distances
+     * between integer points, and MAN_2D, EUC_2D, CEIL_2D and ATT only ever
+     * round those up or to the nearest - so with whole number coordinates the
+     * grid's nearest city is nearest by the metric too (ties may go another
+     * way than nearest_neighbor()'s). Anything else - GEO, fractions,
+     * coordinates past +-2^30 where the squares would overflow - comes back
+     * NULL, for the caller to use a distance table instead. So does running
+     * out of memory. Stops like nearest_neighbor_ws().
+     */
+    TSP_Path *result = NULL;
+    SpatialGrid *grid = NULL;
+    Vec2i *pts = NULL;
+    int *path = NULL;
+    bool *visited = NULL;
+    int n = c->n;
+    int i = 0, k = 0, cur = 0, next = 0, cost = 0;
+    if(n <= 0 || (metric != METRIC_MAN_2D && metric != METRIC_EUC_2D &&
+            metric != METRIC_CEIL_2D && metric != METRIC_ATT)) {
+        return NULL;
+    }
+    for(i = 0; i < n; i++) {
+        if(c->x[i] != floor(c->x[i]) || c->y[i] != floor(c->y[i]) ||
+                fabs(c->x[i]) > NN_GRID_MAX || fabs(c->y[i]) > NN_GRID_MAX) {
+            return NULL;
+        }
+    }
+    pts = malloc(n * sizeof(Vec2i));
+    path = malloc(n * sizeof(int));
+    visited = calloc(n, sizeof(bool));
+    if(!pts || !path || !visited) {
+        free(pts);
+        free(path);
+        free(visited);
+        return NULL;
+    }
+    for(i = 0; i < n; i++) pts[i] = make_vec((int)c->x[i], (int)c->y[i]);
+    grid = create_SpatialGrid(pts, n, 0, metric == METRIC_MAN_2D);
+    if(!grid) {
+        free(pts);
+        free(path);
+        free(visited);
+        return NULL;
+    }
+
+    remove_SpatialGrid(grid, cur);
+    visited[cur] = true;
+    path[0] = cur;
+    for(i = 1; i < n; i++) {
+        if((i & 0xff) == 0 && tsp_stopped(stop)) {
+            // The rest in index order, as nn_finish() does
+            for(k = 0; k < n && i < n; k++) {
+                if(visited[k]) continue;
+                path[i++] = k;
+                cost += coord_dist(c, metric, cur, k);
+                cur = k;
+            }
+            break;
+        }
+        next = nearest_SpatialGrid(grid, pts[cur], -1);
+        remove_SpatialGrid(grid, next);
+        visited[next] = true;
+        path[i] = next;
+        cost += coord_dist(c, metric, cur, next);
+        cur = next;
+    }
+    cost += coord_dist(c, metric, cur, 0);
+
+    result = make_tsp_path(path, n, cost);
+    destroy_SpatialGrid(grid);
+    free(pts);
+    free(path);
+    free(visited);
+    return result;
 }
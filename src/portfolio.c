@@ -0,0 +1,206 @@
+/*
+* TSP
+* Copyright (C) Zach Wilder 2024
+*
+* This file is a part of TSP
+*
+* TSP is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* TSP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with TSP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <tsp.h>
+#include <pthread.h>
+#include <time.h>
+
+/*****
+ * Portfolio solving
+ *
+ * Which solver is best depends on the instance, so run them all at once on
+ * their own threads and take the best tour any of them comes up with:
+ *  - Held-Karp, when select_solver() reckons it fits the time and memory
+ *  - nearest neighbor + 2-opt, which has an answer almost straight away
+ *  - iterated local search, which keeps improving on its own 2-opt tour
+ *
+ * Every tour goes through one shared best slot. Its cost is an atomic, so an
+ * engine can see whether it has anything worth offering without taking the
+ * lock; the tour itself is copied in under the lock, and the solve's progress
+ * callback hears about it there.
+ *
+ * The race is over when Held-Karp finishes (its tour is optimal, so nothing
+ * can beat it), when every engine has finished, or when the solve's own
+ * TSP_Stop says so (time limit, cancel) - whichever comes first. The engines
+ * share a TSP_Stop with the solve's as its parent; it's set, the engines give
+ * up at their next check, and the best tour so far is the answer.
+ *****/
+
+typedef struct {
+    const TSP_Instance *inst;
+    const TSP_Graph *cand;
+    int kicks;
+    TSP_Stop stop;          // The engines', parent is the solve's
+
+    pthread_mutex_t lock;
+    pthread_cond_t done;    // An engine finished
+    int running;
+    bool proved;            // Held-Karp finished, best is optimal
+
+    atomic_int best_cost;   // INT_MAX until there's a tour
+    int *best;              // n cities
+    TSP_Solver best_by;
+} Portfolio;
+
+typedef struct {
+    Portfolio *pf;
+    TSP_Solver engine;
+} PortfolioEngine;
+
+static void pf_offer(Portfolio *pf, const TSP_Path *tour, TSP_Solver by) {
+    /* Put tour in the best slot if it beats what's there */
+    if(tour->cost >= atomic_load(&pf->best_cost)) return;
+    pthread_mutex_lock(&pf->lock);
+    if(tour->cost < atomic_load(&pf->best_cost)) {
+        memcpy(pf->best, tour->path, tour->n * sizeof(int));
+        pf->best_by = by;
+        atomic_store(&pf->best_cost, tour->cost);
+        stop_progress(pf->stop.parent, by, -1, tour->cost);
+    }
+    pthread_mutex_unlock(&pf->lock);
+}
+
+static void pf_improved(const TSP_Path *tour, void *arg) {
+    pf_offer(arg, tour, TSP_SOLVER_ILS);
+}
+
+static void* pf_engine(void *arg) {
+    PortfolioEngine *e = arg;
+    Portfolio *pf = e->pf;
+    const DistMatrix *dist = pf->inst->dist;
+    TSP_Workspace *ws = NULL;
+    TSP_Path *tour = NULL;
+    bool optimal = false;
+
+    switch(e->engine) {
+        case TSP_SOLVER_HK:
+            ws = create_workspace();
+            if(ws) tour = held_karp_ws(dist, 0, ws, &pf->stop);
+            destroy_workspace(ws);
+            optimal = (tour != NULL);
+            break;
+        case TSP_SOLVER_2OPT:
+            tour = two_opt_start(dist, pf->cand, &pf->stop);
+            break;
+        case TSP_SOLVER_ILS:
+            tour = two_opt_start(dist, pf->cand, &pf->stop);
+            if(tour) {
+                pf_offer(pf, tour, TSP_SOLVER_ILS);
+                iterated_local_search(dist, pf->cand, tour, pf->kicks, NULL,
+                        &pf->stop, pf_improved, pf);
+            }
+            break;
+        default:
+            break;
+    }
+    if(tour) pf_offer(pf, tour, e->engine);
+    destroy_tsp_path(tour);
+
+    pthread_mutex_lock(&pf->lock);
+    if(optimal) {
+        pf->proved = true;
+        atomic_store(&pf->stop.stop, true);
+    }
+    pf->running--;
+    pthread_cond_signal(&pf->done);
+    pthread_mutex_unlock(&pf->lock);
+    return NULL;
+}
+
+TSP_Path* solve_portfolio(const TSP_Instance *inst, const TSP_Options *opt,
+        const TSP_Stop *stop, TSP_Solver *used, bool *stopped) {
+    /* Race the engines on inst (see above) until stop says otherwise. *used is
+     * set to the engine whose tour won, *stopped to whether stop ended the
+     * race before an engine could. NULL if none of them found a tour. */
+    static const TSP_Solver engines[] = {TSP_SOLVER_HK, TSP_SOLVER_2OPT,
+        TSP_SOLVER_ILS};
+    Portfolio pf;
+    PortfolioEngine eng[3];
+    pthread_t threads[3];
+    bool started[3] = {false, false, false};
+    pthread_condattr_t attr;
+    TSP_Selection sel;
+    struct timespec wake;
+    TSP_Graph *cand = NULL;
+    TSP_Path *tour = NULL;
+    int i = 0, n = inst->n;
+
+    memset(&pf, 0, sizeof(Portfolio));
+    pf.inst = inst;
+    pf.best = malloc(n * sizeof(int));
+    if(!pf.best) return NULL;
+    cand = instance_candidates(inst, opt);
+    pf.cand = cand;
+    // With a deadline ILS runs until it, without one the default kicks
+    pf.kicks = (stop && stop->deadline > 0) ? INT_MAX : 0;
+    atomic_init(&pf.stop.stop, false);
+    pf.stop.parent = stop;
+    atomic_init(&pf.best_cost, INT_MAX);
+    pthread_mutex_init(&pf.lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&pf.done, &attr);
+    pthread_condattr_destroy(&attr);
+
+    select_solver(inst, opt, &sel);
+    pthread_mutex_lock(&pf.lock);
+    for(i = 0; i < 3; i++) {
+        if(engines[i] == TSP_SOLVER_HK && !sel.fits[TSP_SOLVER_HK]) continue;
+        eng[i].pf = &pf;
+        eng[i].engine = engines[i];
+        if(pthread_create(&threads[i], NULL, pf_engine, &eng[i]) == 0) {
+            started[i] = true;
+            pf.running++;
+        }
+    }
+
+    // Wake every 10ms to look at stop - a cancel doesn't signal done
+    *stopped = false;
+    while(pf.running > 0 && !pf.proved) {
+        if(tsp_stopped(stop)) {
+            *stopped = true;
+            break;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &wake);
+        wake.tv_nsec += 10000000L;
+        if(wake.tv_nsec >= 1000000000L) {
+            wake.tv_sec++;
+            wake.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&pf.done, &pf.lock, &wake);
+    }
+    // The engines may have given up on stop themselves rather than finished
+    if(!pf.proved && tsp_stopped(stop)) *stopped = true;
+    // Time's up (or the answer's in) - call off the rest
+    atomic_store(&pf.stop.stop, true);
+    pthread_mutex_unlock(&pf.lock);
+    for(i = 0; i < 3; i++) {
+        if(started[i]) pthread_join(threads[i], NULL);
+    }
+
+    if(atomic_load(&pf.best_cost) != INT_MAX) {
+        tour = make_tsp_path(pf.best, n, atomic_load(&pf.best_cost));
+        *used = pf.best_by;
+    }
+    pthread_cond_destroy(&pf.done);
+    pthread_mutex_destroy(&pf.lock);
+    destroy_graph(cand);
+    free(pf.best);
+    return tour;
+}
@@ -0,0 +1,330 @@
+/*
+* TSP
+* Copyright (C) Zach Wilder 2024
+*
+* This file is a part of TSP
+*
+* TSP is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* TSP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with TSP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <tsp.h>
+
+/*****
+ * Edge elimination
+ *
+ * A 1-tree is a spanning tree on cities 1..n-1, plus the two cheapest edges
+ * from city 0. Every tour is a 1-tree (one where every city has degree 2), so
+ * the cheapest 1-tree is a lower bound on the tour. Adding a penalty pi[i] to
+ * every edge touching city i changes every tour by the same 2 * sum(pi) but
+ * changes the trees, so the bound is pushed up by raising the penalties on
+ * cities with degree > 2 and lowering them on leaves (subgradient
+ * optimization, Held & Karp 1970).
+ *
+ * With the best penalties found, forcing a non-tree edge (i,j) into the 1-tree
+ * costs at least its reduced cost - c'(i,j) minus the most expensive edge on
+ * the tree path from i to j (which it would replace). If the bound plus that is
+ * more than the cost of a tour we already have, no tour using (i,j) can beat
+ * it, and the edge is thrown away.
+ *****/
+
+#define REDUCE_ITERS 100    // Subgradient iterations
+#define REDUCE_EPS 1e-6     // Slack for floating point in the bound
+
+typedef struct {
+    int n;
+    const DistMatrix *dist;
+    const double *pi;
+    int *parent;        // Tree parent of each city 1..n-1, -1 for the root
+    double *pw;         // c' of the edge to the parent
+    int e1, e2;         // City 0's two 1-tree neighbours, c'(0,e1) <= c'(0,e2)
+    double w1, w2;
+    int *deg;
+    int *row;           // Scratch distance row
+    double *key;        // Prim scratch
+    bool *in_tree;
+} OneTree;
+
+static bool grow_ints(int **p, long cap) {
+    /* realloc that leaves *p alone (still to be freed) if it fails */
+    int *grow = realloc(*p, cap * sizeof(int));
+    if(!grow) return false;
+    *p = grow;
+    return true;
+}
+
+static double one_tree(OneTree *ot) {
+    /* Build the minimum 1-tree under the penalties ot->pi with Prim (O(n^2),
+     * one distance row per city added). Returns its penalized cost minus
+     * 2 * sum(pi) - the lower bound - and fills in the degrees. */
+    int n = ot->n;
+    const double *pi = ot->pi;
+    int i = 0, k = 0, v = 0, best = 0;
+    double total = 0, c = 0, bestkey = 0;
+
+    for(i = 0; i < n; i++) {
+        ot->deg[i] = 0;
+        ot->in_tree[i] = false;
+        ot->key[i] = HUGE_VAL;
+        ot->parent[i] = -1;
+    }
+    // Spanning tree on 1..n-1, rooted at 1
+    v = 1;
+    ot->key[v] = 0;
+    for(k = 0; k < n - 1; k++) {
+        best = -1;
+        bestkey = HUGE_VAL;
+        for(i = 1; i < n; i++) {
+            if(!ot->in_tree[i] && ot->key[i] < bestkey) {
+                bestkey = ot->key[i];
+                best = i;
+            }
+        }
+        v = best;
+        ot->in_tree[v] = true;
+        if(ot->parent[v] >= 0) {
+            ot->pw[v] = bestkey;
+            total += bestkey;
+            ot->deg[v]++;
+            ot->deg[ot->parent[v]]++;
+        }
+        dm_get_row(ot->dist, v, 0, n, ot->row);
+        for(i = 1; i < n; i++) {
+            if(ot->in_tree[i]) continue;
+            c = ot->row[i] + pi[v] + pi[i];
+            if(c < ot->key[i]) {
+                ot->key[i] = c;
+                ot->parent[i] = v;
+            }
+        }
+    }
+    // City 0's two cheapest edges
+    dm_get_row(ot->dist, 0, 0, n, ot->row);
+    ot->e1 = ot->e2 = -1;
+    ot->w1 = ot->w2 = HUGE_VAL;
+    for(i = 1; i < n; i++) {
+        c = ot->row[i] + pi[0] + pi[i];
+        if(c < ot->w1) {
+            ot->e2 = ot->e1;
+            ot->w2 = ot->w1;
+            ot->e1 = i;
+            ot->w1 = c;
+        } else if(c < ot->w2) {
+            ot->e2 = i;
+            ot->w2 = c;
+        }
+    }
+    total += ot->w1 + ot->w2;
+    ot->deg[0] = 2;
+    ot->deg[ot->e1]++;
+    ot->deg[ot->e2]++;
+    for(i = 0; i < n; i++) total -= 2 * pi[i];
+    return total;
+}
+
+static double best_bound(OneTree *ot, double *pi, double *best_pi, int ub) {
+    /* Subgradient optimization of the penalties. Leaves the best penalties in
+     * best_pi, and returns the bound they give. */
+    int n = ot->n;
+    int it = 0, i = 0, stall = 0, norm = 0;
+    double lambda = 2.0, bound = 0, best = -HUGE_VAL, step = 0;
+    for(i = 0; i < n; i++) pi[i] = 0;
+    ot->pi = pi;
+    for(it = 0; it < REDUCE_ITERS; it++) {
+        bound = one_tree(ot);
+        if(bound > best + REDUCE_EPS) {
+            best = bound;
+            memcpy(best_pi, pi, n * sizeof(double));
+            stall = 0;
+        } else if(++stall >= 5) {
+            // Not getting anywhere, take smaller steps
+            lambda /= 2;
+            stall = 0;
+        }
+        norm = 0;
+        for(i = 0; i < n; i++) {
+            norm += (ot->deg[i] - 2) * (ot->deg[i] - 2);
+        }
+        if(norm == 0) break; // The 1-tree is a tour, and so it's optimal
+        if(ub - bound <= REDUCE_EPS || lambda < 1e-4) break;
+        step = lambda * (ub - bound) / norm;
+        for(i = 0; i < n; i++) pi[i] += step * (ot->deg[i] - 2);
+    }
+    ot->pi = best_pi;
+    return one_tree(ot);
+}
+
+TSP_Graph* reduce_edges(const DistMatrix *dist, const TSP_Path *incumbent,
+        TSP_ReduceStats *stats) {
+    /*
+     * Throw away every edge that can't be in a tour shorter than incumbent
+     * (which should be the best tour known - nearest neighbor + 2-opt is a
+     * good start). What's left comes back as a candidate graph for
+     * held_karp_graph() or two_opt(). Edges of the incumbent always survive.
+     * Returns NULL if something couldn't be allocated. Assumes a symmetric
+     * matrix, and n >= 3.
+     *
+     * The reduced costs need the max edge on the tree path between every pair
+     * of cities - a walk of the tree from each city, O(n) each, so O(n^2) time
+     * but only O(n) memory on top of the output. That's dwarfed by the
+     * subgradient steps though: REDUCE_ITERS 1-trees, each an O(n^2) Prim.
+     */
+    int n = dist->n;
+    OneTree ot;
+    TSP_Graph *g = NULL;
+    double *pi = NULL, *best_pi = NULL, *beta = NULL;
+    int *adj = NULL, *adjptr = NULL, *fill = NULL, *stack = NULL;
+    int *eu = NULL, *ev = NULL, *ew = NULL;
+    long m = 0, cap = 0, total = (long)n * (n - 1) / 2;
+    int i = 0, j = 0, a = 0, v = 0, u = 0, sp = 0;
+    int ub = incumbent->cost;
+    double bound = 0, c = 0;
+    bool ok = true;
+    struct timespec t0, t1;
+    if(n < 3) return NULL;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    memset(&ot, 0, sizeof(ot));
+    ot.n = n;
+    ot.dist = dist;
+    ot.parent = malloc(n * sizeof(int));
+    ot.pw = calloc(n, sizeof(double));
+    ot.deg = malloc(n * sizeof(int));
+    ot.row = malloc(n * sizeof(int));
+    ot.key = malloc(n * sizeof(double));
+    ot.in_tree = malloc(n * sizeof(bool));
+    pi = malloc(n * sizeof(double));
+    best_pi = malloc(n * sizeof(double));
+    beta = malloc(n * sizeof(double));
+    adjptr = calloc(n + 1, sizeof(int));
+    adj = malloc(2 * n * sizeof(int));
+    fill = malloc(n * sizeof(int));
+    stack = malloc(n * sizeof(int));
+    cap = 4 * (long)n;
+    eu = malloc(cap * sizeof(int));
+    ev = malloc(cap * sizeof(int));
+    ew = malloc(cap * sizeof(int));
+    if(!ot.parent || !ot.pw || !ot.deg || !ot.row || !ot.key ||
+            !ot.in_tree || !pi || !best_pi || !beta || !adjptr || !adj ||
+            !fill || !stack || !eu || !ev || !ew) {
+        tsp_log("Failed to allocate memory for edge elimination!");
+        ok = false;
+    }
+
+    if(ok) {
+        bound = best_bound(&ot, pi, best_pi, ub);
+        // Tree adjacency (cities 1..n-1) in CSR form, for the path walks
+        for(v = 1; v < n; v++) {
+            if(ot.parent[v] < 0) continue;
+            adjptr[v + 1]++;
+            adjptr[ot.parent[v] + 1]++;
+        }
+        for(v = 0; v < n; v++) {
+            adjptr[v + 1] += adjptr[v];
+            fill[v] = adjptr[v];
+        }
+        for(v = 1; v < n; v++) {
+            if(ot.parent[v] < 0) continue;
+            adj[fill[v]++] = ot.parent[v];
+            adj[fill[ot.parent[v]]++] = v;
+        }
+    }
+
+    for(i = 0; ok && i < n; i++) {
+        if(i > 0) {
+            // beta[j] = most expensive edge on the tree path i -> j. Depth
+            // first from i, fill[] remembers where each city came from.
+            beta[i] = -HUGE_VAL;
+            fill[i] = -1;
+            sp = 0;
+            stack[sp++] = i;
+            while(sp) {
+                v = stack[--sp];
+                for(a = adjptr[v]; a < adjptr[v + 1]; a++) {
+                    u = adj[a];
+                    if(u == fill[v]) continue;
+                    fill[u] = v;
+                    c = (ot.parent[u] == v) ? ot.pw[u] : ot.pw[v];
+                    beta[u] = (beta[v] > c) ? beta[v] : c;
+                    stack[sp++] = u;
+                }
+            }
+        }
+        dm_get_row(dist, i, 0, n, ot.row);
+        for(j = i + 1; j < n; j++) {
+            c = ot.row[j] + best_pi[i] + best_pi[j];
+            if(i == 0) {
+                // Replaces the dearer of city 0's two edges
+                if(j != ot.e1 && j != ot.e2 && bound + c - ot.w2 >
+                        ub + REDUCE_EPS) continue;
+            } else if(ot.parent[i] != j && ot.parent[j] != i) {
+                if(bound + c - beta[j] > ub + REDUCE_EPS) continue;
+            }
+            if(m == cap) {
+                cap *= 2;
+                if(!grow_ints(&eu, cap) || !grow_ints(&ev, cap) ||
+                        !grow_ints(&ew, cap)) {
+                    tsp_log("Failed to allocate memory for edge elimination!");
+                    ok = false;
+                    break;
+                }
+            }
+            eu[m] = i;
+            ev[m] = j;
+            ew[m] = ot.row[j];
+            m++;
+        }
+    }
+
+    if(ok) g = create_graph_edges(n, m, eu, ev, ew, true);
+    if(g && stats) {
+        stats->edges = total;
+        stats->eliminated = total - m;
+        stats->lower_bound = bound;
+        stats->upper_bound = ub;
+        stats->edge_ratio = m ? (double)total / m : 0;
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        stats->seconds = (t1.tv_sec - t0.tv_sec) +
+            (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    }
+    free(ot.parent);
+    free(ot.pw);
+    free(ot.deg);
+    free(ot.row);
+    free(ot.key);
+    free(ot.in_tree);
+    free(pi);
+    free(best_pi);
+    free(beta);
+    free(adjptr);
+    free(adj);
+    free(fill);
+    free(stack);
+    free(eu);
+    free(ev);
+    free(ew);
+    return g;
+}
+
+void print_reduce_stats(FILE *out, const TSP_ReduceStats *stats) {
+    fprintf(out, "Edge elimination: %ld of %ld edges removed (%.1f%%) in "
+            "%.3fs\n", stats->eliminated, stats->edges,
+            stats->edges ? 100.0 * stats->eliminated / stats->edges : 0.0,
+            stats->seconds);
+    fprintf(out, "  1-tree bound %.1f, incumbent %d (gap %.2f%%)\n",
+            stats->lower_bound, stats->upper_bound,
+            stats->upper_bound ?
+            100.0 * (stats->upper_bound - stats->lower_bound) /
+            stats->upper_bound : 0.0);
+    fprintf(out, "  %.1fx fewer edges (a count, not a time)\n",
+            stats->edge_ratio);
+}
@@ -0,0 +1,260 @@
+/*
+* TSP
+* Copyright (C) Zach Wilder 2024
+*
+* This file is a part of TSP
+*
+* TSP is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* TSP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with TSP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <tsp.h>
+
+#define RNG_CHUNK 256   // u32's drawn at a time by rng_fill_range()
+
+/* xoshiro256's jump polynomials: 2^128 and 2^192 steps ahead */
+static const uint64_t rng_jump_poly[4] = {0x180ec6d33cfd0abaULL,
+    0xd5a61266f0c9392cULL, 0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL};
+static const uint64_t rng_long_jump_poly[4] = {0x76e15d3efefdcbbfULL,
+    0xc5004e441c522fb3ULL, 0x77710069854ee241ULL, 0x39109bb02acbe635ULL};
+
+static uint64_t splitmix64(uint64_t *x) {
+    /* For turning one seed into the lanes' states - xoshiro's authors'
+     * recommendation, since it never gives an all-zero state */
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static inline void rng_block(TSP_Rng *r, uint64_t *restrict out);
+
+static void rng_jump_all(TSP_Rng *r, const uint64_t poly[4]) {
+    /* Move every lane poly's distance ahead: the state it ends up in is the
+     * xor of the states it passes through at poly's set bits. All the lanes
+     * step together, so this is 256 steps whatever RNG_LANES is. */
+    uint64_t acc[4][RNG_LANES], out[RNG_LANES];
+    int i = 0, b = 0, w = 0, l = 0;
+    memset(acc, 0, sizeof(acc));
+    for(i = 0; i < 4; i++) {
+        for(b = 0; b < 64; b++) {
+            if(poly[i] & (1ULL << b)) {
+                for(w = 0; w < 4; w++) {
+                    for(l = 0; l < RNG_LANES; l++) acc[w][l] ^= r->s[w][l];
+                }
+            }
+            rng_block(r, out);
+        }
+    }
+    memcpy(r->s, acc, sizeof(acc));
+    r->left = 0;
+}
+
+void rng_seed(TSP_Rng *r, uint64_t seed) {
+    /* Stream 0 of seed: lane 0 from splitmix64, each lane after it 2^128
+     * steps on from the one before, so no two lanes can ever overlap.
+     * Jumping every lane at once (rng_jump_all()) and taking the next lane
+     * from the lane before does all of that in RNG_LANES - 1 jumps. */
+    TSP_Rng tmp;
+    int w = 0, l = 0, k = 0;
+    for(w = 0; w < 4; w++) {
+        r->s[w][0] = splitmix64(&seed);
+        for(l = 1; l < RNG_LANES; l++) r->s[w][l] = r->s[w][0];
+    }
+    // After pass k lanes k.. are k jumps on; lane k keeps that
+    for(k = 1; k < RNG_LANES; k++) {
+        memcpy(&tmp, r, sizeof(TSP_Rng));
+        rng_jump_all(&tmp, rng_jump_poly);
+        for(w = 0; w < 4; w++) {
+            for(l = k; l < RNG_LANES; l++) r->s[w][l] = tmp.s[w][l];
+        }
+    }
+    r->left = 0;
+}
+
+void rng_next_stream(TSP_Rng *r) {
+    /* On to the next stream: every lane 2^192 steps ahead. A stream's lanes
+     * only span RNG_LANES * 2^128 steps, so streams never overlap either. */
+    rng_jump_all(r, rng_long_jump_poly);
+}
+
+void rng_stream(TSP_Rng *r, uint64_t seed, int k) {
+    /* Stream k of seed - O(k), see rng_split() for a lot of them */
+    int i = 0;
+    rng_seed(r, seed);
+    for(i = 0; i < k; i++) rng_next_stream(r);
+}
+
+void rng_split(uint64_t seed, TSP_Rng *out, int count) {
+    /* out[k] = stream k of seed, for k < count */
+    int k = 0;
+    if(count <= 0) return;
+    rng_seed(&out[0], seed);
+    for(k = 1; k < count; k++) {
+        memcpy(&out[k], &out[k - 1], sizeof(TSP_Rng));
+        rng_next_stream(&out[k]);
+    }
+}
+
+static inline void rng_block(TSP_Rng *r, uint64_t *restrict out) {
+    /* One xoshiro256** step of every lane, lane l's output to out[l]. The
+     * multiplies by 5 and 9 are shifts and adds, and the rotates shifts and
+     * ors, so the whole step is SSE2/AVX2 integer ops. */
+    uint64_t *restrict s0 = r->s[0], *restrict s1 = r->s[1];
+    uint64_t *restrict s2 = r->s[2], *restrict s3 = r->s[3];
+    uint64_t x, t;
+    int l;
+    #pragma omp simd private(x, t)
+    for(l = 0; l < RNG_LANES; l++) {
+        x = s1[l] + (s1[l] << 2);
+        x = (x << 7) | (x >> 57);
+        out[l] = x + (x << 3);
+        t = s1[l] << 17;
+        s2[l] ^= s0[l];
+        s3[l] ^= s1[l];
+        s1[l] ^= s2[l];
+        s0[l] ^= s3[l];
+        s2[l] ^= t;
+        s3[l] = (s3[l] << 45) | (s3[l] >> 19);
+    }
+}
+
+uint64_t rng_u64(TSP_Rng *r) {
+    if(r->left == 0) {
+        rng_block(r, r->buf);
+        r->left = RNG_LANES;
+    }
+    return r->buf[RNG_LANES - r->left--];
+}
+
+uint32_t rng_u32(TSP_Rng *r) {
+    /* The high half - the better bits for most generators, though all of
+     * xoshiro256**'s are good */
+    return (uint32_t)(rng_u64(r) >> 32);
+}
+
+double rng_double(TSP_Rng *r) {
+    /* [0, 1) with 53 bits */
+    return (rng_u64(r) >> 11) * 0x1.0p-53;
+}
+
+uint32_t rng_bounded(uint32_t x, uint32_t range, TSP_Rng *r) {
+    /*
+     * x (a uniform u32) scaled to [0, range) by Lemire's method: the high
+     * word of x * range. The low word says whether x fell in the 2^32 %
+     * range values that would make some results more likely than others;
+     * those are thrown away and redrawn from r. Only when that's possible at
+     * all (the low word is under range) is the division for the threshold
+     * worked out.
+     */
+    uint64_t m = (uint64_t)x * range;
+    uint32_t low = (uint32_t)m, t = 0;
+    if(low < range) {
+        t = -range % range;
+        while(low < t) {
+            m = (uint64_t)rng_u32(r) * range;
+            low = (uint32_t)m;
+        }
+    }
+    return (uint32_t)(m >> 32);
+}
+
+int rng_range(TSP_Rng *r, int min, int max) {
+    /* Uniform on [min, max] */
+    uint32_t range = (uint32_t)max - (uint32_t)min + 1;
+    if(range == 0) return (int)rng_u32(r); // The whole of int
+    return min + (int)rng_bounded(rng_u32(r), range, r);
+}
+
+void rng_fill_u64(TSP_Rng *r, uint64_t *out, size_t count) {
+    /* What's left of buf, then whole steps straight into out, then the
+     * remainder through buf again */
+    size_t i = 0;
+    while(i < count && r->left > 0) out[i++] = rng_u64(r);
+    for(; i + RNG_LANES <= count; i += RNG_LANES) rng_block(r, out + i);
+    while(i < count) out[i++] = rng_u64(r);
+}
+
+void rng_fill_u32(TSP_Rng *r, uint32_t *out, size_t count) {
+    /* Each u64 gives two u32s, high half first; an odd count throws the last
+     * low half away */
+    uint64_t block[RNG_LANES];
+    size_t i = 0;
+    int l = 0;
+    while(i < count && r->left > 0) out[i++] = rng_u32(r);
+    for(; i + 2 * RNG_LANES <= count; i += 2 * RNG_LANES) {
+        rng_block(r, block);
+        #pragma omp simd
+        for(l = 0; l < RNG_LANES; l++) {
+            out[i + 2 * l] = (uint32_t)(block[l] >> 32);
+            out[i + 2 * l + 1] = (uint32_t)block[l];
+        }
+    }
+    while(i < count) {
+        if(i + 1 < count) {
+            block[0] = rng_u64(r);
+            out[i++] = (uint32_t)(block[0] >> 32);
+            out[i++] = (uint32_t)block[0];
+        } else {
+            out[i++] = rng_u32(r);
+        }
+    }
+}
+
+void rng_fill_double(TSP_Rng *r, double *out, size_t count) {
+    /* [0, 1), 53 bits each */
+    uint64_t block[RNG_LANES];
+    size_t i = 0;
+    int l = 0;
+    while(i < count && r->left > 0) out[i++] = rng_double(r);
+    for(; i + RNG_LANES <= count; i += RNG_LANES) {
+        rng_block(r, block);
+        #pragma omp simd
+        for(l = 0; l < RNG_LANES; l++) {
+            out[i + l] = (double)(block[l] >> 11) * 0x1.0p-53;
+        }
+    }
+    while(i < count) out[i++] = rng_double(r);
+}
+
+void rng_fill_range(TSP_Rng *r, int *out, size_t count, int min, int max) {
+    /* count ints uniform on [min, max] - rng_bounded() on u32s drawn in bulk.
+     * The range is the same for all of them, so the rejection threshold is
+     * worked out once and the scaling is one SIMD loop; the rare draw that
+     * has to be thrown away is redrawn afterwards. */
+    uint32_t raw[RNG_CHUNK];
+    uint32_t range = (uint32_t)max - (uint32_t)min + 1;
+    uint32_t t = range ? -range % range : 0;
+    size_t i = 0, len = 0, k = 0;
+    uint64_t m = 0;
+    int bad = 0;
+    for(i = 0; i < count; i += len) {
+        len = (count - i < RNG_CHUNK) ? count - i : RNG_CHUNK;
+        rng_fill_u32(r, raw, len);
+        if(range == 0) {
+            for(k = 0; k < len; k++) out[i + k] = (int)raw[k]; // All of int
+            continue;
+        }
+        bad = 0;
+        #pragma omp simd private(m) reduction(|:bad)
+        for(k = 0; k < len; k++) {
+            m = (uint64_t)raw[k] * range;
+            out[i + k] = min + (int)(m >> 32);
+            bad |= ((uint32_t)m < t);
+        }
+        for(k = 0; bad && k < len; k++) {
+            if((uint32_t)((uint64_t)raw[k] * range) < t) {
+                out[i + k] = min + (int)rng_bounded(raw[k], range, r);
+            }
+        }
+    }
+}
@@ -0,0 +1,356 @@
+/*
+* TSP
+* Copyright (C) Zach Wilder 2024
+*
+* This file is a part of TSP
+*
+* TSP is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* TSP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with TSP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <tsp.h>
+#include <sys/sysinfo.h>
+
+/*****
+ * Choosing a solver (TSP_SOLVER_AUTO)
+ *
+ * Each solver gets an estimate of how long it will take and how much memory
+ * it needs at this n:
+ *
+ *   hk    n^2 2^n steps, 8 n 2^n bytes (dp + prev)
+ *   nn    n^2 steps (every step scans every city)
+ *   2opt  n log n steps with candidate lists (building them is most of it),
+ *         n^2 without
+ *   ils   2opt, then ILS_KICKS kicks of n steps each (n^2 without
+ *         candidates) - or the whole time limit, if there is one
+ *
+ * A step costs however many nanoseconds the TSP_Calibration says, measured
+ * on this machine by tsp_calibrate() or else the built-in numbers. The budget
+ * is opt->time_limit (TSP_AUTO_SECONDS without one) and opt->memory_limit,
+ * or what the system has free: MemAvailable (sysinfo() if there's no
+ * /proc/meminfo), less again if the process is in a cgroup with a limit. The
+ * system is only asked when some solver needs more than SELECT_SMALL bytes,
+ * which for a batch of small instances is never.
+ *
+ * Of the solvers good enough for opt->quality and inside the budget, the
+ * fastest wins. If none is, it's the best solver that does fit, and failing
+ * that the fastest one that fits in memory (it'll be stopped at the time
+ * limit with what it has). Held-Karp is never picked past the budget: half a
+ * table isn't a tour.
+ *****/
+
+#define SELECT_SMALL (64.0 * 1024 * 1024)
+
+// Best first - the order quality levels go in
+static const TSP_Solver select_order[] = {TSP_SOLVER_HK, TSP_SOLVER_ILS,
+    TSP_SOLVER_2OPT, TSP_SOLVER_NN};
+
+static const char *quality_names[] = {"optimal", "high", "good", "any"};
+
+void tsp_default_calibration(TSP_Calibration *cal) {
+    /* Nanoseconds per step on the machine this was written on */
+    cal->hk = 3.3;
+    cal->nn = 8;
+    cal->two_opt = 400;
+    cal->ils = 13;
+}
+
+const char* tsp_quality_name(TSP_Quality quality) {
+    if(quality < TSP_QUALITY_OPTIMAL || quality > TSP_QUALITY_ANY) return "?";
+    return quality_names[quality];
+}
+
+static bool read_number(const char *fname, const char *key, double *value) {
+    /* The number after key in fname (the first one in it if key is NULL).
+     * False if there's no such file or key, or it isn't a number ("max"). */
+    FILE *f = fopen(fname, "r");
+    char line[256];
+    bool found = false;
+    size_t len = key ? strlen(key) : 0;
+    if(!f) return false;
+    while(!found && fgets(line, sizeof(line), f)) {
+        if(key && strncmp(line, key, len) != 0) continue;
+        found = (sscanf(line + len, "%lf", value) == 1);
+        if(!key) break;
+    }
+    fclose(f);
+    return found;
+}
+
+double select_memory(void) {
+    /* Bytes this process could allocate without trouble */
+    struct sysinfo si;
+    double avail = 0, limit = 0, used = 0;
+    if(read_number("/proc/meminfo", "MemAvailable:", &avail)) {
+        avail *= 1024;
+    } else if(sysinfo(&si) == 0) {
+        avail = ((double)si.freeram + si.bufferram) * si.mem_unit;
+    }
+    // cgroup v2, then v1 - an unlimited v1 group says some absurd number,
+    // which is no trouble
+    if((read_number("/sys/fs/cgroup/memory.max", NULL, &limit) &&
+                read_number("/sys/fs/cgroup/memory.current", NULL, &used)) ||
+            (read_number("/sys/fs/cgroup/memory/memory.limit_in_bytes", NULL,
+                         &limit) &&
+             read_number("/sys/fs/cgroup/memory/memory.usage_in_bytes", NULL,
+                         &used))) {
+        if(limit - used < avail) avail = (limit > used) ? limit - used : 0;
+    }
+    return avail;
+}
+
+static void select_estimate(const TSP_Instance *inst, const TSP_Options *opt,
+        TSP_Selection *sel) {
+    /* Fill in sel's seconds and bytes for each solver (see above) */
+    TSP_Calibration def;
+    const TSP_Calibration *cal = opt ? opt->calibration : NULL;
+    double n = inst->n;
+    double k = 4 * ((opt && opt->candidates) ? opt->candidates :
+            TSP_CANDIDATES);
+    double limit = opt ? opt->time_limit : 0;
+    bool cand = inst->coords && inst->metric != METRIC_EXPLICIT;
+    double kick = cand ? n : n * n;
+    int s = 0;
+    if(!cal) {
+        tsp_default_calibration(&def);
+        cal = &def;
+    }
+    for(s = 0; s < TSP_SOLVERS; s++) {
+        sel->seconds[s] = INFINITY;
+        sel->bytes[s] = INFINITY;
+    }
+    if(inst->n <= HK_MAX_N) {
+        sel->seconds[TSP_SOLVER_HK] = cal->hk * 1e-9 * n * n * ldexp(1, n);
+        sel->bytes[TSP_SOLVER_HK] = 8 * n * ldexp(1, n);
+    }
+    sel->seconds[TSP_SOLVER_NN] = cal->nn * 1e-9 * n * n;
+    sel->bytes[TSP_SOLVER_NN] = 9 * n;
+    // Candidate lists (up to k a city) and the k-d tree they come from, then
+    // 2-opt's tour, positions and don't-look bits
+    sel->seconds[TSP_SOLVER_2OPT] = cal->two_opt * 1e-9 *
+        (cand ? n * log2(n + 1) : n * n);
+    sel->bytes[TSP_SOLVER_2OPT] = (cand ? (8 * k + 40) * n : 0) + 18 * n;
+    sel->seconds[TSP_SOLVER_ILS] = sel->seconds[TSP_SOLVER_2OPT] +
+        cal->ils * 1e-9 * ILS_KICKS * kick;
+    if(limit > 0) {
+        sel->seconds[TSP_SOLVER_ILS] = fmax(sel->seconds[TSP_SOLVER_2OPT],
+                limit);
+    }
+    sel->bytes[TSP_SOLVER_ILS] = sel->bytes[TSP_SOLVER_2OPT] + 8 * n;
+}
+
+static void fmt_bytes(char *buf, size_t len, double bytes) {
+    static const char *units[] = {"B", "KB", "MB", "GB", "TB", "PB"};
+    int u = 0;
+    while(bytes >= 1024 && u < 5) {
+        bytes /= 1024;
+        u++;
+    }
+    snprintf(buf, len, "%.3g%s", bytes, units[u]);
+}
+
+static void select_explain(TSP_Selection *sel, int n, TSP_Quality quality,
+        bool met) {
+    /* sel->why: what was picked, its estimate against the budget, and what
+     * was wrong with every better solver */
+    char *why = sel->why;
+    size_t len = sizeof(sel->why), at = 0;
+    char need[16], have[16];
+    TSP_Solver s = sel->solver;
+    int i = 0;
+    fmt_bytes(need, sizeof(need), sel->bytes[s]);
+    fmt_bytes(have, sizeof(have), sel->memory);
+    at = snprintf(why, len, "%s for %d cities: ~%.2gs, %s (budget %gs%s%s); "
+            "%s quality %s%s", tsp_solver_name(s), n, sel->seconds[s], need,
+            sel->time_budget, isinf(sel->memory) ? "" : ", ",
+            isinf(sel->memory) ? "" : have,
+            met ? "fastest meeting" : "nothing meeting",
+            tsp_quality_name(quality), met ? "" : " fits");
+    for(i = 0; select_order[i] != sel->solver && at < len; i++) {
+        s = select_order[i];
+        if(isinf(sel->bytes[s])) {
+            at += snprintf(why + at, len - at, ", %s can't do %d",
+                    tsp_solver_name(s), n);
+        } else if(sel->bytes[s] > sel->memory) {
+            fmt_bytes(need, sizeof(need), sel->bytes[s]);
+            at += snprintf(why + at, len - at, ", %s needs %s",
+                    tsp_solver_name(s), need);
+        } else {
+            at += snprintf(why + at, len - at, ", %s needs ~%.2gs",
+                    tsp_solver_name(s), sel->seconds[s]);
+        }
+    }
+}
+
+TSP_Solver select_solver(const TSP_Instance *inst, const TSP_Options *opt,
+        TSP_Selection *sel) {
+    /* Pick the solver for TSP_SOLVER_AUTO (see above). sel gets the
+     * estimates and the reasons; it can be NULL. */
+    TSP_Selection local;
+    TSP_Quality quality = opt ? opt->quality : TSP_QUALITY_OPTIMAL;
+    TSP_Solver s = TSP_SOLVER_NN, best = TSP_SOLVER_AUTO;
+    int i = 0, count = sizeof(select_order) / sizeof(TSP_Solver);
+    double most = 0;
+    bool met = true;
+    if(!sel) sel = &local;
+    memset(sel, 0, sizeof(TSP_Selection));
+    select_estimate(inst, opt, sel);
+    sel->time_budget = (opt && opt->time_limit > 0) ? opt->time_limit :
+        TSP_AUTO_SECONDS;
+    sel->memory = (opt && opt->memory_limit > 0) ? opt->memory_limit : 0;
+    if(sel->memory == 0) {
+        for(i = 0; i < count; i++) {
+            s = select_order[i];
+            if(!isinf(sel->bytes[s])) most = fmax(most, sel->bytes[s]);
+        }
+        sel->memory = (most > SELECT_SMALL) ? select_memory() : INFINITY;
+    }
+    for(i = 0; i < count; i++) {
+        s = select_order[i];
+        sel->fits[s] = sel->bytes[s] <= sel->memory &&
+            sel->seconds[s] <= sel->time_budget;
+    }
+
+    // Fastest good enough...
+    for(i = 0; i <= (int)quality && i < count; i++) {
+        s = select_order[i];
+        if(sel->fits[s] && (best == TSP_SOLVER_AUTO ||
+                    sel->seconds[s] < sel->seconds[best])) {
+            best = s;
+        }
+    }
+    // ...or the best that fits...
+    for(i = 0; best == TSP_SOLVER_AUTO && i < count; i++) {
+        met = false;
+        if(sel->fits[select_order[i]]) best = select_order[i];
+    }
+    // ...or the fastest that can run at all
+    for(i = 0; best == TSP_SOLVER_AUTO && i < count; i++) {
+        s = select_order[i];
+        if(s != TSP_SOLVER_HK && sel->bytes[s] <= sel->memory &&
+                (best == TSP_SOLVER_AUTO ||
+                 sel->seconds[s] < sel->seconds[best])) {
+            best = s;
+        }
+    }
+    sel->solver = (best == TSP_SOLVER_AUTO) ? TSP_SOLVER_NN : best;
+    select_explain(sel, inst->n, quality, met);
+    return sel->solver;
+}
+
+/*****
+ * Calibration
+ *****/
+
+static double cal_time(const TSP_Instance *inst, TSP_Solver solver,
+        int kicks) {
+    /* Seconds to run solver on inst */
+    TSP_Workspace *ws = create_workspace();
+    TSP_Graph *cand = NULL;
+    TSP_Path *tour = NULL;
+    double t0 = stop_now();
+    if(!ws) return 0;
+    switch(solver) {
+        case TSP_SOLVER_HK:
+            tour = held_karp_ws(inst->dist, 0, ws, NULL);
+            break;
+        case TSP_SOLVER_NN:
+            tour = nearest_neighbor_ws(inst->dist, ws, NULL);
+            break;
+        default:
+            cand = instance_candidates(inst, NULL);
+            tour = two_opt_start(inst->dist, cand, NULL);
+            if(tour && solver == TSP_SOLVER_ILS) {
+                iterated_local_search(inst->dist, cand, tour, kicks, NULL,
+                        NULL, NULL, NULL);
+            }
+            break;
+    }
+    t0 = stop_now() - t0;
+    destroy_tsp_path(tour);
+    destroy_graph(cand);
+    destroy_workspace(ws);
+    return t0;
+}
+
+static TSP_Instance* cal_instance(int n) {
+    /* n cities scattered at random (always the same ones) */
+    TSP_Coords *c = create_coords(n);
+    uint64_t s = 0x2545f4914f6cdd1dULL;
+    int i = 0;
+    if(!c) return NULL;
+    for(i = 0; i < n; i++) {
+        s ^= s << 13;
+        s ^= s >> 7;
+        s ^= s << 17;
+        c->x[i] = (double)(s % 100000);
+        c->y[i] = (double)((s >> 32) % 100000);
+    }
+    return create_instance_coords(c, METRIC_EUC_2D, DM_SYMMETRIC);
+}
+
+bool tsp_calibrate(TSP_Calibration *cal) {
+    /* Time each solver on this machine and fill in cal - a second or so.
+     * False (and cal left as it was) if there wasn't the memory to. */
+    TSP_Instance *hk = cal_instance(18), *big = cal_instance(2000);
+    TSP_Instance *mid = cal_instance(500);
+    double n = 0, t2 = 0;
+    bool ok = hk && big && mid;
+    if(ok) {
+        n = hk->n;
+        cal->hk = cal_time(hk, TSP_SOLVER_HK, 0) * 1e9 / (n * n * ldexp(1, n));
+        n = big->n;
+        cal->nn = cal_time(big, TSP_SOLVER_NN, 0) * 1e9 / (n * n);
+        cal->two_opt = cal_time(big, TSP_SOLVER_2OPT, 0) * 1e9 /
+            (n * log2(n + 1));
+        n = mid->n;
+        t2 = cal_time(mid, TSP_SOLVER_2OPT, 0);
+        cal->ils = fmax(cal_time(mid, TSP_SOLVER_ILS, 200) - t2, 0) * 1e9 /
+            (200 * n);
+    }
+    destroy_instance(hk);
+    destroy_instance(big);
+    destroy_instance(mid);
+    return ok;
+}
+
+bool tsp_calibration_save(const char *fname, const TSP_Calibration *cal) {
+    /* Write cal to fname as "name nanoseconds" lines */
+    FILE *f = fopen(fname, "w");
+    if(!f) return false;
+    fprintf(f, "# TSP calibration - nanoseconds per step (see select.c)\n"
+            "hk %g\nnn %g\n2opt %g\nils %g\n", cal->hk, cal->nn,
+            cal->two_opt, cal->ils);
+    return fclose(f) == 0;
+}
+
+bool tsp_calibration_load(const char *fname, TSP_Calibration *cal) {
+    /* Read a tsp_calibration_save() file into cal. Solvers it doesn't mention
+     * keep the built-in numbers. */
+    FILE *f = fopen(fname, "r");
+    char line[128], name[16];
+    double ns = 0;
+    bool ok = true;
+    if(!f) return false;
+    tsp_default_calibration(cal);
+    while(ok && fgets(line, sizeof(line), f)) {
+        if(line[0] == '#' || line[0] == '\n') continue;
+        if(sscanf(line, "%15s %lf", name, &ns) != 2 || ns <= 0) ok = false;
+        else if(strcmp(name, "hk") == 0) cal->hk = ns;
+        else if(strcmp(name, "nn") == 0) cal->nn = ns;
+        else if(strcmp(name, "2opt") == 0) cal->two_opt = ns;
+        else if(strcmp(name, "ils") == 0) cal->ils = ns;
+        else ok = false;
+    }
+    fclose(f);
+    return ok;
+}
@@ -0,0 +1,961 @@
+/*
+* TSP
+* Copyright (C) Zach Wilder 2024
+*
+* This file is a part of TSP
+*
+* TSP is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* TSP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with TSP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#define _GNU_SOURCE // accept4()
+#include <tsp.h>
+#include <errno.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+/*****
+ * Solve server (see server.h for the protocol)
+ *
+ * One thread runs an epoll loop over the listening socket, a signalfd for
+ * SIGINT/SIGTERM and every client, all non-blocking and level-triggered. Each
+ * time round the loop it reads whatever the ready clients sent, parses every
+ * complete request into a queue, and then solves the whole queue as one batch
+ * on a TSP_Pool (batch.c) - so the more clients are sending at once, the
+ * bigger the batches get. The loop thread is one of the pool's threads while
+ * a batch runs.
+ *
+ * Responses are appended to each client's output buffer in queue order, which
+ * is the order that client sent its requests, and written out as the socket
+ * takes them. A client that hangs up after its last request still gets its
+ * answers.
+ *****/
+
+#define SRV_BATCH 512               // Requests solved together at most
+#define SRV_READ 65536              // Bytes read from a client at a time
+#define SRV_MAX_MSG (64 << 20)      // Longest request accepted
+#define SRV_MAX_EVENTS 64
+#define SRV_ID_MAX 64               // Longest JSON id echoed back
+
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t cap;
+} SrvBuf;
+
+typedef struct {
+    int fd;
+    SrvBuf in;
+    SrvBuf out;
+    size_t out_pos;     // Bytes of out already sent
+    uint32_t events;    // What epoll is watching for
+    int pending;        // Requests in the queue
+    bool eof;           // Client won't send any more (or sent garbage)
+    bool dead;          // Socket error, nothing more can be written
+} SrvConn;
+
+typedef struct {
+    SrvConn *conn;
+    bool binary;
+    uint32_t bin_id;
+    char id[SRV_ID_MAX];    // JSON id as sent, "" if there wasn't one
+    TSP_Options opt;
+    TSP_Handle *h;          // NULL if the request couldn't be read
+    const char *error;      // ...and why
+    TSP_Result res;
+} SrvReq;
+
+typedef struct {
+    int epfd;
+    int lfd;
+    int sfd;
+    TSP_Pool *pool;
+    TSP_Options opt;
+    int mode;               // TSP_MATRIX_* for coordinate instances
+    bool stats;
+
+    SrvConn **conns;
+    int nconns;
+    int capconns;
+
+    SrvReq *reqs;           // The queue, SRV_BATCH long
+    int nreqs;
+    TSP_Handle **handles;   // One solver's share of the queue, for the pool
+    TSP_Result *results;
+    int *slot;              // Where handles[i] is in reqs
+
+    long served;
+    long failed;
+    long batches;
+    double solving;
+} Server;
+
+static const struct {
+    const char *name;
+    int metric;
+} srv_metrics[] = {
+    {"MAN_2D", TSP_METRIC_MAN_2D},
+    {"EUC_2D", TSP_METRIC_EUC_2D},
+    {"CEIL_2D", TSP_METRIC_CEIL_2D},
+    {"GEO", TSP_METRIC_GEO},
+    {"ATT", TSP_METRIC_ATT}
+};
+
+static double srv_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*****
+ * Buffers
+ *****/
+
+static bool srv_reserve(SrvBuf *b, size_t extra) {
+    /* Make room for extra more bytes in b */
+    size_t cap = b->cap ? b->cap : 4096;
+    char *grow = NULL;
+    if(b->len + extra <= b->cap) return true;
+    while(cap < b->len + extra) cap *= 2;
+    grow = realloc(b->buf, cap);
+    if(!grow) return false;
+    b->buf = grow;
+    b->cap = cap;
+    return true;
+}
+
+static bool srv_append(SrvBuf *b, const void *data, size_t len) {
+    if(!srv_reserve(b, len)) return false;
+    memcpy(b->buf + b->len, data, len);
+    b->len += len;
+    return true;
+}
+
+static bool srv_printf(SrvBuf *b, const char *fmt, ...) {
+    va_list args;
+    int len = 0;
+    va_start(args, fmt);
+    len = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+    if(len < 0 || !srv_reserve(b, len + 1)) return false;
+    va_start(args, fmt);
+    vsnprintf(b->buf + b->len, len + 1, fmt, args);
+    va_end(args);
+    b->len += len;
+    return true;
+}
+
+/*****
+ * JSON requests
+ *
+ * Just enough JSON for the request objects: strings come back with their
+ * escapes untouched (ids are echoed verbatim, and nothing else needs them),
+ * and keys that aren't recognised are skipped whatever they hold.
+ *****/
+
+typedef struct {
+    const char *p;
+    const char *end;
+} SrvJson;
+
+typedef struct {
+    double *v;
+    int n;
+    int cap;
+} SrvArray;
+
+static void js_ws(SrvJson *js) {
+    while(js->p < js->end && (*js->p == ' ' || *js->p == '\t' ||
+                *js->p == '\r' || *js->p == '\n')) {
+        js->p++;
+    }
+}
+
+static bool js_char(SrvJson *js, char c) {
+    /* Skip whitespace, and c if it comes next */
+    js_ws(js);
+    if(js->p < js->end && *js->p == c) {
+        js->p++;
+        return true;
+    }
+    return false;
+}
+
+static bool js_string(SrvJson *js, const char **str, int *len) {
+    /* A string, *str pointing at its contents (without the quotes) */
+    const char *start = NULL;
+    if(!js_char(js, '"')) return false;
+    start = js->p;
+    while(js->p < js->end && *js->p != '"') {
+        if(*js->p == '\\') js->p++;
+        js->p++;
+    }
+    if(js->p >= js->end) return false;
+    if(str) *str = start;
+    if(len) *len = js->p - start;
+    js->p++;
+    return true;
+}
+
+static bool js_number(SrvJson *js, double *v) {
+    /* The line isn't NUL terminated, so strtod() gets a copy */
+    char tmp[64];
+    char *stop = NULL;
+    int len = 0;
+    js_ws(js);
+    while(js->p + len < js->end && len < (int)sizeof(tmp) - 1 &&
+            js->p[len] != '\0' &&
+            strchr("+-.0123456789eE", js->p[len])) {
+        tmp[len] = js->p[len];
+        len++;
+    }
+    tmp[len] = '\0';
+    if(len == 0) return false;
+    *v = strtod(tmp, &stop);
+    if(stop != tmp + len) return false;
+    js->p += len;
+    return true;
+}
+
+static bool js_word(SrvJson *js, const char *word) {
+    size_t len = strlen(word);
+    js_ws(js);
+    if((size_t)(js->end - js->p) < len || memcmp(js->p, word, len) != 0) {
+        return false;
+    }
+    js->p += len;
+    return true;
+}
+
+static bool js_skip(SrvJson *js, int depth) {
+    /* Skip any value */
+    double v = 0;
+    if(depth > 64) return false;
+    js_ws(js);
+    if(js->p >= js->end) return false;
+    if(*js->p == '"') return js_string(js, NULL, NULL);
+    if(js_char(js, '[')) {
+        if(js_char(js, ']')) return true;
+        do {
+            if(!js_skip(js, depth + 1)) return false;
+        } while(js_char(js, ','));
+        return js_char(js, ']');
+    }
+    if(js_char(js, '{')) {
+        if(js_char(js, '}')) return true;
+        do {
+            if(!js_string(js, NULL, NULL) || !js_char(js, ':') ||
+                    !js_skip(js, depth + 1)) {
+                return false;
+            }
+        } while(js_char(js, ','));
+        return js_char(js, '}');
+    }
+    if(js_word(js, "true") || js_word(js, "false") || js_word(js, "null")) {
+        return true;
+    }
+    return js_number(js, &v);
+}
+
+static bool srv_push(SrvArray *a, double v) {
+    double *grow = NULL;
+    if(a->n == a->cap) {
+        a->cap = a->cap ? a->cap * 2 : 256;
+        grow = realloc(a->v, a->cap * sizeof(double));
+        if(!grow) return false;
+        a->v = grow;
+    }
+    a->v[a->n++] = v;
+    return true;
+}
+
+static bool js_numbers(SrvJson *js, SrvArray *a, int *count) {
+    /* A flat array of numbers, appended to a */
+    double v = 0;
+    *count = 0;
+    if(!js_char(js, '[')) return false;
+    if(js_char(js, ']')) return true;
+    do {
+        if(!js_number(js, &v) || !srv_push(a, v)) return false;
+        (*count)++;
+    } while(js_char(js, ','));
+    return js_char(js, ']');
+}
+
+static bool js_rows(SrvJson *js, SrvArray *a, int *rows, int *cols) {
+    /* An array of equal length number arrays, all appended to a */
+    int len = 0;
+    *rows = *cols = 0;
+    if(!js_char(js, '[')) return false;
+    if(js_char(js, ']')) return true;
+    do {
+        if(!js_numbers(js, a, &len)) return false;
+        if(*rows && len != *cols) return false;
+        *cols = len;
+        (*rows)++;
+    } while(js_char(js, ','));
+    return js_char(js, ']');
+}
+
+static const char* srv_check_coords(double *x, double *y, int n,
+        int metric) {
+    /* Why tsp_open_coords() would turn the cities down, for the client - NULL
+     * if it wouldn't */
+    TSP_Coords c = {n, x, y};
+    if(!(coord_tour_bound(&c, metric) <= INT_MAX)) {
+        return "coordinates too far apart, a tour could overflow";
+    }
+    return NULL;
+}
+
+static const char* srv_check_matrix(const int *dist, int n) {
+    /* Why tsp_open_matrix() would turn dist down, for the client - NULL if it
+     * wouldn't */
+    long bound = 0;
+    int i = 0, j = 0, worst = 0;
+    for(i = 0; i < n; i++) {
+        worst = 0;
+        for(j = 0; j < n; j++) {
+            if(dist[(size_t)i * n + j] != dist[(size_t)j * n + i]) {
+                return "the matrix isn't symmetric";
+            }
+            if(dist[(size_t)i * n + j] > worst) worst = dist[(size_t)i * n + j];
+        }
+        bound += worst;
+    }
+    if(bound > INT_MAX) return "distances too large, a tour could overflow";
+    return NULL;
+}
+
+static const char* srv_open_json(const char *line, const char *end,
+        SrvReq *req, int mode) {
+    /* Read one JSON request into req, returning why not if it can't be */
+    SrvJson js = {line, end};
+    SrvArray a = {NULL, 0, 0};
+    const char *key = NULL, *str = NULL, *err = NULL;
+    const char *id = NULL;
+    double *x = NULL;
+    int *dist = NULL;
+    int keylen = 0, len = 0, rows = 0, cols = 0, i = 0;
+    int metric = TSP_METRIC_EUC_2D;
+    bool coords = false, matrix = false;
+
+    if(!js_char(&js, '{')) return "request isn't a JSON object";
+    if(!js_char(&js, '}')) {
+        do {
+            if(!js_string(&js, &key, &keylen) || !js_char(&js, ':')) {
+                err = "bad JSON";
+                break;
+            }
+            if(keylen == 2 && memcmp(key, "id", 2) == 0) {
+                js_ws(&js);
+                id = js.p;
+                if(!js_skip(&js, 0)) {
+                    err = "bad JSON";
+                    break;
+                }
+                len = js.p - id;
+                if(len >= SRV_ID_MAX || *id == '{' || *id == '[') {
+                    err = "id must be a short number or string";
+                    break;
+                }
+                memcpy(req->id, id, len);
+                req->id[len] = '\0';
+            } else if(keylen == 6 && memcmp(key, "solver", 6) == 0) {
+                if(!js_string(&js, &str, &len)) {
+                    err = "solver must be a string";
+                    break;
+                }
+                for(i = 0; i < TSP_SOLVERS; i++) {
+                    if((int)strlen(tsp_solver_name(i)) == len &&
+                            memcmp(str, tsp_solver_name(i), len) == 0) {
+                        break;
+                    }
+                }
+                if(i == TSP_SOLVERS) {
+                    err = "unknown solver";
+                    break;
+                }
+                req->opt.solver = i;
+            } else if(keylen == 6 && memcmp(key, "metric", 6) == 0) {
+                if(!js_string(&js, &str, &len)) {
+                    err = "metric must be a string";
+                    break;
+                }
+                for(i = 0; i < (int)(sizeof(srv_metrics) /
+                            sizeof(srv_metrics[0])); i++) {
+                    if((int)strlen(srv_metrics[i].name) == len &&
+                            strncasecmp(str, srv_metrics[i].name, len) == 0) {
+                        break;
+                    }
+                }
+                if(i == (int)(sizeof(srv_metrics) / sizeof(srv_metrics[0]))) {
+                    err = "unknown metric";
+                    break;
+                }
+                metric = srv_metrics[i].metric;
+            } else if(keylen == 6 && memcmp(key, "coords", 6) == 0) {
+                a.n = 0;
+                if(!js_rows(&js, &a, &rows, &cols) ||
+                        (rows && cols != 2)) {
+                    err = "coords must be [[x, y], ...]";
+                    break;
+                }
+                coords = true;
+                matrix = false;
+            } else if(keylen == 6 && memcmp(key, "matrix", 6) == 0) {
+                a.n = 0;
+                if(!js_rows(&js, &a, &rows, &cols) || rows != cols) {
+                    err = "matrix must be n arrays of n numbers";
+                    break;
+                }
+                matrix = true;
+                coords = false;
+            } else if(!js_skip(&js, 0)) {
+                err = "bad JSON";
+                break;
+            }
+        } while(js_char(&js, ','));
+        if(!err && !js_char(&js, '}')) err = "bad JSON";
+    }
+    js_ws(&js);
+    if(!err && js.p != js.end) err = "junk after the request";
+    if(!err && !coords && !matrix) err = "no coords or matrix";
+    if(!err && rows == 0) err = "no cities";
+
+    if(!err && coords) {
+        // a holds x,y pairs - the library wants all the x's then the y's
+        x = malloc(2 * rows * sizeof(double));
+        if(x) {
+            for(i = 0; i < rows; i++) {
+                x[i] = a.v[2 * i];
+                x[rows + i] = a.v[2 * i + 1];
+            }
+            err = srv_check_coords(x, x + rows, rows, metric);
+            if(!err) req->h = tsp_open_coords(x, x + rows, rows, metric, mode);
+        }
+        if(!err && !req->h) err = "couldn't build the instance";
+    } else if(!err && matrix) {
+        dist = malloc((size_t)rows * rows * sizeof(int));
+        for(i = 0; dist && i < rows * rows; i++) {
+            if(a.v[i] < INT_MIN || a.v[i] > INT_MAX) break;
+            dist[i] = (int)a.v[i];
+        }
+        if(dist && i < rows * rows) err = "distance out of range";
+        else if(dist) err = srv_check_matrix(dist, rows);
+        if(dist && !err) req->h = tsp_open_matrix(dist, rows);
+        if(!err && !req->h) err = "couldn't build the instance";
+    }
+    free(x);
+    free(dist);
+    free(a.v);
+    return err;
+}
+
+/*****
+ * Binary requests
+ *****/
+
+static const char* srv_open_bin(const TSP_SrvRequest *hdr,
+        const char *payload, SrvReq *req, int mode) {
+    /* Build req's handle from a binary request. The payload isn't aligned
+     * (it's wherever it landed in the input buffer), so it's copied out. */
+    int n = hdr->n;
+    double *xy = NULL;
+    int *dist = NULL;
+    const char *err = NULL;
+    req->bin_id = hdr->id;
+    if(hdr->solver >= TSP_SOLVERS) return "unknown solver";
+    req->opt.solver = hdr->solver;
+    if(hdr->kind == SRV_COORDS) {
+        xy = malloc(2 * (size_t)n * sizeof(double));
+        if(!xy) return "out of memory";
+        memcpy(xy, payload, 2 * (size_t)n * sizeof(double));
+        err = srv_check_coords(xy, xy + n, n, hdr->metric);
+        if(!err) req->h = tsp_open_coords(xy, xy + n, n, hdr->metric, mode);
+        free(xy);
+        if(err) return err;
+    } else {
+        dist = malloc((size_t)n * n * sizeof(int));
+        if(!dist) return "out of memory";
+        memcpy(dist, payload, (size_t)n * n * sizeof(int));
+        err = srv_check_matrix(dist, n);
+        if(!err) req->h = tsp_open_matrix(dist, n);
+        free(dist);
+        if(err) return err;
+    }
+    return req->h ? NULL : "couldn't build the instance";
+}
+
+static size_t srv_bin_payload(const TSP_SrvRequest *hdr) {
+    /* Bytes after the header, 0 if the header is nonsense */
+    size_t n = hdr->n;
+    if(memcmp(hdr->magic, SRV_REQ_MAGIC, 4) != 0 || n == 0) return 0;
+    if(hdr->kind == SRV_COORDS) {
+        if(n > SRV_MAX_MSG / (2 * sizeof(double))) return 0;
+        return 2 * n * sizeof(double);
+    }
+    if(hdr->kind == SRV_MATRIX) {
+        if(n > 4096 || n * n > SRV_MAX_MSG / sizeof(int)) return 0;
+        return n * n * sizeof(int);
+    }
+    return 0;
+}
+
+/*****
+ * Connections
+ *****/
+
+static void srv_watch(Server *srv, SrvConn *c) {
+    /* Point epoll at what c is waiting for now */
+    struct epoll_event ev;
+    uint32_t events = 0;
+    if(c->dead) return;
+    if(!c->eof) events |= EPOLLIN;
+    if(c->out_pos < c->out.len) events |= EPOLLOUT;
+    if(events == c->events) return;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = c;
+    epoll_ctl(srv->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+    c->events = events;
+}
+
+static void srv_flush(Server *srv, SrvConn *c) {
+    /* Send as much of c's output as the socket will take */
+    ssize_t sent = 0;
+    while(!c->dead && c->out_pos < c->out.len) {
+        sent = send(c->fd, c->out.buf + c->out_pos, c->out.len - c->out_pos,
+                MSG_NOSIGNAL);
+        if(sent < 0) {
+            if(errno == EINTR) continue;
+            if(errno != EAGAIN && errno != EWOULDBLOCK) c->dead = true;
+            break;
+        }
+        c->out_pos += sent;
+    }
+    if(c->out_pos == c->out.len || c->dead) {
+        c->out.len = 0;
+        c->out_pos = 0;
+    }
+    srv_watch(srv, c);
+}
+
+static SrvReq* srv_queue(Server *srv, SrvConn *c, bool binary) {
+    /* The next free request in the queue, for c */
+    SrvReq *req = &srv->reqs[srv->nreqs++];
+    memset(req, 0, sizeof(SrvReq));
+    req->conn = c;
+    req->binary = binary;
+    req->opt = srv->opt;
+    c->pending++;
+    return req;
+}
+
+static void srv_parse(Server *srv, SrvConn *c) {
+    /* Queue every complete request in c's input (until the queue is full) */
+    TSP_SrvRequest hdr;
+    SrvReq *req = NULL;
+    char *p = c->in.buf;
+    char *end = c->in.buf + c->in.len;
+    char *nl = NULL;
+    size_t payload = 0;
+
+    while(!c->dead && srv->nreqs < SRV_BATCH) {
+        while(p < end && (*p == ' ' || *p == '\t' || *p == '\r' ||
+                    *p == '\n')) {
+            p++;
+        }
+        if(p == end) break;
+        if(*p == SRV_REQ_MAGIC[0]) {
+            if(end - p < (ssize_t)sizeof(hdr)) {
+                if(c->eof) {
+                    srv_queue(srv, c, true)->error = "truncated request";
+                    p = end;
+                }
+                break;
+            }
+            memcpy(&hdr, p, sizeof(hdr));
+            payload = srv_bin_payload(&hdr);
+            if(payload == 0) {
+                // No way to know where the next request starts
+                req = srv_queue(srv, c, true);
+                req->bin_id = hdr.id;
+                req->error = "bad binary request header";
+                c->eof = true;
+                p = end;
+                break;
+            }
+            if((size_t)(end - p) < sizeof(hdr) + payload) {
+                if(c->eof) {
+                    srv_queue(srv, c, true)->error = "truncated request";
+                    p = end;
+                }
+                break;
+            }
+            req = srv_queue(srv, c, true);
+            req->error = srv_open_bin(&hdr, p + sizeof(hdr), req, srv->mode);
+            p += sizeof(hdr) + payload;
+        } else {
+            nl = memchr(p, '\n', end - p);
+            if(!nl && c->eof) nl = end;
+            if(!nl) {
+                if(end - p > SRV_MAX_MSG) {
+                    srv_queue(srv, c, false)->error = "request too long";
+                    c->eof = true;
+                    p = end;
+                }
+                break;
+            }
+            req = srv_queue(srv, c, false);
+            req->error = srv_open_json(p, nl, req, srv->mode);
+            p = (nl < end) ? nl + 1 : end;
+        }
+    }
+    c->in.len = end - p;
+    if(c->in.len) memmove(c->in.buf, p, c->in.len);
+    srv_watch(srv, c);
+}
+
+static void srv_read(Server *srv, SrvConn *c) {
+    ssize_t got = 0;
+    if(!srv_reserve(&c->in, SRV_READ)) {
+        c->dead = true;
+        return;
+    }
+    got = read(c->fd, c->in.buf + c->in.len, SRV_READ);
+    if(got > 0) c->in.len += got;
+    else if(got == 0) c->eof = true;
+    else if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        c->dead = true;
+    }
+    srv_parse(srv, c);
+}
+
+static void srv_accept(Server *srv) {
+    /* Take every waiting client */
+    struct epoll_event ev;
+    SrvConn *c = NULL, **grow = NULL;
+    int fd = -1;
+    while((fd = accept4(srv->lfd, NULL, NULL,
+                    SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        if(srv->nconns == srv->capconns) {
+            grow = realloc(srv->conns,
+                    (srv->capconns ? srv->capconns * 2 : 16) *
+                    sizeof(SrvConn *));
+            if(!grow) {
+                close(fd);
+                continue;
+            }
+            srv->conns = grow;
+            srv->capconns = srv->capconns ? srv->capconns * 2 : 16;
+        }
+        c = calloc(1, sizeof(SrvConn));
+        if(!c) {
+            close(fd);
+            continue;
+        }
+        c->fd = fd;
+        c->events = EPOLLIN;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        if(epoll_ctl(srv->epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            close(fd);
+            free(c);
+            continue;
+        }
+        srv->conns[srv->nconns++] = c;
+    }
+}
+
+static void srv_reap(Server *srv) {
+    /* Close the clients that are done: hung up (or broken) with nothing left
+     * to answer or send */
+    SrvConn *c = NULL;
+    int i = 0;
+    while(i < srv->nconns) {
+        c = srv->conns[i];
+        if(c->pending > 0 || !(c->dead || (c->eof && c->out.len == 0))) {
+            i++;
+            continue;
+        }
+        close(c->fd); // Takes it out of the epoll set too
+        free(c->in.buf);
+        free(c->out.buf);
+        free(c);
+        srv->conns[i] = srv->conns[--srv->nconns];
+    }
+}
+
+/*****
+ * Batches
+ *****/
+
+static void srv_respond(SrvReq *req) {
+    /* Append the answer to req to its client's output */
+    SrvBuf *out = &req->conn->out;
+    TSP_SrvResponse resp;
+    TSP_Result *res = &req->res;
+    const char *err = req->error ? req->error : tsp_strerror(res->status);
+    bool ok = !req->error && res->status == TSP_OK;
+    int i = 0;
+
+    if(req->binary) {
+        memcpy(resp.magic, SRV_RESP_MAGIC, 4);
+        resp.id = req->bin_id;
+        resp.status = req->error ? TSP_ERR_ARG : res->status;
+        resp.solver = res->solver;
+        resp.cost = ok ? res->cost : 0;
+        resp.n = ok ? res->n : 0;
+        srv_append(out, &resp, sizeof(resp));
+        if(ok) srv_append(out, res->tour, res->n * sizeof(int));
+        return;
+    }
+    if(!ok) {
+        srv_printf(out, "{\"id\": %s, \"status\": \"error\", "
+                "\"error\": \"%s\"}\n", req->id[0] ? req->id : "null", err);
+        return;
+    }
+    srv_printf(out, "{\"id\": %s, \"status\": \"ok\", \"solver\": \"%s\", "
+            "\"cost\": %d, \"seconds\": %.6f, \"tour\": [",
+            req->id[0] ? req->id : "null", tsp_solver_name(res->solver),
+            res->cost, res->seconds);
+    if(!srv_reserve(out, (size_t)res->n * 13 + 3)) return;
+    for(i = 0; i < res->n; i++) {
+        out->len += sprintf(out->buf + out->len, i ? ", %d" : "%d",
+                res->tour[i]);
+    }
+    srv_append(out, "]}\n", 3);
+}
+
+static void srv_solve(Server *srv) {
+    /* Solve the queue, one pool batch per solver asked for, and answer it */
+    TSP_Options opt = srv->opt;
+    TSP_BatchStats bs;
+    double t0 = srv_now();
+    int s = 0, i = 0, k = 0, failed = 0;
+    SrvReq *req = NULL;
+
+    for(s = 0; s < TSP_SOLVERS; s++) {
+        k = 0;
+        for(i = 0; i < srv->nreqs; i++) {
+            if(srv->reqs[i].h && srv->reqs[i].opt.solver == (TSP_Solver)s) {
+                srv->handles[k] = srv->reqs[i].h;
+                srv->slot[k++] = i;
+            }
+        }
+        if(k == 0) continue;
+        opt.solver = s;
+        tsp_pool_solve(srv->pool, srv->handles, k, &opt, srv->results, &bs);
+        for(i = 0; i < k; i++) srv->reqs[srv->slot[i]].res = srv->results[i];
+    }
+
+    for(i = 0; i < srv->nreqs; i++) {
+        req = &srv->reqs[i];
+        if(req->error || req->res.status != TSP_OK) failed++;
+        if(!req->conn->dead) srv_respond(req);
+        tsp_free_result(&req->res);
+        tsp_close(req->h);
+        req->conn->pending--;
+    }
+    for(i = 0; i < srv->nconns; i++) {
+        if(srv->conns[i]->out.len) srv_flush(srv, srv->conns[i]);
+    }
+
+    t0 = srv_now() - t0;
+    if(srv->stats) {
+        fprintf(stderr, "serve: batch of %d, %d failed, %.3fs\n", srv->nreqs,
+                failed, t0);
+    }
+    srv->served += srv->nreqs;
+    srv->failed += failed;
+    srv->batches++;
+    srv->solving += t0;
+    srv->nreqs = 0;
+}
+
+static void srv_drain(Server *srv) {
+    /* Solve what's queued, then whatever was left waiting in the clients'
+     * input because the queue was full, until there's nothing complete left */
+    int i = 0;
+    while(srv->nreqs > 0) {
+        srv_solve(srv);
+        for(i = 0; i < srv->nconns && srv->nreqs < SRV_BATCH; i++) {
+            srv_parse(srv, srv->conns[i]);
+        }
+    }
+}
+
+/*****
+ * Setup and the event loop
+ *****/
+
+static int srv_listen(const char *path) {
+    /* A non-blocking socket listening on path. A stale socket left there by a
+     * server that didn't shut down is replaced; anything else isn't. */
+    struct sockaddr_un addr;
+    struct stat st;
+    int fd = -1;
+    if(strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        return -1;
+    }
+    if(stat(path, &st) == 0) {
+        if(!S_ISSOCK(st.st_mode)) {
+            fprintf(stderr, "%s exists and isn't a socket\n", path);
+            return -1;
+        }
+        unlink(path);
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+            listen(fd, SOMAXCONN) != 0) {
+        fprintf(stderr, "Can't listen on %s: %s\n", path, strerror(errno));
+        if(fd >= 0) close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool srv_init(Server *srv, const char *path, int jobs) {
+    struct epoll_event ev;
+    sigset_t mask;
+    srv->epfd = srv->lfd = srv->sfd = -1;
+    srv->reqs = malloc(SRV_BATCH * sizeof(SrvReq));
+    srv->handles = malloc(SRV_BATCH * sizeof(TSP_Handle *));
+    srv->results = malloc(SRV_BATCH * sizeof(TSP_Result));
+    srv->slot = malloc(SRV_BATCH * sizeof(int));
+
+    // SIGINT/SIGTERM come in through the epoll set as a clean shutdown. They
+    // have to be blocked before the pool starts, so its threads inherit that.
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+    srv->pool = tsp_pool_create(jobs);
+    if(!srv->reqs || !srv->handles || !srv->results || !srv->slot ||
+            !srv->pool) {
+        fprintf(stderr, "Failed to start the solver pool\n");
+        return false;
+    }
+    srv->sfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    srv->lfd = srv_listen(path);
+    srv->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if(srv->sfd < 0 || srv->lfd < 0 || srv->epfd < 0) return false;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = &srv->lfd;
+    if(epoll_ctl(srv->epfd, EPOLL_CTL_ADD, srv->lfd, &ev) != 0) return false;
+    ev.data.ptr = &srv->sfd;
+    return epoll_ctl(srv->epfd, EPOLL_CTL_ADD, srv->sfd, &ev) == 0;
+}
+
+static void srv_close(Server *srv, const char *path) {
+    int i = 0;
+    for(i = 0; i < srv->nconns; i++) {
+        close(srv->conns[i]->fd);
+        free(srv->conns[i]->in.buf);
+        free(srv->conns[i]->out.buf);
+        free(srv->conns[i]);
+    }
+    if(srv->lfd >= 0) {
+        close(srv->lfd);
+        unlink(path);
+    }
+    if(srv->sfd >= 0) close(srv->sfd);
+    if(srv->epfd >= 0) close(srv->epfd);
+    tsp_pool_destroy(srv->pool);
+    free(srv->conns);
+    free(srv->reqs);
+    free(srv->handles);
+    free(srv->results);
+    free(srv->slot);
+}
+
+int run_server(const char *path, const TSP_Options *opt, int mode, int jobs,
+        TSP_Cache *cache, bool stats) {
+    /* Serve solve requests on the Unix socket at path with jobs solver
+     * threads (0 for one per core) until SIGINT/SIGTERM. opt is the default
+     * for requests that don't pick a solver, mode the matrix for coordinate
+     * instances, and cache (if not NULL) is checked before solving anything.
+     * Returns the exit status. */
+    struct epoll_event events[SRV_MAX_EVENTS];
+    struct signalfd_siginfo sig;
+    Server srv;
+    SrvConn *c = NULL;
+    double t0 = srv_now();
+    int nev = 0, i = 0;
+    bool quit = false;
+
+    memset(&srv, 0, sizeof(Server));
+    srv.opt = *opt;
+    srv.mode = mode;
+    srv.stats = stats;
+    if(!srv_init(&srv, path, jobs)) {
+        srv_close(&srv, path);
+        return 1;
+    }
+    tsp_pool_set_cache(srv.pool, cache);
+    fprintf(stderr, "serve: listening on %s, %d threads\n", path,
+            tsp_pool_threads(srv.pool));
+
+    while(!quit) {
+        nev = epoll_wait(srv.epfd, events, SRV_MAX_EVENTS, -1);
+        if(nev < 0) {
+            if(errno == EINTR) continue;
+            fprintf(stderr, "epoll_wait: %s\n", strerror(errno));
+            break;
+        }
+        for(i = 0; i < nev; i++) {
+            if(events[i].data.ptr == &srv.lfd) {
+                srv_accept(&srv);
+            } else if(events[i].data.ptr == &srv.sfd) {
+                while(read(srv.sfd, &sig, sizeof(sig)) == sizeof(sig)) {
+                    quit = true;
+                }
+            } else {
+                c = events[i].data.ptr;
+                if(events[i].events & EPOLLERR) c->dead = true;
+                if(events[i].events & EPOLLOUT) srv_flush(&srv, c);
+                // A full queue is solved below, the rest can wait a round
+                if((events[i].events & (EPOLLIN | EPOLLHUP)) &&
+                        srv.nreqs < SRV_BATCH) {
+                    srv_read(&srv, c);
+                }
+            }
+        }
+        srv_drain(&srv);
+        srv_reap(&srv);
+    }
+
+    t0 = srv_now() - t0;
+    fprintf(stderr, "serve: %ld requests, %ld failed, %ld batches "
+            "(%.1f per batch), %.3fs solving, up %.1fs\n", srv.served,
+            srv.failed, srv.batches,
+            srv.batches ? (double)srv.served / srv.batches : 0.0,
+            srv.solving, t0);
+    srv_close(&srv, path);
+    return 0;
+}
@@ -388,7 +388,8 @@ SList* slist_load_dataset(char *fname, char d) {
             buf[i] = '\0';
             slist_push(&words, buf);
             i = 0;
-        } else { 
+        } else if(i < (int)sizeof(buf) - 1) { 
+            // Anything past the end of buf is dropped, not written off the end
             buf[i] = (char)in;
             i++;
         }
@@ -0,0 +1,222 @@
+/*
+* TSP
+* Copyright (C) Zach Wilder 2024
+*
+* This file is a part of TSP
+*
+* TSP is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* TSP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with TSP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <tsp.h>
+
+/* A uniform grid spatial index over Vec2i points (see spatialgrid.h). Like
+ * rect.c this only needs vec2i.h/rect.h, and could move to the toolbox. */
+
+static inline int sg_cell_x(const SpatialGrid *grid, int x) {
+    int c = (x - grid->bounds.pos.x) / grid->cell;
+    return (c < 0) ? 0 : (c >= grid->cols) ? grid->cols - 1 : c;
+}
+
+static inline int sg_cell_y(const SpatialGrid *grid, int y) {
+    int c = (y - grid->bounds.pos.y) / grid->cell;
+    return (c < 0) ? 0 : (c >= grid->rows) ? grid->rows - 1 : c;
+}
+
+static inline long long sg_dist(const SpatialGrid *grid, Vec2i a, Vec2i b) {
+    /* Distance in the grid's metric - squared for straight line, so compare
+     * against squared radii */
+    long long dx = (long long)a.x - b.x, dy = (long long)a.y - b.y;
+    if(grid->taxicab) return llabs(dx) + llabs(dy);
+    return dx * dx + dy * dy;
+}
+
+static inline long long sg_radius(const SpatialGrid *grid, long long r) {
+    /* r as a value sg_dist() can be compared with */
+    return grid->taxicab ? r : r * r;
+}
+
+SpatialGrid* create_SpatialGrid(const Vec2i *points, int n, int cell,
+        bool taxicab) {
+    /* Build a grid over n points. cell is the cell size; 0 picks one that puts
+     * about two points in each cell. */
+    SpatialGrid *grid = NULL;
+    int i = 0, c = 0, minx = INT_MAX, miny = INT_MAX;
+    int maxx = INT_MIN, maxy = INT_MIN;
+    long long cells = 0, area = 0;
+    if(!points || n <= 0) return NULL;
+    for(i = 0; i < n; i++) {
+        if(points[i].x < minx) minx = points[i].x;
+        if(points[i].x > maxx) maxx = points[i].x;
+        if(points[i].y < miny) miny = points[i].y;
+        if(points[i].y > maxy) maxy = points[i].y;
+    }
+    if(cell <= 0) {
+        area = ((long long)maxx - minx + 1) * ((long long)maxy - miny + 1);
+        cell = (int)sqrt(2.0 * area / n);
+        if(cell < 1) cell = 1;
+    }
+    grid = calloc(1, sizeof(SpatialGrid));
+    if(!grid) return NULL;
+    grid->bounds = make_rect(minx, miny, maxx - minx + 1, maxy - miny + 1);
+    grid->cell = cell;
+    grid->cols = (int)(((long long)maxx - minx) / cell + 1);
+    grid->rows = (int)(((long long)maxy - miny) / cell + 1);
+    grid->taxicab = taxicab;
+    grid->n = grid->live = n;
+    cells = (long long)grid->cols * grid->rows;
+    if(cells > INT_MAX - 1) {
+        tsp_log("Grid cell size %d is too small for these points!", cell);
+        free(grid);
+        return NULL;
+    }
+    grid->cell_start = calloc(cells + 1, sizeof(int));
+    grid->cell_len = calloc(cells, sizeof(int));
+    grid->pos = malloc(n * sizeof(Vec2i));
+    grid->id = malloc(n * sizeof(int));
+    grid->slot = malloc(n * sizeof(int));
+    if(!grid->cell_start || !grid->cell_len || !grid->pos || !grid->id ||
+            !grid->slot) {
+        tsp_log("Failed to allocate memory for grid!");
+        destroy_SpatialGrid(grid);
+        return NULL;
+    }
+
+    // Counting sort by cell: count, prefix sum, scatter
+    for(i = 0; i < n; i++) {
+        c = sg_cell_y(grid, points[i].y) * grid->cols +
+            sg_cell_x(grid, points[i].x);
+        grid->cell_len[c]++;
+    }
+    for(c = 0; c < cells; c++) {
+        grid->cell_start[c + 1] = grid->cell_start[c] + grid->cell_len[c];
+        grid->cell_len[c] = 0;
+    }
+    for(i = 0; i < n; i++) {
+        c = sg_cell_y(grid, points[i].y) * grid->cols +
+            sg_cell_x(grid, points[i].x);
+        grid->slot[i] = grid->cell_start[c] + grid->cell_len[c]++;
+        grid->pos[grid->slot[i]] = points[i];
+        grid->id[grid->slot[i]] = i;
+    }
+    return grid;
+}
+
+void destroy_SpatialGrid(SpatialGrid *grid) {
+    if(!grid) return;
+    free(grid->cell_start);
+    free(grid->cell_len);
+    free(grid->pos);
+    free(grid->id);
+    free(grid->slot);
+    free(grid);
+}
+
+bool remove_SpatialGrid(SpatialGrid *grid, int id) {
+    /* Take point id out of the grid - O(1), it swaps places with the last point
+     * in its cell. Returns false if it was already gone. */
+    int s = 0, last = 0, c = 0;
+    Vec2i p;
+    if(id < 0 || id >= grid->n) return false;
+    s = grid->slot[id];
+    p = grid->pos[s];
+    c = sg_cell_y(grid, p.y) * grid->cols + sg_cell_x(grid, p.x);
+    if(s >= grid->cell_start[c] + grid->cell_len[c]) return false;
+    last = grid->cell_start[c] + --grid->cell_len[c];
+    grid->pos[s] = grid->pos[last];
+    grid->id[s] = grid->id[last];
+    grid->slot[grid->id[s]] = s;
+    grid->pos[last] = p;
+    grid->id[last] = id;
+    grid->slot[id] = last;
+    grid->live--;
+    return true;
+}
+
+int radius_SpatialGrid(const SpatialGrid *grid, Vec2i p, int r, int *out,
+        int max) {
+    /* Every point within r of p. Up to max of their ids go in out; returns how
+     * many there are in total (which can be more than max). */
+    int x0 = sg_cell_x(grid, p.x - r), x1 = sg_cell_x(grid, p.x + r);
+    int y0 = sg_cell_y(grid, p.y - r), y1 = sg_cell_y(grid, p.y + r);
+    int cx = 0, cy = 0, c = 0, i = 0, found = 0;
+    long long lim = sg_radius(grid, r);
+    for(cy = y0; cy <= y1; cy++) {
+        for(cx = x0; cx <= x1; cx++) {
+            c = cy * grid->cols + cx;
+            for(i = grid->cell_start[c];
+                    i < grid->cell_start[c] + grid->cell_len[c]; i++) {
+                if(sg_dist(grid, grid->pos[i], p) > lim) continue;
+                if(found < max) out[found] = grid->id[i];
+                found++;
+            }
+        }
+    }
+    return found;
+}
+
+static int sg_nearest(const SpatialGrid *grid, Vec2i p, int exclude,
+        const bool *visited) {
+    /*
+     * Search outwards from p's cell one ring of cells at a time. Every cell in
+     * ring r+1 is at least r cells away along x or y, and both metrics are at
+     * least that far, so once the best so far is within r * cell there's no
+     * need to look further out.
+     */
+    int cx = sg_cell_x(grid, p.x), cy = sg_cell_y(grid, p.y);
+    int maxr = (grid->cols > grid->rows) ? grid->cols : grid->rows;
+    int r = 0, x = 0, y = 0, c = 0, i = 0, step = 0, best = -1;
+    long long d = 0, bestd = LLONG_MAX;
+    if(grid->live == 0) return -1;
+    for(r = 0; r <= maxr; r++) {
+        for(y = cy - r; y <= cy + r; y++) {
+            if(y < 0 || y >= grid->rows) continue;
+            // Whole rows at the top and bottom of the ring, just the two ends
+            // in between
+            step = (y == cy - r || y == cy + r) ? 1 : 2 * r;
+            for(x = cx - r; x <= cx + r; x += step) {
+                if(x < 0 || x >= grid->cols) continue;
+                c = y * grid->cols + x;
+                for(i = grid->cell_start[c];
+                        i < grid->cell_start[c] + grid->cell_len[c]; i++) {
+                    if(grid->id[i] == exclude) continue;
+                    if(visited && visited[grid->id[i]]) continue;
+                    d = sg_dist(grid, grid->pos[i], p);
+                    // Ties go to the lowest id, so the answer doesn't depend
+                    // on what order the cells were filled in
+                    if(d < bestd || (d == bestd && grid->id[i] < best)) {
+                        bestd = d;
+                        best = grid->id[i];
+                    }
+                }
+            }
+        }
+        if(best >= 0 && bestd < sg_radius(grid, (long long)r * grid->cell)) {
+            break;
+        }
+    }
+    return best;
+}
+
+int nearest_SpatialGrid(const SpatialGrid *grid, Vec2i p, int exclude) {
+    /* Closest point to p that hasn't been removed (other than exclude, -1 to
+     * allow any). -1 if there's nothing left. */
+    return sg_nearest(grid, p, exclude, NULL);
+}
+
+int nearest_unvisited_SpatialGrid(const SpatialGrid *grid, Vec2i p,
+        const bool *visited) {
+    /* Closest point to p that hasn't been removed and isn't marked in visited
+     * (indexed by id). Removing visited points as they're used keeps this
+     * fast; visited is for grids that are shared and can't be changed. */
+    return sg_nearest(grid, p, -1, visited);
+}
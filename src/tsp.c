@@ -19,31 +19,137 @@
 */
 #include <tsp.h>
 
-TSP_Path* make_tsp_path(int path[SIZE + 1], int cost) {
+TSP_Path* make_tsp_path(const int *path, int n, int cost) {
+    /* Copy the first n nodes of path into a new TSP_Path, and close the tour by
+     * setting path[n] back to the start */
     TSP_Path *newpath = malloc(sizeof(TSP_Path));
+    if(!newpath) return NULL;
+    newpath->path = malloc((n + 1) * sizeof(int));
+    if(!newpath->path) {
+        free(newpath);
+        return NULL;
+    }
     
     int i = 0;
-    for(i = 0; i < (SIZE + 1); i++) {
+    for(i = 0; i < n; i++) {
         newpath->path[i] = path[i];
     }
+    newpath->path[n] = path[0];
 
+    newpath->n = n;
     newpath->cost = cost;
     return newpath;
 }
 
 void destroy_tsp_path(TSP_Path *path) {
     if(path) {
+        if(path->path) {
+            free(path->path);
+        }
         free(path);
     }
 }
 
+double stop_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void stop_init(TSP_Stop *s, const TSP_Options *opt) {
+    /* A stop token for one solve under opt (which can be NULL) */
+    memset(s, 0, sizeof(TSP_Stop));
+    atomic_init(&s->stop, false);
+    s->start = stop_now();
+    if(!opt) return;
+    if(opt->time_limit > 0) s->deadline = s->start + opt->time_limit;
+    s->cancel = opt->cancel;
+    s->progress = opt->progress;
+    s->arg = opt->progress_arg;
+}
+
+bool stop_check(const TSP_Stop *s) {
+    /* tsp_stopped() past the fast check: is it time to stop? Sets s->stop if
+     * so, which is why the const is cast away - a TSP_Stop is only ever
+     * 'const' to the solvers, which mustn't stop it themselves. */
+    bool stop = false;
+    if(s->cancel && atomic_load(&((TSP_Cancel *)s->cancel)->cancelled)) {
+        stop = true;
+    } else if(s->parent && tsp_stopped(s->parent)) {
+        stop = true;
+    } else if(s->deadline > 0 && stop_now() >= s->deadline) {
+        stop = true;
+    }
+    if(stop) atomic_store(&((TSP_Stop *)s)->stop, true);
+    return stop;
+}
+
+void stop_progress(const TSP_Stop *s, TSP_Solver solver, double done,
+        int best) {
+    /* Tell the caller's progress callback (if there is one) where s's solve
+     * has got to */
+    TSP_Progress p;
+    if(!s || !s->progress) return;
+    p.solver = solver;
+    p.done = done;
+    p.best = best;
+    p.seconds = stop_now() - s->start;
+    s->progress(&p, s->arg);
+}
+
+TSP_Workspace* create_workspace(void) {
+    /* An empty workspace, buffers are allocated by workspace_reserve() */
+    return calloc(1, sizeof(TSP_Workspace));
+}
+
+void destroy_workspace(TSP_Workspace *ws) {
+    if(!ws) return;
+    free(ws->dp);
+    free(ws->prev);
+    free(ws->visited);
+    free(ws->path);
+    free(ws);
+}
+
+bool workspace_reserve(TSP_Workspace *ws, int n, bool hk) {
+    /* Make sure ws has room for an n city instance (and the Held-Karp table if
+     * hk). Buffers keep their size between instances, so after the biggest
+     * one this never allocates again. */
+    bool *visited = NULL;
+    int *path = NULL;
+    size_t cells = 0;
+    if(n > ws->n) {
+        visited = realloc(ws->visited, n * sizeof(bool));
+        if(!visited) return false;
+        ws->visited = visited;
+        path = realloc(ws->path, (n + 1) * sizeof(int));
+        if(!path) return false;
+        ws->path = path;
+        ws->n = n;
+    }
+    if(hk && n > ws->hk_n) {
+        if(n > HK_MAX_N) return false;
+        // The old table is garbage either way, no point copying it
+        free(ws->dp);
+        free(ws->prev);
+        cells = ((size_t)1 << n) * n;
+        ws->dp = malloc(cells * sizeof(int));
+        ws->prev = malloc(cells * sizeof(int));
+        ws->hk_n = n;
+        if(!ws->dp || !ws->prev) {
+            free(ws->dp);
+            free(ws->prev);
+            ws->dp = ws->prev = NULL;
+            ws->hk_n = 0;
+            return false;
+        }
+    }
+    return true;
+}
+
 TSP_Data* init_tsp_data(void) {
-    int i = 0;
     TSP_Data *data = malloc(sizeof(TSP_Data));
-    data->dist = malloc(SIZE * sizeof(int *));
-    for(i = 0; i < SIZE; i++) {
-        data->dist[i] = malloc(SIZE * sizeof(int));
-    }
+    data->dist = create_dist_matrix(SIZE);
     data->hk_path = NULL;
     data->nn_path = NULL;
     data->pos = -1;
@@ -51,16 +157,8 @@ TSP_Data* init_tsp_data(void) {
 }
 
 void destroy_tsp_data(TSP_Data *data) {
-    int i = 0;
     if(!data) return;
-    if(data->dist) {
-        for(i = 0; i < SIZE; i++) {
-            if(data->dist[i]) {
-                free(data->dist[i]);
-            }
-        }
-        free(data->dist);
-    }
+    destroy_dist_matrix(data->dist);
     destroy_tsp_path(data->hk_path);
     destroy_tsp_path(data->nn_path);
 
@@ -0,0 +1,558 @@
+/*
+* TSP
+* Copyright (C) Zach Wilder 2024
+*
+* This file is a part of TSP
+*
+* TSP is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* TSP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with TSP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <tsp.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*****
+ * TSPLIB reader
+ *
+ * Reads the TSPLIB format (http://comopt.ifi.uni-heidelberg.de/software/TSPLIB95/)
+ * used by most published TSP instances. The whole file is mapped (or read, for
+ * pipes) into one buffer and walked with a pointer - no line buffers, no
+ * per-token allocations - and numbers go straight into the TSP_Coords arrays or
+ * the DistMatrix.
+ *
+ * Supported:
+ *  - EDGE_WEIGHT_TYPE: EUC_2D, CEIL_2D, MAN_2D, GEO, ATT, EXPLICIT
+ *  - EDGE_WEIGHT_FORMAT: FULL_MATRIX, UPPER_ROW, LOWER_ROW, UPPER_DIAG_ROW,
+ *    LOWER_DIAG_ROW and the matching _COL formats
+ *  - NODE_COORD_SECTION, EDGE_WEIGHT_SECTION. Other sections
+ *    (DISPLAY_DATA_SECTION etc) are skipped.
+ *  - TYPE : TSP only. ATSP files, and FULL_MATRIX tables that aren't
+ *    symmetric, are turned down.
+ *****/
+
+typedef enum {
+    EWF_FULL_MATRIX     = 0,
+    EWF_UPPER_ROW       = 1,
+    EWF_LOWER_ROW       = 2,
+    EWF_UPPER_DIAG_ROW  = 3,
+    EWF_LOWER_DIAG_ROW  = 4
+} EdgeWeightFormat;
+
+typedef struct {
+    const char *p;      // Current position
+    const char *end;    // One past the last byte
+} TSPLIB_Reader;
+
+static const double pow10_tbl[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13,
+    1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static void rd_skip_space(TSPLIB_Reader *r) {
+    /* Skip spaces, tabs and newlines */
+    while(r->p < r->end && (*r->p == ' ' || *r->p == '\t' ||
+                *r->p == '\n' || *r->p == '\r')) {
+        r->p++;
+    }
+}
+
+static void rd_skip_line(TSPLIB_Reader *r) {
+    while(r->p < r->end && *r->p != '\n') {
+        r->p++;
+    }
+    if(r->p < r->end) r->p++;
+}
+
+static bool rd_at_keyword(TSPLIB_Reader *r) {
+    /* Sections end where the next keyword (or EOF) starts */
+    rd_skip_space(r);
+    return (r->p >= r->end) || (*r->p >= 'A' && *r->p <= 'Z');
+}
+
+static bool rd_number(TSPLIB_Reader *r, double *out) {
+    /* Parse a decimal number ([-]123.456e-7) at the reader position. Up to 19
+     * significant digits are collected in an integer and scaled once at the end,
+     * which is exact for the integer and short decimal values TSPLIB files are
+     * full of. Anything stranger goes to strtod. */
+    const char *p, *start;
+    uint64_t mant = 0;
+    int digits = 0, scale = 0, ex = 0, exsign = 1;
+    bool neg = false;
+    double v;
+    char tmp[64];
+    rd_skip_space(r);
+    p = start = r->p;
+    if(p < r->end && (*p == '-' || *p == '+')) {
+        neg = (*p == '-');
+        p++;
+    }
+    if(p >= r->end || !((*p >= '0' && *p <= '9') || *p == '.')) return false;
+    while(p < r->end && *p >= '0' && *p <= '9') {
+        if(digits < 19) {
+            mant = mant * 10 + (*p - '0');
+            digits++;
+        } else {
+            scale++; // Too many digits, drop them and scale up instead
+        }
+        p++;
+    }
+    if(p < r->end && *p == '.') {
+        p++;
+        while(p < r->end && *p >= '0' && *p <= '9') {
+            if(digits < 19) {
+                mant = mant * 10 + (*p - '0');
+                digits++;
+                scale--;
+            }
+            p++;
+        }
+    }
+    if(p < r->end && (*p == 'e' || *p == 'E')) {
+        p++;
+        if(p < r->end && (*p == '-' || *p == '+')) {
+            exsign = (*p == '-') ? -1 : 1;
+            p++;
+        }
+        while(p < r->end && *p >= '0' && *p <= '9') {
+            if(ex < 10000) ex = ex * 10 + (*p - '0');
+            p++;
+        }
+        scale += exsign * ex;
+    }
+    r->p = p;
+    v = (double)mant;
+    if(scale >= -22 && scale <= 22) {
+        v = (scale < 0) ? v / pow10_tbl[-scale] : v * pow10_tbl[scale];
+    } else {
+        // Way out of range of the table, let libc handle it
+        if((size_t)(p - start) >= sizeof(tmp)) return false;
+        memcpy(tmp, start, p - start);
+        tmp[p - start] = '\0';
+        v = strtod(tmp, NULL);
+        neg = false;
+    }
+    *out = neg ? -v : v;
+    return true;
+}
+
+static bool rd_int(TSPLIB_Reader *r, int *out) {
+    /* Parse an integer - this is the hot path for EDGE_WEIGHT_SECTION */
+    const char *p;
+    long v = 0;
+    bool neg = false;
+    double d;
+    rd_skip_space(r);
+    p = r->p;
+    if(p < r->end && (*p == '-' || *p == '+')) {
+        neg = (*p == '-');
+        p++;
+    }
+    if(p >= r->end || *p < '0' || *p > '9') return false;
+    while(p < r->end && *p >= '0' && *p <= '9') {
+        v = v * 10 + (*p - '0');
+        p++;
+        if(v > INT_MAX) return false;
+    }
+    if(p < r->end && (*p == '.' || *p == 'e' || *p == 'E')) {
+        // Some files write weights as floats, round them like TSPLIB does
+        if(!rd_number(r, &d)) return false;
+        *out = (int)(d + (d < 0 ? -0.5 : 0.5));
+        return true;
+    }
+    r->p = p;
+    *out = neg ? (int)-v : (int)v;
+    return true;
+}
+
+static int rd_keyword(TSPLIB_Reader *r, char *key, int keysz, char *val,
+        int valsz) {
+    /* Read "KEY : VALUE" or a bare "KEY" (section names). Returns 1 for a
+     * keyword with a value, 0 for a bare keyword, -1 at the end of the buffer.
+     * key/val are trimmed. */
+    int i = 0;
+    rd_skip_space(r);
+    if(r->p >= r->end) return -1;
+    while(r->p < r->end && *r->p != ':' && *r->p != '\n' && *r->p != ' ' &&
+            *r->p != '\t' && *r->p != '\r') {
+        if(i < keysz - 1) key[i++] = *r->p;
+        r->p++;
+    }
+    key[i] = '\0';
+    while(r->p < r->end && (*r->p == ' ' || *r->p == '\t')) r->p++;
+    val[0] = '\0';
+    if(r->p >= r->end || *r->p != ':') {
+        rd_skip_line(r);
+        return 0;
+    }
+    r->p++; // ':'
+    while(r->p < r->end && (*r->p == ' ' || *r->p == '\t')) r->p++;
+    i = 0;
+    while(r->p < r->end && *r->p != '\n' && *r->p != '\r') {
+        if(i < valsz - 1) val[i++] = *r->p;
+        r->p++;
+    }
+    while(i > 0 && (val[i - 1] == ' ' || val[i - 1] == '\t')) i--;
+    val[i] = '\0';
+    rd_skip_line(r);
+    return 1;
+}
+
+static int tsplib_metric(const char *val) {
+    if(strcmp(val, "EUC_2D") == 0) return METRIC_EUC_2D;
+    if(strcmp(val, "CEIL_2D") == 0) return METRIC_CEIL_2D;
+    if(strcmp(val, "MAN_2D") == 0) return METRIC_MAN_2D;
+    if(strcmp(val, "GEO") == 0) return METRIC_GEO;
+    if(strcmp(val, "ATT") == 0) return METRIC_ATT;
+    if(strcmp(val, "EXPLICIT") == 0) return METRIC_EXPLICIT;
+    return -1;
+}
+
+static int tsplib_format(const char *val) {
+    /* For a symmetric matrix the column formats are the row formats of the
+     * other triangle */
+    if(strcmp(val, "FULL_MATRIX") == 0) return EWF_FULL_MATRIX;
+    if(strcmp(val, "UPPER_ROW") == 0) return EWF_UPPER_ROW;
+    if(strcmp(val, "LOWER_COL") == 0) return EWF_UPPER_ROW;
+    if(strcmp(val, "LOWER_ROW") == 0) return EWF_LOWER_ROW;
+    if(strcmp(val, "UPPER_COL") == 0) return EWF_LOWER_ROW;
+    if(strcmp(val, "UPPER_DIAG_ROW") == 0) return EWF_UPPER_DIAG_ROW;
+    if(strcmp(val, "LOWER_DIAG_COL") == 0) return EWF_UPPER_DIAG_ROW;
+    if(strcmp(val, "LOWER_DIAG_ROW") == 0) return EWF_LOWER_DIAG_ROW;
+    if(strcmp(val, "UPPER_DIAG_COL") == 0) return EWF_LOWER_DIAG_ROW;
+    return -1;
+}
+
+static bool tsplib_read_coords(TSPLIB_Reader *r, TSP_Coords *c) {
+    /* NODE_COORD_SECTION - "id x y" per node, ids 1..n, each exactly once
+     * (in any order) */
+    double id, x, y;
+    int count = 0;
+    bool ok = true;
+    char *seen = calloc(c->n, 1);
+    if(!seen) return false;
+    while(ok && !rd_at_keyword(r)) {
+        if(!rd_number(r, &id) || !rd_number(r, &x) || !rd_number(r, &y)) {
+            ok = false;
+            break;
+        }
+        ok = (id >= 1 && id <= c->n && id == floor(id) && !seen[(int)id - 1]);
+        if(!ok) break;
+        seen[(int)id - 1] = 1;
+        c->x[(int)id - 1] = x;
+        c->y[(int)id - 1] = y;
+        // Skip a z coordinate (NODE_COORD_TYPE : THREED_COORDS) if there is one
+        while(r->p < r->end && (*r->p == ' ' || *r->p == '\t')) r->p++;
+        if(r->p < r->end && *r->p != '\n' && *r->p != '\r') rd_skip_line(r);
+        count++;
+    }
+    free(seen);
+    // n distinct ids in 1..n means none are missing
+    return ok && (count == c->n);
+}
+
+static bool tsplib_read_weights(TSPLIB_Reader *r, DistMatrix *m, int format) {
+    /* EDGE_WEIGHT_SECTION - a stream of numbers, in the order format says */
+    int n = m->n;
+    int i, j, d;
+    int *out = NULL;
+    switch(format) {
+        case EWF_FULL_MATRIX:
+            for(i = 0; i < n; i++) {
+                out = dm_row(m, i);
+                for(j = 0; j < n; j++) {
+                    if(!rd_int(r, &out[j])) return false;
+                }
+            }
+            break;
+        case EWF_UPPER_DIAG_ROW:
+            // This is exactly the DM_SYMMETRIC layout, numbers go straight in
+            for(i = 0; i < n; i++) {
+                out = m->data + dm_sym_index(n, i, i);
+                for(j = 0; j < n - i; j++) {
+                    if(!rd_int(r, &out[j])) return false;
+                }
+            }
+            break;
+        case EWF_UPPER_ROW:
+            for(i = 0; i < n; i++) {
+                out = m->data + dm_sym_index(n, i, i);
+                out[0] = 0;
+                for(j = 1; j < n - i; j++) {
+                    if(!rd_int(r, &out[j])) return false;
+                }
+            }
+            break;
+        case EWF_LOWER_ROW:
+        case EWF_LOWER_DIAG_ROW:
+            for(i = 0; i < n; i++) {
+                for(j = 0; j < i; j++) {
+                    if(!rd_int(r, &d)) return false;
+                    dm_set(m, i, j, d);
+                }
+                if(format == EWF_LOWER_DIAG_ROW) {
+                    if(!rd_int(r, &d)) return false;
+                    dm_set(m, i, i, d);
+                }
+            }
+            break;
+        default:
+            return false;
+    }
+    return true;
+}
+
+TSP_Instance* parse_tsplib(const char *buf, size_t len, int mode) {
+    /* Parse a TSPLIB file held in buf. For coordinate instances, mode is the
+     * DistMatrixMode to build (see create_instance_coords). Explicit instances
+     * are DM_FULL for FULL_MATRIX and DM_SYMMETRIC for the triangular
+     * formats. */
+    TSPLIB_Reader r;
+    char key[64], val[128];
+    int kind, n = 0, metric = -1, format = EWF_FULL_MATRIX;
+    TSP_Coords *coords = NULL;
+    DistMatrix *dist = NULL;
+    TSP_Instance *inst = NULL;
+    const char *why = NULL;
+    bool ok = true;
+    r.p = buf;
+    r.end = buf + len;
+
+    while(ok && (kind = rd_keyword(&r, key, sizeof(key), val, sizeof(val))) >= 0) {
+        if(kind == 1) {
+            if(strcmp(key, "DIMENSION") == 0) {
+                n = atoi(val);
+                ok = (n > 0);
+            } else if(strcmp(key, "EDGE_WEIGHT_TYPE") == 0) {
+                metric = tsplib_metric(val);
+                ok = (metric >= 0);
+            } else if(strcmp(key, "EDGE_WEIGHT_FORMAT") == 0) {
+                format = tsplib_format(val);
+                ok = (format >= 0);
+            } else if(strcmp(key, "TYPE") == 0) {
+                // Not ATSP - the solvers past HK/NN need dist(i,j) ==
+                // dist(j,i) (see dm_is_symmetric())
+                ok = (strcmp(val, "TSP") == 0);
+                if(!ok) why = "only symmetric TSP is supported";
+            }
+            // NAME, COMMENT, etc don't matter here
+        } else if(strcmp(key, "NODE_COORD_SECTION") == 0) {
+            ok = (n > 0) && !coords;
+            if(ok) coords = create_coords(n);
+            ok = ok && coords && tsplib_read_coords(&r, coords);
+        } else if(strcmp(key, "EDGE_WEIGHT_SECTION") == 0) {
+            ok = (n > 0) && !dist;
+            if(ok) {
+                dist = (format == EWF_FULL_MATRIX) ? create_dist_matrix(n) :
+                    create_sym_dist_matrix(n);
+            }
+            ok = ok && dist && tsplib_read_weights(&r, dist, format);
+            if(ok && !dm_is_symmetric(dist)) {
+                ok = false;
+                why = "the matrix isn't symmetric";
+            }
+            if(ok && dm_tour_bound(dist) > INT_MAX) {
+                ok = false;
+                why = "distances too large, a tour could overflow";
+            }
+        } else if(strcmp(key, "EOF") == 0) {
+            break;
+        } else {
+            // Some other section - skip its data
+            while(!rd_at_keyword(&r)) rd_skip_line(&r);
+        }
+    }
+
+    if(ok && metric == METRIC_EXPLICIT && dist) {
+        inst = create_instance_matrix(dist);
+        dist = NULL;
+        if(inst && coords) {
+            // Explicit instances sometimes carry coordinates for drawing,
+            // keep them (they don't change the distances)
+            inst->coords = coords;
+            coords = NULL;
+        }
+    } else if(ok && metric >= 0 && metric != METRIC_EXPLICIT && coords) {
+        // The metric is what says how far apart they are, so this can't be
+        // checked as they're read
+        if(coord_tour_bound(coords, metric) <= INT_MAX) {
+            inst = create_instance_coords(coords, metric, mode);
+            if(inst) coords = NULL;
+        } else {
+            why = "coordinates too far apart, a tour could overflow";
+        }
+    }
+    if(!inst) {
+        tsp_log("Failed to parse TSPLIB data (%s)!",
+                why ? why : (ok ? "incomplete" : key));
+    }
+    destroy_dist_matrix(dist);
+    destroy_coords(coords);
+    return inst;
+}
+
+TSP_Instance* load_instance_tsplib(const char *fname, int mode) {
+    /* Map a TSPLIB file and parse it. Falls back to read() for things that
+     * can't be mapped (pipes, /dev/stdin). */
+    TSP_Instance *inst = NULL;
+    struct stat st;
+    char *buf = NULL, *tmp = NULL;
+    size_t len = 0, cap = 0;
+    ssize_t got;
+    int fd = open(fname, O_RDONLY);
+    if(fd < 0) return NULL;
+    if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(buf != MAP_FAILED) {
+            madvise(buf, st.st_size, MADV_SEQUENTIAL);
+            close(fd);
+            inst = parse_tsplib(buf, st.st_size, mode);
+            munmap(buf, st.st_size);
+            return inst;
+        }
+        buf = NULL;
+    }
+    // Not mappable, read it in big chunks
+    cap = 1 << 20;
+    buf = malloc(cap);
+    while(buf) {
+        if(len == cap) {
+            cap *= 2;
+            tmp = realloc(buf, cap);
+            if(!tmp) break;
+            buf = tmp;
+        }
+        got = read(fd, buf + len, cap - len);
+        if(got <= 0) {
+            inst = parse_tsplib(buf, len, mode);
+            break;
+        }
+        len += got;
+    }
+    free(buf);
+    close(fd);
+    return inst;
+}
+
+/*****
+ * TSPLIB writer
+ *
+ * Lines are put together in a buffer by hand and written out a block at a
+ * time - printf()'s parsing of the format for each of millions of numbers
+ * costs more than the disk does. Whole numbers (all generated instances) are
+ * written as integers, anything else with %.17g so it reads back exactly.
+ *****/
+#define TSPLIB_WBUF (1 << 20)
+
+typedef struct {
+    FILE *f;
+    char *buf;
+    size_t len;
+    bool ok;
+} TSPLIB_Writer;
+
+static void wr_flush(TSPLIB_Writer *w) {
+    if(w->len && fwrite(w->buf, 1, w->len, w->f) != w->len) w->ok = false;
+    w->len = 0;
+}
+
+static void wr_number(TSPLIB_Writer *w, double v) {
+    /* v and a space (the caller swaps the last one for a newline) */
+    char tmp[32];
+    long long k = 0;
+    int len = 0;
+    if(TSPLIB_WBUF - w->len < 64) wr_flush(w);
+    if(v == floor(v) && fabs(v) < 1e15) {
+        k = (long long)v;
+        if(k < 0) w->buf[w->len++] = '-';
+        if(k < 0) k = -k;
+        do {
+            tmp[len++] = '0' + k % 10;
+            k /= 10;
+        } while(k);
+        while(len) w->buf[w->len++] = tmp[--len];
+    } else {
+        w->len += snprintf(w->buf + w->len, 32, "%.17g", v);
+    }
+    w->buf[w->len++] = ' ';
+}
+
+static void wr_end_line(TSPLIB_Writer *w) {
+    if(w->len) w->buf[w->len - 1] = '\n';
+}
+
+static const char* tsplib_metric_name(int metric) {
+    switch(metric) {
+        case METRIC_EUC_2D: return "EUC_2D";
+        case METRIC_CEIL_2D: return "CEIL_2D";
+        case METRIC_MAN_2D: return "MAN_2D";
+        case METRIC_GEO: return "GEO";
+        case METRIC_ATT: return "ATT";
+        default: return "EXPLICIT";
+    }
+}
+
+bool save_instance_tsplib(const TSP_Instance *inst, const char *fname,
+        const char *name) {
+    /* Write inst to fname ("-" for stdout) as TSPLIB: a NODE_COORD_SECTION
+     * if it has coordinates, else the matrix as an EXPLICIT FULL_MATRIX.
+     * name goes in the NAME line (NULL for fname's). */
+    TSPLIB_Writer w;
+    const char *base = NULL;
+    bool coords = false;
+    int i = 0, j = 0;
+    if(!inst || !fname) return false;
+    coords = inst->coords && inst->metric != METRIC_EXPLICIT;
+    if(!coords && !inst->dist) return false;
+    if(!name) {
+        base = strrchr(fname, '/');
+        name = base ? base + 1 : fname;
+    }
+    w.f = (strcmp(fname, "-") == 0) ? stdout : fopen(fname, "w");
+    w.buf = malloc(TSPLIB_WBUF);
+    w.len = 0;
+    w.ok = (w.f && w.buf);
+    if(w.ok) {
+        w.len = snprintf(w.buf, TSPLIB_WBUF, "NAME : %s\nTYPE : TSP\n"
+                "DIMENSION : %d\nEDGE_WEIGHT_TYPE : %s\n", name, inst->n,
+                coords ? tsplib_metric_name(inst->metric) : "EXPLICIT");
+        if(coords) {
+            w.len += snprintf(w.buf + w.len, 64, "NODE_COORD_SECTION\n");
+            for(i = 0; i < inst->n; i++) {
+                wr_number(&w, i + 1);
+                wr_number(&w, inst->coords->x[i]);
+                wr_number(&w, inst->coords->y[i]);
+                wr_end_line(&w);
+            }
+        } else {
+            w.len += snprintf(w.buf + w.len, 64, "EDGE_WEIGHT_FORMAT : "
+                    "FULL_MATRIX\nEDGE_WEIGHT_SECTION\n");
+            for(i = 0; i < inst->n; i++) {
+                for(j = 0; j < inst->n; j++) {
+                    wr_number(&w, dm_get(inst->dist, i, j));
+                }
+                wr_end_line(&w);
+            }
+        }
+        if(TSPLIB_WBUF - w.len < 8) wr_flush(&w);
+        w.len += snprintf(w.buf + w.len, 8, "EOF\n");
+        wr_flush(&w);
+    }
+    free(w.buf);
+    if(w.f && w.f != stdout) {
+        if(fclose(w.f) != 0) w.ok = false;
+    } else if(w.f) {
+        if(fflush(w.f) != 0) w.ok = false;
+    }
+    return w.ok;
+}
@@ -0,0 +1,218 @@
+/*
+* TSP
+* Copyright (C) Zach Wilder 2024
+*
+* This file is a part of TSP
+*
+* TSP is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* TSP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with TSP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <tsp.h>
+
+static void reverse_segment(int *t, int *pos, int n, int i, int j) {
+    /* Reverse the stretch of tour from position i forward to position j
+     * (wrapping around the end). Reversing the rest of the tour instead gives
+     * the same cycle, so whichever stretch is shorter gets flipped. */
+    int len = ((j - i + n) % n) + 1;
+    int k = 0, a = 0, b = 0, tmp = 0;
+    if(2 * len > n) {
+        tmp = i;
+        i = (j + 1) % n;
+        j = (tmp - 1 + n) % n;
+        len = n - len;
+    }
+    for(k = 0; k < len / 2; k++) {
+        a = (i + k) % n;
+        b = (j - k + n) % n;
+        tmp = t[a];
+        t[a] = t[b];
+        t[b] = tmp;
+        pos[t[a]] = a;
+        pos[t[b]] = b;
+    }
+}
+
+static int candidate_count(const TSP_Graph *cand, int n, int a) {
+    return cand ? (cand->rowptr[a + 1] - cand->rowptr[a]) : n;
+}
+
+static int candidate(const TSP_Graph *cand, int a, int k) {
+    return cand ? cand->col[cand->rowptr[a] + k] : k;
+}
+
+void two_opt_wake(TwoOpt *s, int a) {
+    /* Clear a's don't-look bit, and queue it to be looked at again */
+    if(!s->dlb[a]) return;
+    s->dlb[a] = false;
+    s->queue[(s->head + s->queued) % s->n] = a;
+    s->queued++;
+}
+
+static bool log_move(TwoOpt *s, int i, int j) {
+    /* Note a reversal for two_opt_undo() */
+    int *grow = NULL;
+    if(s->nundo + 2 > s->undocap) {
+        grow = realloc(s->undo, (2 * s->undocap + 64) * sizeof(int));
+        if(!grow) return false;
+        s->undo = grow;
+        s->undocap = 2 * s->undocap + 64;
+    }
+    s->undo[s->nundo++] = i;
+    s->undo[s->nundo++] = j;
+    return true;
+}
+
+bool two_opt_init(TwoOpt *s, const TSP_Path *tour, const DistMatrix *dist) {
+    /* Set s up on tour, with every city queued. False if there's no memory
+     * (s is still safe to two_opt_free()). The cost is measured on dist
+     * rather than taken from tour, which may have come from somewhere that
+     * measures differently (a DM_QUANT16 matrix rounds). */
+    int n = tour->n, i = 0;
+    memset(s, 0, sizeof(TwoOpt));
+    s->n = n;
+    for(i = 0; i < n; i++) {
+        s->cost += dm_get(dist, tour->path[i], tour->path[i + 1]);
+    }
+    s->t = malloc(n * sizeof(int));
+    s->pos = malloc(n * sizeof(int));
+    s->dlb = malloc(n * sizeof(bool));
+    s->queue = malloc(n * sizeof(int));
+    if(!s->t || !s->pos || !s->dlb || !s->queue) return false;
+    memcpy(s->t, tour->path, n * sizeof(int));
+    for(i = 0; i < n; i++) {
+        s->pos[s->t[i]] = i;
+        s->dlb[i] = false;
+        s->queue[i] = s->t[i];
+    }
+    s->queued = n;
+    return true;
+}
+
+void two_opt_free(TwoOpt *s) {
+    free(s->t);
+    free(s->pos);
+    free(s->dlb);
+    free(s->queue);
+    free(s->undo);
+    memset(s, 0, sizeof(TwoOpt));
+}
+
+bool two_opt_run(TwoOpt *s, const DistMatrix *dist, const TSP_Graph *cand,
+        const TSP_Stop *stop) {
+    /*
+     * 2-opt local search - take out two edges of the tour and reconnect the
+     * pieces the other way round (reversing the stretch between them), as long
+     * as that makes the tour shorter.
+     *
+     * Given a candidate graph (from reduce_edges(), or any neighbor lists) the
+     * only new edges tried are candidate edges, cheapest first - once the new
+     * edge costs more than the one it would replace there's no gain left and
+     * the rest of the list is skipped. With cand == NULL every city is a
+     * candidate and each pass is O(n^2).
+     *
+     * Don't-look bits: only the queued cities are looked at, and a city is
+     * queued again only when one of its tour edges changes. So after a small
+     * change (an ILS kick, two_opt_wake() on its ends) this costs about as
+     * much as the change, not a sweep of the whole tour.
+     *
+     * Runs until the queue is empty or stop says so. s->cost follows every
+     * move; with s->logging each reversal is kept for two_opt_undo(). Returns
+     * true if the tour got shorter. Assumes a symmetric matrix.
+     */
+    int n = s->n, *t = s->t, *pos = s->pos;
+    bool improved = false;
+    int k = 0, dir = 0, a = 0, b = 0, c = 0, d = 0, cnt = 0, steps = 0;
+    int dab = 0, dac = 0, delta = 0, i = 0, j = 0;
+    if(n < 4) return false;
+    while(s->queued > 0) {
+        if((steps++ & 0x3f) == 0 && tsp_stopped(stop)) break;
+        a = s->queue[s->head];
+        s->head = (s->head + 1) % n;
+        s->queued--;
+        s->dlb[a] = true;
+        // dir 0 looks at a's successor, dir 1 at its predecessor
+        for(dir = 0; dir < 2 && s->dlb[a]; dir++) {
+            b = dir ? t[(pos[a] - 1 + n) % n] : t[(pos[a] + 1) % n];
+            dab = dm_get(dist, a, b);
+            cnt = candidate_count(cand, n, a);
+            for(k = 0; k < cnt; k++) {
+                c = candidate(cand, a, k);
+                if(c == a || c == b) continue;
+                // The candidate weights are only for where to stop - they're
+                // exact, and dist may not be (DM_QUANT16), so the gain comes
+                // from dist or s->cost drifts off the tour's length
+                if(cand && cand->w[cand->rowptr[a] + k] >= dab) break;
+                dac = dm_get(dist, a, c);
+                if(dac >= dab) continue;
+                d = dir ? t[(pos[c] - 1 + n) % n] : t[(pos[c] + 1) % n];
+                if(d == a) continue;
+                delta = dab + dm_get(dist, c, d) - dac - dm_get(dist, b, d);
+                if(delta <= 0) continue;
+                // Swap (a,b),(c,d) for (a,c),(b,d)
+                i = dir ? pos[a] : pos[b];
+                j = dir ? pos[d] : pos[c];
+                reverse_segment(t, pos, n, i, j);
+                if(s->logging && !log_move(s, i, j)) s->lost = true;
+                s->cost -= delta;
+                two_opt_wake(s, a);
+                two_opt_wake(s, b);
+                two_opt_wake(s, c);
+                two_opt_wake(s, d);
+                improved = true;
+                break;
+            }
+        }
+    }
+    return improved;
+}
+
+void two_opt_undo(TwoOpt *s) {
+    /* Take back the logged reversals, newest first - reversing the same
+     * positions again puts every city back where it was. s->cost is left for
+     * the caller, who knows what it was. */
+    while(s->nundo > 0) {
+        s->nundo -= 2;
+        reverse_segment(s->t, s->pos, s->n, s->undo[s->nundo],
+                s->undo[s->nundo + 1]);
+    }
+}
+
+void two_opt_tour(const TwoOpt *s, TSP_Path *tour) {
+    /* Copy s's tour out to tour, rotated to start where tour does */
+    int n = s->n, at = s->pos[tour->path[0]], i = 0;
+    for(i = 0; i < n; i++) tour->path[i] = s->t[(at + i) % n];
+    tour->path[n] = tour->path[0];
+    tour->cost = s->cost;
+}
+
+bool two_opt(const DistMatrix *dist, const TSP_Graph *cand, TSP_Path *tour,
+        const TSP_Stop *stop) {
+    /*
+     * two_opt_run() from scratch: tour is improved in place (still starting
+     * at the same city). Returns true if it got shorter. If stop is set part
+     * way through, tour gets whatever improvement was made up to then.
+     */
+    TwoOpt s;
+    bool improved = false;
+    if(tour->n < 4) return false;
+    if(!two_opt_init(&s, tour, dist)) {
+        tsp_log("Failed to allocate memory for 2-opt!");
+        two_opt_free(&s);
+        return false;
+    }
+    improved = two_opt_run(&s, dist, cand, stop);
+    // Even unchanged, the cost is now the one dist gives
+    two_opt_tour(&s, tour);
+    two_opt_free(&s);
+    return improved;
+}
@@ -0,0 +1,129 @@
+#!/bin/sh
+#
+# Command line checks, run by "make check": files that have to be turned down
+# (exit 1, quickly - not a hang) and files that have to solve to a known cost.
+#
+TSP=${TSP:-./TSP}
+DIR=$(dirname "$0")
+failed=0
+
+check() {
+    # check NAME EXPECTED_STATUS EXPECTED_COST ARGS... (cost "-" for none)
+    name=$1; want=$2; cost=$3; shift 3
+    out=$(timeout 10 "$TSP" "$@" 2>/dev/null)
+    got=$?
+    if [ "$got" -ne "$want" ]; then
+        echo "FAIL $name: exit $got, wanted $want"
+        failed=1
+    elif [ "$cost" != "-" ] && [ "$(echo "$out" | cut -d' ' -f2)" != "$cost" ]; then
+        echo "FAIL $name: cost $(echo "$out" | cut -d' ' -f2), wanted $cost"
+        failed=1
+    else
+        echo "ok   $name"
+    fi
+}
+
+# Asymmetric instances - 2-opt and ILS used to loop forever on these
+for s in hk nn 2opt ils portfolio; do
+    check "atsp12 -s $s" 1 - -s $s "$DIR/atsp12.tsp"
+    check "asym12 -s $s" 1 - -s $s "$DIR/asym12.tsp"
+done
+check "sym12 -s hk" 0 281 -s hk "$DIR/sym12.tsp"
+check "sym12 -s ils" 0 281 -s ils "$DIR/sym12.tsp"
+check "sym12 -s hk --reduce" 0 281 -s hk --reduce "$DIR/sym12.tsp"
+check "sym12 -s 2opt --reduce" 0 - -s 2opt --reduce "$DIR/sym12.tsp"
+
+# Distances or tours too big for an int - these used to come out negative
+check "far4 (coordinates overflow)" 1 - -s hk "$DIR/far4.tsp"
+check "big4 (weights overflow)" 1 - -s hk "$DIR/big4.tsp"
+
+# Node ids repeated or missing
+check "dup3" 1 - "$DIR/dup3.tsp"
+check "missing3" 1 - "$DIR/missing3.tsp"
+
+# Why they were turned down goes to stderr, never into the tours on stdout
+for f in dup3.tsp asym12.tsp split4.graph; do
+    if [ -n "$(timeout 10 "$TSP" "$DIR/$f" 2>/dev/null)" ]; then
+        echo "FAIL $f: diagnostics on stdout"
+        failed=1
+    else
+        echo "ok   $f (nothing on stdout)"
+    fi
+done
+
+# Road networks: solved on shortest paths, or on the roads alone
+check "roads6" 0 60 "$DIR/roads6.graph"
+check "roads6 --roads-only" 0 60 --roads-only -s hk "$DIR/roads6.graph"
+check "star4" 0 6 "$DIR/star4.graph"
+check "star4 --roads-only" 1 - --roads-only "$DIR/star4.graph"
+check "split4 (not connected)" 1 - "$DIR/split4.graph"
+check "huge5 (tour overflows)" 1 - "$DIR/huge5.graph"
+
+# Candidate lists - a lattice is all ties and cocircular points for Delaunay
+for k in quadrant delaunay; do
+    check "grid16 -s 2opt --candidates $k" 0 4000000 -s 2opt --candidates $k \
+        "$DIR/grid16.tsp"
+    check "grid16 -s ils --candidates $k" 0 4000000 -s ils --candidates $k \
+        "$DIR/grid16.tsp"
+done
+check "grid16 --candidates foo" 2 - --candidates foo "$DIR/grid16.tsp"
+
+# Nearest neighbor on a grid for whole number coordinates, a table otherwise
+check "grid16 -s nn" 0 4500000 -s nn "$DIR/grid16.tsp"
+check "frac4 -s nn" 0 30 -s nn "$DIR/frac4.tsp"
+
+# Binary files whose header doesn't fit the file: cut short, or an offset
+# that wraps around past the end and back
+TMP=$(mktemp -d)
+"$TSP" --generate uniform -n 4 -o "$TMP/u4.tspb" 2>/dev/null
+check "u4.tspb" 0 - "$TMP/u4.tspb"
+head -c 100 "$TMP/u4.tspb" > "$TMP/short.tspb"
+check "short.tspb (truncated)" 1 - "$TMP/short.tspb"
+cp "$TMP/u4.tspb" "$TMP/wrap.tspb"
+printf '\300\377\377\377\377\377\377\377' |
+    dd of="$TMP/wrap.tspb" bs=1 seek=32 conv=notrunc 2>/dev/null
+check "wrap.tspb (coords_off wraps)" 1 - "$TMP/wrap.tspb"
+
+# A rounded (quant16) matrix: the cost printed has to be what the tour it
+# came with adds up to on that matrix - lo is 0 (the diagonal), so each
+# distance is rounded to the nearest multiple of ceil(hi / 65535)
+"$TSP" --generate uniform -n 400 -o "$TMP/u400.tsp" 2>/dev/null
+for s in 2opt ils; do
+    out=$(timeout 10 "$TSP" -m quant16 -s $s "$TMP/u400.tsp" 2>/dev/null)
+    len=$(echo "$out" | awk -v f="$TMP/u400.tsp" '
+        function euc(i, j,   dx, dy) {
+            dx = x[i] - x[j]; dy = y[i] - y[j]
+            return int(sqrt(dx * dx + dy * dy) + 0.5)
+        }
+        BEGIN {
+            n = 0
+            while((getline line < f) > 0) {
+                if(line ~ /NODE_COORD_SECTION/) coords = 1
+                else if(coords && split(line, p) == 3) {
+                    x[n] = p[2]; y[n] = p[3]; n++
+                }
+            }
+            for(i = 0; i < n; i++) for(j = 0; j < n; j++) {
+                if(euc(i, j) > hi) hi = euc(i, j)
+            }
+            scale = int((hi + 65534) / 65535)
+        }
+        {
+            for(k = 3; k < NF; k++) {
+                d = euc($k, $(k + 1))
+                len += int((d + int(scale / 2)) / scale) * scale
+            }
+            d = euc($NF, $3)
+            print len + int((d + int(scale / 2)) / scale) * scale
+        }')
+    cost=$(echo "$out" | cut -d' ' -f2)
+    if [ -z "$out" ] || [ "$cost" != "$len" ]; then
+        echo "FAIL u400 -m quant16 -s $s: cost $cost, tour adds up to $len"
+        failed=1
+    else
+        echo "ok   u400 -m quant16 -s $s"
+    fi
+done
+rm -rf "$TMP"
+
+exit $failed